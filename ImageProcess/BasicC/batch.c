@@ -0,0 +1,272 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "batch.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "convert.h"
+#include "stream.h"
+
+/* Rows decoded at a time when an RGB image is expanded to RGBA. */
+#define BATCH_RGB_ROWS 64
+
+/* Size a decoder arena may grow to, for images with large ancillary
+ * chunks.
+ */
+#define BATCH_MAX_ARENA_SIZE (64u << 20)
+
+/* Decodes @filename into @pixels as RGBA8, with the decoder memory taken from
+ * @arena and RGB rows expanded through @scratch, both owned by the worker.
+ */
+static bool decode_file(const struct o_image_batch *self, const char *filename,
+                        uint8_t *pixels, struct png_arena *arena,
+                        uint8_t *scratch) {
+  struct o_image image;
+  if (!o_image_init_from_filename_in_arena(&image, filename, arena))
+    return false;
+
+  if (image.width != self->width || image.height != self->height) {
+    o_image_clear(&image);
+    errno = EINVAL;
+    return false;
+  }
+
+  /* RGB rows go through a small scratch buffer and get expanded on the
+   * way into the item.
+   */
+  bool rgb = image.format == O_IMAGE_FORMAT_RGB;
+  o_convert_func expand =
+      rgb ? o_convert_get_kernel(O_CONVERT_RGB8_TO_RGBA8, o_convert_best_isa())
+          : NULL;
+
+  size_t rgba_stride = (size_t)self->width * 4;
+  size_t decoded_rows = 0;
+  ssize_t size_read;
+  do {
+    size_t first_row;
+    size_t num_rows;
+    if (rgb) {
+      size_read = o_image_read(&image, scratch,
+                               image.row_stride * BATCH_RGB_ROWS, &first_row,
+                               &num_rows);
+      for (size_t y = 0; size_read > 0 && y < num_rows; y++)
+        expand(pixels + (first_row + y) * rgba_stride,
+               scratch + y * image.row_stride, self->width, NULL);
+    } else {
+      size_t offset = decoded_rows * rgba_stride;
+      size_read = o_image_read(&image, pixels + offset,
+                               rgba_stride * self->height - offset,
+                               &first_row, &num_rows);
+    }
+
+    if (size_read > 0) decoded_rows += num_rows;
+  } while (size_read > 0 && decoded_rows < self->height);
+
+  o_image_clear(&image);
+
+  return size_read >= 0 && decoded_rows == self->height;
+}
+
+static void *worker_thread_func(void *data) {
+  struct o_image_batch *self = data;
+
+  /* Every image is the same size, so the worker decodes all of them with
+   * the same memory, allocated once and only grown for an image that needs
+   * more.
+   */
+  struct png_arena arena;
+  uint8_t *scratch = malloc((size_t)self->width * 3 * BATCH_RGB_ROWS);
+  bool has_arena = png_arena_init(&arena, png_arena_budget(self->width));
+
+  for (;;) {
+    /* Wait for a free item. */
+    pthread_mutex_lock(&self->lock);
+    while (self->num_free == 0 && self->next_file < self->num_files &&
+           !self->cancelled)
+      pthread_cond_wait(&self->item_released, &self->lock);
+
+    if (self->cancelled || self->next_file == self->num_files) {
+      pthread_mutex_unlock(&self->lock);
+      break;
+    }
+
+    struct o_image_batch_item *item =
+        &self->items[self->free[--self->num_free]];
+    item->index = self->next_file++;
+    pthread_mutex_unlock(&self->lock);
+
+    /* Decode outside the lock. */
+    uint64_t start = o_image_stream_now_ns();
+    item->ok = scratch != NULL && has_arena &&
+               decode_file(self, self->filenames[item->index], item->pixels,
+                           &arena, scratch);
+
+    /* The budget of the width leaves out ancillary chunks. An image that
+     * exhausts it is decoded again with twice the arena, which the worker
+     * keeps for the rest of the batch.
+     */
+    while (!item->ok && has_arena && arena.exhausted &&
+           arena.size < BATCH_MAX_ARENA_SIZE) {
+      size_t size = arena.size * 2;
+      png_arena_clear(&arena);
+      has_arena = png_arena_init(&arena, size);
+      item->ok = has_arena &&
+                 decode_file(self, self->filenames[item->index], item->pixels,
+                             &arena, scratch);
+    }
+    uint64_t elapsed = o_image_stream_now_ns() - start;
+
+    pthread_mutex_lock(&self->lock);
+    self->stats.decode_ns += elapsed;
+    self->ready[(self->ready_head + self->num_ready) % self->num_items] =
+        item - self->items;
+    self->num_ready++;
+    pthread_cond_signal(&self->item_ready);
+    pthread_mutex_unlock(&self->lock);
+  }
+
+  if (has_arena) png_arena_clear(&arena);
+  free(scratch);
+
+  return NULL;
+}
+
+bool o_image_batch_init(struct o_image_batch *self,
+                        const char *const *filenames, size_t num_files,
+                        uint32_t width, uint32_t height, uint32_t num_threads,
+                        uint32_t max_pending) {
+  assert(self != NULL);
+  assert(filenames != NULL);
+  assert(width > 0 && height > 0);
+  assert(max_pending > 0);
+
+  memset(self, 0x00, sizeof(struct o_image_batch));
+
+  self->filenames = filenames;
+  self->num_files = num_files;
+  self->width = width;
+  self->height = height;
+
+  if (num_threads == 0) {
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    num_threads = num_cpus > 0 ? num_cpus : 1;
+  }
+  self->num_threads = num_threads;
+
+  /* There's no point in more items than workers can fill, plus one being
+   * consumed.
+   */
+  if (max_pending > num_threads + 1) max_pending = num_threads + 1;
+  self->num_items = max_pending;
+
+  pthread_mutex_init(&self->lock, NULL);
+  pthread_cond_init(&self->item_ready, NULL);
+  pthread_cond_init(&self->item_released, NULL);
+
+  self->threads = calloc(num_threads, sizeof(pthread_t));
+  self->items = calloc(max_pending, sizeof(struct o_image_batch_item));
+  self->free = calloc(max_pending, sizeof(uint32_t));
+  self->ready = calloc(max_pending, sizeof(uint32_t));
+  if (self->threads == NULL || self->items == NULL || self->free == NULL ||
+      self->ready == NULL) {
+    o_image_batch_clear(self);
+    errno = ENOMEM;
+    return false;
+  }
+
+  for (uint32_t i = 0; i < max_pending; i++) {
+    self->items[i].pixels = malloc((size_t)width * height * 4);
+    if (self->items[i].pixels == NULL) {
+      o_image_batch_clear(self);
+      errno = ENOMEM;
+      return false;
+    }
+    self->free[self->num_free++] = i;
+  }
+
+  return true;
+}
+
+bool o_image_batch_start(struct o_image_batch *self) {
+  assert(self != NULL);
+  assert(self->num_started == 0);
+
+  for (uint32_t i = 0; i < self->num_threads; i++) {
+    if (pthread_create(&self->threads[i], NULL, worker_thread_func, self) !=
+        0)
+      break;
+    self->num_started++;
+  }
+
+  return self->num_started > 0;
+}
+
+struct o_image_batch_item *o_image_batch_acquire(struct o_image_batch *self) {
+  assert(self != NULL);
+  assert(self->num_started > 0);
+
+  pthread_mutex_lock(&self->lock);
+  uint64_t start = o_image_stream_now_ns();
+  while (self->num_ready == 0 && self->num_returned < self->num_files)
+    pthread_cond_wait(&self->item_ready, &self->lock);
+  self->stats.consume_stall_ns += o_image_stream_now_ns() - start;
+
+  struct o_image_batch_item *item = NULL;
+  if (self->num_ready > 0) {
+    item = &self->items[self->ready[self->ready_head]];
+    self->ready_head = (self->ready_head + 1) % self->num_items;
+    self->num_ready--;
+    self->num_returned++;
+  }
+  pthread_mutex_unlock(&self->lock);
+
+  return item;
+}
+
+void o_image_batch_release(struct o_image_batch *self,
+                           struct o_image_batch_item *item) {
+  assert(self != NULL);
+  assert(item != NULL);
+
+  pthread_mutex_lock(&self->lock);
+  self->free[self->num_free++] = item - self->items;
+  pthread_cond_signal(&self->item_released);
+  pthread_mutex_unlock(&self->lock);
+}
+
+void o_image_batch_clear(struct o_image_batch *self) {
+  assert(self != NULL);
+
+  if (self->num_started > 0) {
+    pthread_mutex_lock(&self->lock);
+    self->cancelled = true;
+    pthread_cond_broadcast(&self->item_released);
+    pthread_mutex_unlock(&self->lock);
+
+    for (uint32_t i = 0; i < self->num_started; i++)
+      pthread_join(self->threads[i], NULL);
+    self->num_started = 0;
+  }
+
+  if (self->items != NULL) {
+    for (uint32_t i = 0; i < self->num_items; i++)
+      free(self->items[i].pixels);
+    free(self->items);
+    self->items = NULL;
+  }
+
+  free(self->free);
+  self->free = NULL;
+  free(self->ready);
+  self->ready = NULL;
+  free(self->threads);
+  self->threads = NULL;
+
+  pthread_mutex_destroy(&self->lock);
+  pthread_cond_destroy(&self->item_ready);
+  pthread_cond_destroy(&self->item_released);
+}
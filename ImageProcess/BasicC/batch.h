@@ -0,0 +1,81 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "image.h"
+
+/* One decoded image of a batch, always expanded to RGBA8. */
+struct o_image_batch_item {
+  /* Position of the file in the batch, e.g. its texture array layer. */
+  size_t index;
+  uint8_t *pixels;
+  bool ok;
+};
+
+struct o_image_batch_stats {
+  /* Time spent decoding, summed over all workers. */
+  uint64_t decode_ns;
+  /* Time the consumer waited for the workers. */
+  uint64_t consume_stall_ns;
+};
+
+/* Decodes many images of the same size on a pool of worker threads. Images
+ * are handed out in completion order, and at most @max_pending decoded
+ * images are held in memory at once.
+ */
+struct o_image_batch {
+  const char *const *filenames;
+  size_t num_files;
+  uint32_t width;
+  uint32_t height;
+
+  pthread_t *threads;
+  uint32_t num_threads;
+  uint32_t num_started;
+
+  struct o_image_batch_item *items;
+  uint32_t num_items;
+  /* Stack of items free for decoding. */
+  uint32_t *free;
+  uint32_t num_free;
+  /* Ring of decoded items waiting for the consumer. */
+  uint32_t *ready;
+  uint32_t ready_head;
+  uint32_t num_ready;
+
+  pthread_mutex_t lock;
+  pthread_cond_t item_ready;
+  pthread_cond_t item_released;
+
+  size_t next_file;
+  size_t num_returned;
+  bool cancelled;
+
+  struct o_image_batch_stats stats;
+};
+
+/* Every image must be @width x @height; others are returned with ok unset.
+ * A @num_threads of 0 uses one worker per online CPU. Each worker decodes
+ * PNGs within a memory budget for the width, doubled for any image whose
+ * ancillary chunks need more, up to 64 MiB; images needing more than that
+ * are returned with ok unset.
+ */
+bool o_image_batch_init(struct o_image_batch *self,
+                        const char *const *filenames, size_t num_files,
+                        uint32_t width, uint32_t height, uint32_t num_threads,
+                        uint32_t max_pending);
+
+bool o_image_batch_start(struct o_image_batch *self);
+
+/* Blocks until another image is decoded. Returns NULL once every image of
+ * the batch has been returned.
+ */
+struct o_image_batch_item *o_image_batch_acquire(struct o_image_batch *self);
+
+/* Hands an item returned by o_image_batch_acquire() back to the workers. */
+void o_image_batch_release(struct o_image_batch *self,
+                           struct o_image_batch_item *item);
+
+void o_image_batch_clear(struct o_image_batch *self);
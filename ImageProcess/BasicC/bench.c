@@ -0,0 +1,286 @@
+/* Micro-benchmarks for the image loading building blocks. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "convert.h"
+#include "image.h"
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void print_result(const char *name, uint64_t elapsed_ns,
+                         uint32_t iterations, uint64_t pixels,
+                         size_t encoded_size) {
+  double ms = elapsed_ns / 1e6 / iterations;
+  double mpixels_per_s = pixels / 1e6 / (ms / 1e3);
+
+  printf("  %-16s %10.2f ms %10.1f MP/s", name, ms, mpixels_per_s);
+  if (encoded_size > 0) printf(" %12zu bytes", encoded_size);
+  printf("\n");
+}
+
+static uint8_t *read_file(const char *filename, size_t *size) {
+  FILE *file = fopen(filename, "rb");
+  if (file == NULL) return NULL;
+
+  fseek(file, 0, SEEK_END);
+  *size = ftell(file);
+  rewind(file);
+
+  uint8_t *data = malloc(*size);
+  if (data != NULL && fread(data, 1, *size, file) != *size) {
+    free(data);
+    data = NULL;
+  }
+
+  fclose(file);
+
+  return data;
+}
+
+/* Decodes a whole in-memory image into @pixels, with PNG decoders allocating
+ * from @arena if not NULL.
+ */
+static bool decode_all(const uint8_t *data, size_t size, uint8_t *pixels,
+                       size_t pixels_size, struct png_arena *arena) {
+  struct o_image image;
+  if (!o_image_init_from_memory_in_arena(&image, data, size, arena))
+    return false;
+
+  size_t offset = 0;
+  ssize_t size_read;
+  do {
+    size_read = o_image_read(&image, pixels + offset, pixels_size - offset,
+                             NULL, NULL);
+    if (size_read < 0) break;
+    offset += size_read;
+  } while (size_read > 0 && offset < pixels_size);
+
+  o_image_clear(&image);
+
+  return offset == pixels_size;
+}
+
+static bool encode_png(const char *filename, const uint8_t *pixels,
+                       uint32_t width, uint32_t height, uint8_t channels) {
+  FILE *file = fopen(filename, "wb");
+  if (file == NULL) return false;
+
+  png_structp png_ptr =
+      png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  png_infop info_ptr = png_create_info_struct(png_ptr);
+  if (setjmp(png_jmpbuf(png_ptr)) != 0) {
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+    fclose(file);
+    return false;
+  }
+
+  png_init_io(png_ptr, file);
+  png_set_IHDR(png_ptr, info_ptr, width, height, 8,
+               channels == 4 ? PNG_COLOR_TYPE_RGB_ALPHA : PNG_COLOR_TYPE_RGB,
+               PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+               PNG_FILTER_TYPE_DEFAULT);
+  png_write_info(png_ptr, info_ptr);
+
+  for (uint32_t y = 0; y < height; y++)
+    png_write_row(png_ptr, pixels + (size_t)y * width * channels);
+
+  png_write_end(png_ptr, info_ptr);
+  png_destroy_write_struct(&png_ptr, &info_ptr);
+  fclose(file);
+
+  return true;
+}
+
+/* Same settings as encode_png(), deflated on every core. */
+static bool encode_png_parallel(const char *filename, const uint8_t *pixels,
+                                uint32_t width, uint32_t height,
+                                uint8_t channels) {
+  struct png_ctx png;
+  if (!png_encoder_init_to_filename(&png, filename, width, height, channels,
+                                    -1, PNG_FILTER_STRATEGY_ADAPTIVE, 0))
+    return false;
+
+  ssize_t size_written =
+      png_write(&png, pixels, (size_t)width * height * channels);
+  bool ok = size_written >= 0 && png.status == PNG_STATUS_DONE;
+  png_clear(&png);
+
+  return ok;
+}
+
+static bool encode_qoi(const char *filename, const uint8_t *pixels,
+                       uint32_t width, uint32_t height, uint8_t channels) {
+  struct qoi_ctx qoi;
+  if (!qoi_encoder_init_to_filename(&qoi, filename, width, height, channels))
+    return false;
+
+  ssize_t size_written =
+      qoi_write(&qoi, pixels, (size_t)width * height * channels);
+  bool ok = size_written >= 0 && qoi.status == QOI_STATUS_DONE;
+  qoi_clear(&qoi);
+
+  return ok;
+}
+
+/* Compares the libpng and QOI paths on the pixels of a PNG image. */
+static int32_t bench_codec(const char *filename, uint32_t iterations) {
+  size_t png_size;
+  uint8_t *png_data = read_file(filename, &png_size);
+  if (png_data == NULL) return EXIT_FAILURE;
+
+  struct o_image image;
+  if (!o_image_init_from_memory(&image, png_data, png_size)) {
+    free(png_data);
+    return EXIT_FAILURE;
+  }
+
+  uint32_t width = image.width;
+  uint32_t height = image.height;
+  uint8_t channels = image.format == O_IMAGE_FORMAT_RGBA ? 4 : 3;
+  size_t pixels_size = image.row_stride * height;
+  uint64_t num_pixels = (uint64_t)width * height;
+  o_image_clear(&image);
+
+  uint8_t *pixels = malloc(pixels_size);
+  uint8_t *decoded = malloc(pixels_size);
+  assert(pixels != NULL && decoded != NULL);
+
+  if (!decode_all(png_data, png_size, pixels, pixels_size, NULL)) {
+    free(pixels);
+    free(decoded);
+    free(png_data);
+    return EXIT_FAILURE;
+  }
+
+  printf("%ux%u, %u channels, %u iterations\n", width, height, channels,
+         iterations);
+
+  uint64_t start = now_ns();
+  for (uint32_t i = 0; i < iterations; i++)
+    decode_all(png_data, png_size, decoded, pixels_size, NULL);
+  print_result("PNG decode", now_ns() - start, iterations, num_pixels,
+               png_size);
+
+  /* The same decode, without a single malloc. */
+  struct png_arena arena;
+  if (png_arena_init(&arena, png_arena_budget(width))) {
+    start = now_ns();
+    for (uint32_t i = 0; i < iterations; i++)
+      decode_all(png_data, png_size, decoded, pixels_size, &arena);
+    print_result("PNG decode arena", now_ns() - start, iterations,
+                 num_pixels, png_size);
+    printf("  %-16s %10zu bytes peak, %zu bytes budget\n", "", arena.peak,
+           arena.size);
+    png_arena_clear(&arena);
+  }
+
+  start = now_ns();
+  for (uint32_t i = 0; i < iterations; i++)
+    encode_png("bench.png", pixels, width, height, channels);
+  uint64_t elapsed = now_ns() - start;
+  size_t encoded_size;
+  free(read_file("bench.png", &encoded_size));
+  print_result("PNG encode", elapsed, iterations, num_pixels, encoded_size);
+
+  start = now_ns();
+  for (uint32_t i = 0; i < iterations; i++)
+    encode_png_parallel("bench.png", pixels, width, height, channels);
+  elapsed = now_ns() - start;
+  free(read_file("bench.png", &encoded_size));
+  print_result("PNG encode MT", elapsed, iterations, num_pixels,
+               encoded_size);
+
+  start = now_ns();
+  for (uint32_t i = 0; i < iterations; i++)
+    encode_qoi("bench.qoi", pixels, width, height, channels);
+  elapsed = now_ns() - start;
+  uint8_t *qoi_data = read_file("bench.qoi", &encoded_size);
+  print_result("QOI encode", elapsed, iterations, num_pixels, encoded_size);
+
+  start = now_ns();
+  for (uint32_t i = 0; i < iterations; i++)
+    decode_all(qoi_data, encoded_size, decoded, pixels_size, NULL);
+  print_result("QOI decode", now_ns() - start, iterations, num_pixels,
+               encoded_size);
+
+  bool lossless = memcmp(pixels, decoded, pixels_size) == 0;
+  printf("QOI round trip: %s\n", lossless ? "lossless" : "MISMATCH");
+
+  free(qoi_data);
+  free(decoded);
+  free(pixels);
+  free(png_data);
+
+  return lossless ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Measures the throughput of every pixel-format kernel on each instruction
+ * set the CPU supports, over rows that stay resident in the L1/L2 caches.
+ */
+static int32_t bench_convert(uint32_t iterations) {
+  enum { ROW_PIXELS = 4096, ROWS_PER_ITERATION = 1024 };
+
+  /* Large enough for 16-bit RGBA source rows. */
+  uint8_t *src = malloc(ROW_PIXELS * 8);
+  uint8_t *dst = malloc(ROW_PIXELS * 8);
+  uint32_t palette[256];
+  assert(src != NULL && dst != NULL);
+
+  for (uint32_t i = 0; i < ROW_PIXELS * 8; i++) src[i] = i * 7;
+  for (uint32_t i = 0; i < 256; i++) palette[i] = i * 0x01010101u;
+
+  printf("%u rows of %u pixels, %u iterations\n", ROWS_PER_ITERATION,
+         ROW_PIXELS, iterations);
+
+  for (int32_t kernel = 0; kernel < O_CONVERT_NUM_KERNELS; kernel++) {
+    printf("%s\n", o_convert_kernel_name(kernel));
+
+    for (int32_t isa = 0; isa < O_CONVERT_NUM_ISAS; isa++) {
+      o_convert_func convert = o_convert_get_kernel(kernel, isa);
+      if (convert == NULL) continue;
+
+      uint64_t start = now_ns();
+      for (uint32_t i = 0; i < iterations * ROWS_PER_ITERATION; i++)
+        convert(dst, src, ROW_PIXELS, palette);
+
+      print_result(o_convert_isa_name(isa), now_ns() - start, iterations,
+                   (uint64_t)ROW_PIXELS * ROWS_PER_ITERATION, 0);
+    }
+  }
+
+  free(dst);
+  free(src);
+
+  return EXIT_SUCCESS;
+}
+
+int32_t main(int32_t argc, char *argv[]) {
+  printf("Usage: %s codec <path-to-PNG-image> [iterations]\n", argv[0]);
+  printf("       %s convert [iterations]\n", argv[0]);
+
+  if (argc < 2) return EXIT_FAILURE;
+
+  if (strcmp(argv[1], "codec") == 0 && argc > 2) {
+    uint32_t iterations = argc > 3 ? strtoul(argv[3], NULL, 10) : 10;
+    return bench_codec(argv[2], iterations > 0 ? iterations : 1);
+  }
+
+  if (strcmp(argv[1], "convert") == 0) {
+    uint32_t iterations = argc > 2 ? strtoul(argv[2], NULL, 10) : 10;
+    return bench_convert(iterations > 0 ? iterations : 1);
+  }
+
+  return EXIT_FAILURE;
+}
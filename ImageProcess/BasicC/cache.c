@@ -0,0 +1,458 @@
+#define _DEFAULT_SOURCE
+
+#include "cache.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+/* Pixels start on a page boundary so they can be mapped and uploaded
+ * without copying.
+ */
+#define CACHE_PIXELS_OFFSET 4096
+#define CACHE_SUFFIX ".oic"
+
+/* Temporary files older than this belong to a store that never finished,
+ * most likely in a process that crashed.
+ */
+#define CACHE_STALE_TEMP_NS (3600ll * 1000000000ll)
+
+static const uint8_t CACHE_MAGIC[8] = {'O', 'I', 'M', 'G', 'C', 'A', 'C', '1'};
+
+struct cache_header {
+  uint8_t magic[8];
+  uint64_t device;
+  uint64_t inode;
+  uint64_t size;
+  uint64_t mtime_ns;
+  uint64_t row_stride;
+  uint32_t width;
+  uint32_t height;
+  uint32_t channels;
+};
+
+static struct {
+  pthread_mutex_t lock;
+  char *directory;
+  uint64_t max_size;
+  /* Bytes in entries, counted by a scan and updated on every store. */
+  uint64_t total_size;
+  /* Set while a store scans the directory, so that the others don't. */
+  bool evicting;
+  struct o_image_cache_stats stats;
+} cache = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+void o_image_cache_disable(void) {
+  pthread_mutex_lock(&cache.lock);
+  free(cache.directory);
+  cache.directory = NULL;
+  pthread_mutex_unlock(&cache.lock);
+}
+
+void o_image_cache_get_stats(struct o_image_cache_stats *stats) {
+  assert(stats != NULL);
+
+  pthread_mutex_lock(&cache.lock);
+  *stats = cache.stats;
+  pthread_mutex_unlock(&cache.lock);
+}
+
+void o_image_cache_entry_init(struct o_image_cache_entry *self) {
+  assert(self != NULL);
+
+  memset(self, 0x00, sizeof(struct o_image_cache_entry));
+  self->file_map.fd = -1;
+  self->fd = -1;
+}
+
+/* Returns the malloc'ed path of the entry for @self's key, or NULL if the
+ * cache is disabled. Must be called with the lock held.
+ */
+static char *cache_entry_path(const struct o_image_cache_entry *self) {
+  if (cache.directory == NULL) return NULL;
+
+  /* FNV-1a over the key. */
+  const uint64_t key[4] = {self->device, self->inode, self->size,
+                           self->mtime_ns};
+  const uint8_t *bytes = (const uint8_t *)key;
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < sizeof(key); i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ull;
+  }
+
+  size_t length = strlen(cache.directory) + 32;
+  char *path = malloc(length);
+  if (path != NULL)
+    snprintf(path, length, "%s/%016" PRIx64 CACHE_SUFFIX, cache.directory,
+             hash);
+
+  return path;
+}
+
+bool o_image_cache_lookup(struct o_image_cache_entry *self,
+                          const char *filename) {
+  assert(self != NULL);
+  assert(filename != NULL);
+
+  o_image_cache_entry_init(self);
+
+  struct stat st;
+  if (stat(filename, &st) != 0 || !S_ISREG(st.st_mode)) return false;
+
+  self->has_key = true;
+  self->device = st.st_dev;
+  self->inode = st.st_ino;
+  self->size = st.st_size;
+  self->mtime_ns = (uint64_t)st.st_mtim.tv_sec * 1000000000ull +
+                   (uint64_t)st.st_mtim.tv_nsec;
+
+  pthread_mutex_lock(&cache.lock);
+  char *path = cache_entry_path(self);
+  pthread_mutex_unlock(&cache.lock);
+  if (path == NULL) return false;
+
+  bool mapped = file_map_open(&self->file_map, path);
+  free(path);
+  if (!mapped) return false;
+
+  const struct cache_header *header = (const void *)self->file_map.data;
+  if (self->file_map.size < CACHE_PIXELS_OFFSET ||
+      memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+      header->device != self->device || header->inode != self->inode ||
+      header->size != self->size || header->mtime_ns != self->mtime_ns ||
+      self->file_map.size - CACHE_PIXELS_OFFSET <
+          header->row_stride * header->height) {
+    file_map_close(&self->file_map);
+    return false;
+  }
+
+  self->width = header->width;
+  self->height = header->height;
+  self->row_stride = header->row_stride;
+  self->channels = header->channels;
+  self->pixels = self->file_map.data + CACHE_PIXELS_OFFSET;
+
+  /* The modification time of an entry records its last use. */
+  futimens(self->file_map.fd, NULL);
+
+  pthread_mutex_lock(&cache.lock);
+  cache.stats.hits++;
+  pthread_mutex_unlock(&cache.lock);
+
+  return true;
+}
+
+void o_image_cache_store_begin(struct o_image_cache_entry *self,
+                               uint32_t width, uint32_t height,
+                               size_t row_stride, uint8_t channels) {
+  assert(self != NULL);
+  assert(self->fd < 0);
+
+  if (!self->has_key) return;
+
+  pthread_mutex_lock(&cache.lock);
+  char *path = cache_entry_path(self);
+  if (path != NULL) cache.stats.misses++;
+  pthread_mutex_unlock(&cache.lock);
+  if (path == NULL) return;
+
+  /* Decode into a temporary file, renamed into place once complete, so that
+   * readers never see a partial entry.
+   */
+  size_t length = strlen(path) + 8;
+  self->path = malloc(length);
+  if (self->path == NULL) {
+    free(path);
+    return;
+  }
+  snprintf(self->path, length, "%s.XXXXXX", path);
+  free(path);
+
+  self->fd = mkstemp(self->path);
+  if (self->fd < 0) {
+    free(self->path);
+    self->path = NULL;
+    return;
+  }
+
+  self->width = width;
+  self->height = height;
+  self->row_stride = row_stride;
+  self->channels = channels;
+  self->stored_rows = 0;
+
+  if (lseek(self->fd, CACHE_PIXELS_OFFSET, SEEK_SET) < 0)
+    o_image_cache_clear(self);
+}
+
+static bool write_all(int32_t fd, const uint8_t *data, size_t size) {
+  while (size > 0) {
+    ssize_t size_written = write(fd, data, size);
+    if (size_written < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    data += size_written;
+    size -= size_written;
+  }
+
+  return true;
+}
+
+struct cache_file {
+  char *path;
+  uint64_t size;
+  int64_t mtime_ns;
+};
+
+/* qsort() comparator, oldest first. */
+static int compare_mtime(const void *a, const void *b) {
+  const struct cache_file *file_a = a;
+  const struct cache_file *file_b = b;
+
+  return (file_a->mtime_ns > file_b->mtime_ns) -
+         (file_a->mtime_ns < file_b->mtime_ns);
+}
+
+/* Removes stale temporary files from @directory, then the least recently
+ * used entries until they fit in @max_size bytes. Adds the entries removed
+ * to @evictions and returns the size of those left. Runs without the lock,
+ * as it touches every file of the directory.
+ */
+static uint64_t cache_scan(const char *directory, uint64_t max_size,
+                           uint64_t *evictions) {
+  DIR *dir = opendir(directory);
+  if (dir == NULL) return 0;
+
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  int64_t now_ns = (int64_t)now.tv_sec * 1000000000ll + now.tv_nsec;
+
+  struct cache_file *files = NULL;
+  size_t num_files = 0;
+  size_t capacity = 0;
+  uint64_t total_size = 0;
+
+  size_t suffix_length = strlen(CACHE_SUFFIX);
+  struct dirent *dirent;
+  while ((dirent = readdir(dir)) != NULL) {
+    /* Entries end with the suffix, and temporary files with the suffix and
+     * the six characters mkstemp() fills in.
+     */
+    size_t name_length = strlen(dirent->d_name);
+    bool is_temp = false;
+    if (name_length > suffix_length + 7 &&
+        strncmp(dirent->d_name + name_length - suffix_length - 7,
+                CACHE_SUFFIX ".", suffix_length + 1) == 0)
+      is_temp = true;
+    else if (name_length <= suffix_length ||
+             strcmp(dirent->d_name + name_length - suffix_length,
+                    CACHE_SUFFIX) != 0)
+      continue;
+
+    struct stat st;
+    if (fstatat(dirfd(dir), dirent->d_name, &st, 0) != 0) continue;
+
+    int64_t mtime_ns =
+        (int64_t)st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+    if (is_temp) {
+      if (now_ns - mtime_ns > CACHE_STALE_TEMP_NS)
+        unlinkat(dirfd(dir), dirent->d_name, 0);
+      continue;
+    }
+
+    if (num_files == capacity) {
+      capacity = capacity > 0 ? capacity * 2 : 64;
+      struct cache_file *grown = realloc(files, capacity * sizeof(*files));
+      if (grown == NULL) break;
+      files = grown;
+    }
+
+    size_t length = strlen(directory) + name_length + 2;
+    char *path = malloc(length);
+    if (path == NULL) break;
+    snprintf(path, length, "%s/%s", directory, dirent->d_name);
+
+    files[num_files++] = (struct cache_file){path, st.st_size, mtime_ns};
+    total_size += st.st_size;
+  }
+  closedir(dir);
+
+  qsort(files, num_files, sizeof(*files), compare_mtime);
+
+  for (size_t i = 0; i < num_files; i++) {
+    if (total_size > max_size && unlink(files[i].path) == 0) {
+      total_size -= files[i].size;
+      (*evictions)++;
+    }
+    free(files[i].path);
+  }
+  free(files);
+
+  return total_size;
+}
+
+bool o_image_cache_enable(const char *directory, uint64_t max_size) {
+  assert(directory != NULL);
+
+  if (mkdir(directory, 0755) != 0 && errno != EEXIST) return false;
+
+  char *copy = strdup(directory);
+  if (copy == NULL) return false;
+
+  /* Seeds the running total, which stores keep up to date from then on. */
+  uint64_t evictions = 0;
+  uint64_t total_size = cache_scan(directory, max_size, &evictions);
+
+  pthread_mutex_lock(&cache.lock);
+  free(cache.directory);
+  cache.directory = copy;
+  cache.max_size = max_size;
+  cache.total_size = total_size;
+  cache.stats.evictions += evictions;
+  pthread_mutex_unlock(&cache.lock);
+
+  return true;
+}
+
+/* Writes the header and publishes the finished entry. */
+static void cache_store_end(struct o_image_cache_entry *self) {
+  struct cache_header header = {
+      .device = self->device,
+      .inode = self->inode,
+      .size = self->size,
+      .mtime_ns = self->mtime_ns,
+      .row_stride = self->row_stride,
+      .width = self->width,
+      .height = self->height,
+      .channels = self->channels,
+  };
+  memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+
+  bool ok = pwrite(self->fd, &header, sizeof(header), 0) ==
+            (ssize_t)sizeof(header);
+  ok = close(self->fd) == 0 && ok;
+  self->fd = -1;
+
+  /* Drop the mkstemp() suffix. */
+  char *path = strdup(self->path);
+  if (path != NULL) {
+    *strrchr(path, '.') = '\0';
+    ok = ok && rename(self->path, path) == 0;
+    free(path);
+  } else {
+    ok = false;
+  }
+
+  if (!ok) {
+    unlink(self->path);
+  } else {
+    /* Only a store that takes the cache over its cap scans the directory.
+     * Entries replaced by a rename are counted twice until then.
+     */
+    char *directory = NULL;
+    uint64_t max_size = 0;
+    pthread_mutex_lock(&cache.lock);
+    cache.stats.stores++;
+    cache.total_size +=
+        CACHE_PIXELS_OFFSET + (uint64_t)self->row_stride * self->height;
+    if (cache.directory != NULL && cache.total_size > cache.max_size &&
+        !cache.evicting) {
+      directory = strdup(cache.directory);
+      max_size = cache.max_size;
+      cache.evicting = directory != NULL;
+    }
+    pthread_mutex_unlock(&cache.lock);
+
+    if (directory != NULL) {
+      uint64_t evictions = 0;
+      uint64_t total_size = cache_scan(directory, max_size, &evictions);
+
+      pthread_mutex_lock(&cache.lock);
+      cache.total_size = total_size;
+      cache.stats.evictions += evictions;
+      cache.evicting = false;
+      pthread_mutex_unlock(&cache.lock);
+      free(directory);
+    }
+  }
+
+  free(self->path);
+  self->path = NULL;
+}
+
+void o_image_cache_store_rows(struct o_image_cache_entry *self,
+                              const void *rows, size_t size) {
+  assert(self != NULL);
+
+  if (self->fd < 0) return;
+
+  assert(size % self->row_stride == 0);
+  if (!write_all(self->fd, rows, size)) {
+    o_image_cache_clear(self);
+    return;
+  }
+
+  self->stored_rows += size / self->row_stride;
+  if (self->stored_rows == self->height) cache_store_end(self);
+}
+
+void o_image_cache_clear(struct o_image_cache_entry *self) {
+  assert(self != NULL);
+
+  file_map_close(&self->file_map);
+  self->pixels = NULL;
+
+  if (self->fd >= 0) {
+    close(self->fd);
+    self->fd = -1;
+    unlink(self->path);
+  }
+
+  free(self->path);
+  self->path = NULL;
+}
+
+ssize_t o_image_cache_read_direct(struct o_image_cache_entry *self,
+                                  const void **data, size_t size,
+                                  size_t *first_row, size_t *num_rows) {
+  assert(self != NULL);
+  assert(data != NULL);
+  assert(self->pixels != NULL);
+  assert(size >= self->row_stride);
+
+  size_t _first_row = self->last_decoded_row;
+  size_t _num_rows = size / self->row_stride;
+  if (_num_rows > self->height - _first_row)
+    _num_rows = self->height - _first_row;
+
+  *data = self->pixels + _first_row * self->row_stride;
+  self->last_decoded_row += _num_rows;
+
+  if (first_row != NULL) *first_row = _first_row;
+
+  if (num_rows != NULL) *num_rows = _num_rows;
+
+  return _num_rows * self->row_stride;
+}
+
+ssize_t o_image_cache_read(struct o_image_cache_entry *self, void *buffer,
+                           size_t size, size_t *first_row, size_t *num_rows) {
+  assert(size == 0 || buffer != NULL);
+
+  const void *data;
+  ssize_t result =
+      o_image_cache_read_direct(self, &data, size, first_row, num_rows);
+  if (result > 0) memcpy(buffer, data, result);
+
+  return result;
+}
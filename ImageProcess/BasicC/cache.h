@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "file_map.h"
+
+/* Optional on-disk cache of decoded pixels. Entries are keyed by the source
+ * file's device, inode, size and modification time, and hold the raw rows
+ * page-aligned after a small header, so a hit is served straight from a
+ * mapping of the entry instead of inflating the source again.
+ *
+ * The cache is shared by the whole process and disabled until
+ * o_image_cache_enable() is called.
+ */
+
+struct o_image_cache_stats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t stores;
+  uint64_t evictions;
+};
+
+/* Creates @directory if needed. Once the entries exceed @max_size bytes, the
+ * least recently used ones are removed, along with temporary files that
+ * stores which never finished left behind.
+ */
+bool o_image_cache_enable(const char *directory, uint64_t max_size);
+
+void o_image_cache_disable(void);
+
+void o_image_cache_get_stats(struct o_image_cache_stats *stats);
+
+/* A cached image being read back, or a decoded image being stored. */
+struct o_image_cache_entry {
+  struct file_map file_map;
+  const uint8_t *pixels;
+
+  uint32_t width;
+  uint32_t height;
+  size_t row_stride;
+  uint8_t channels;
+  size_t last_decoded_row;
+
+  /* Key of the source file, from the last lookup. */
+  bool has_key;
+  uint64_t device;
+  uint64_t inode;
+  uint64_t size;
+  uint64_t mtime_ns;
+
+  /* Temporary file receiving decoded rows. */
+  int32_t fd;
+  char *path;
+  size_t stored_rows;
+};
+
+/* Resets @self so that o_image_cache_clear() is always safe to call. */
+void o_image_cache_entry_init(struct o_image_cache_entry *self);
+
+/* Returns true on a hit, with @self ready for o_image_cache_read(). On a
+ * miss, @self remembers the key of @filename for o_image_cache_store_begin().
+ */
+bool o_image_cache_lookup(struct o_image_cache_entry *self,
+                          const char *filename);
+
+/* Starts storing the decoded rows of the file from the last missed lookup.
+ * Does nothing if the cache is disabled.
+ */
+void o_image_cache_store_begin(struct o_image_cache_entry *self,
+                               uint32_t width, uint32_t height,
+                               size_t row_stride, uint8_t channels);
+
+/* Appends whole decoded rows. The entry is published once the last row is
+ * stored; on any error the store is silently abandoned.
+ */
+void o_image_cache_store_rows(struct o_image_cache_entry *self,
+                              const void *rows, size_t size);
+
+/* Unmaps a hit, or discards an unfinished store. */
+void o_image_cache_clear(struct o_image_cache_entry *self);
+
+ssize_t o_image_cache_read(struct o_image_cache_entry *self, void *buffer,
+                           size_t size, size_t *first_row, size_t *num_rows);
+
+ssize_t o_image_cache_read_direct(struct o_image_cache_entry *self,
+                                  const void **data, size_t size,
+                                  size_t *first_row, size_t *num_rows);
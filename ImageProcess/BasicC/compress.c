@@ -0,0 +1,1058 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "compress.h"
+
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "convert.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define O_COMPRESS_X86 1
+#include <immintrin.h>
+#endif
+
+/* Pixels of a 4x4 block in row-major order. ETC and EAC number their pixels
+ * column by column instead, so they index blocks with x * 4 + y.
+ */
+typedef uint8_t block_t[16][4];
+
+static inline uint32_t sq(int32_t v) { return v * v; }
+
+static inline int32_t clamp255(int32_t v) {
+  return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+static inline float clampf(float v, float lo, float hi) {
+  return v < lo ? lo : v > hi ? hi : v;
+}
+
+static void load_block(const uint8_t *pixels, uint32_t width, uint32_t height,
+                       uint32_t bx, uint32_t by, block_t block) {
+  for (uint32_t y = 0; y < 4; y++) {
+    uint32_t py = by * 4 + y < height ? by * 4 + y : height - 1;
+    for (uint32_t x = 0; x < 4; x++) {
+      uint32_t px = bx * 4 + x < width ? bx * 4 + x : width - 1;
+      memcpy(block[y * 4 + x], pixels + ((size_t)py * width + px) * 4, 4);
+    }
+  }
+}
+
+static void store_block(const block_t block, uint32_t width, uint32_t height,
+                        uint32_t bx, uint32_t by, uint8_t *pixels) {
+  for (uint32_t y = 0; y < 4 && by * 4 + y < height; y++) {
+    for (uint32_t x = 0; x < 4 && bx * 4 + x < width; x++) {
+      memcpy(pixels + ((size_t)(by * 4 + y) * width + bx * 4 + x) * 4,
+             block[y * 4 + x], 4);
+    }
+  }
+}
+
+/* Picks two endpoints spanning the block's colors: the bounding box corners
+ * for FAST, otherwise the extremes of the colors projected on their
+ * principal axis.
+ */
+static void fit_endpoints(const block_t block, uint32_t channels,
+                          enum o_compress_quality quality, float e0[4],
+                          float e1[4]) {
+  float lo[4] = {255, 255, 255, 255};
+  float hi[4] = {0, 0, 0, 0};
+  float mean[4] = {0};
+  for (uint32_t i = 0; i < 16; i++) {
+    for (uint32_t c = 0; c < channels; c++) {
+      lo[c] = block[i][c] < lo[c] ? block[i][c] : lo[c];
+      hi[c] = block[i][c] > hi[c] ? block[i][c] : hi[c];
+      mean[c] += block[i][c] / 16.0f;
+    }
+  }
+
+  if (quality == O_COMPRESS_QUALITY_FAST) {
+    memcpy(e0, lo, sizeof(lo));
+    memcpy(e1, hi, sizeof(hi));
+    return;
+  }
+
+  float cov[4][4] = {{0}};
+  for (uint32_t i = 0; i < 16; i++) {
+    for (uint32_t a = 0; a < channels; a++) {
+      for (uint32_t b = 0; b < channels; b++)
+        cov[a][b] += (block[i][a] - mean[a]) * (block[i][b] - mean[b]);
+    }
+  }
+
+  /* Power iteration, starting from the bounding box diagonal. */
+  float axis[4] = {0};
+  for (uint32_t c = 0; c < channels; c++) axis[c] = hi[c] - lo[c];
+  for (uint32_t iteration = 0; iteration < 8; iteration++) {
+    float next[4] = {0};
+    float norm = 0;
+    for (uint32_t a = 0; a < channels; a++) {
+      for (uint32_t b = 0; b < channels; b++) next[a] += cov[a][b] * axis[b];
+      norm = fabsf(next[a]) > norm ? fabsf(next[a]) : norm;
+    }
+    if (norm < 1e-6f) break;
+    for (uint32_t c = 0; c < channels; c++) axis[c] = next[c] / norm;
+  }
+
+  float t_min = 0;
+  float t_max = 0;
+  float length = 0;
+  for (uint32_t c = 0; c < channels; c++) length += axis[c] * axis[c];
+  if (length > 1e-12f) {
+    t_min = INFINITY;
+    t_max = -INFINITY;
+    for (uint32_t i = 0; i < 16; i++) {
+      float t = 0;
+      for (uint32_t c = 0; c < channels; c++)
+        t += (block[i][c] - mean[c]) * axis[c];
+      t /= length;
+      t_min = t < t_min ? t : t_min;
+      t_max = t > t_max ? t : t_max;
+    }
+  }
+
+  for (uint32_t c = 0; c < channels; c++) {
+    e0[c] = clampf(mean[c] + axis[c] * t_min, 0, 255);
+    e1[c] = clampf(mean[c] + axis[c] * t_max, 0, 255);
+  }
+}
+
+/* Least-squares endpoints for colors interpolated with @weights (the weight
+ * of e0, per pixel). Returns false if the system is singular.
+ */
+static bool refine_endpoints(const block_t block, uint32_t channels,
+                             const float weights[16], float e0[4],
+                             float e1[4]) {
+  float aa = 0, bb = 0, ab = 0;
+  float ax[4] = {0}, bx[4] = {0};
+  for (uint32_t i = 0; i < 16; i++) {
+    float a = weights[i];
+    float b = 1 - a;
+    aa += a * a;
+    bb += b * b;
+    ab += a * b;
+    for (uint32_t c = 0; c < channels; c++) {
+      ax[c] += a * block[i][c];
+      bx[c] += b * block[i][c];
+    }
+  }
+
+  float det = aa * bb - ab * ab;
+  if (fabsf(det) < 1e-6f) return false;
+
+  for (uint32_t c = 0; c < channels; c++) {
+    e0[c] = clampf((ax[c] * bb - bx[c] * ab) / det, 0, 255);
+    e1[c] = clampf((bx[c] * aa - ax[c] * ab) / det, 0, 255);
+  }
+
+  return true;
+}
+
+/* Finds the nearest of @num_colors @palette entries, by the squared error
+ * of the first @channels channels, for each pixel of the block. Stores their
+ * indices and returns the total error. Ties go to the first entry.
+ */
+typedef uint32_t (*nearest_colors_func)(const block_t block,
+                                        const uint8_t palette[][4],
+                                        uint32_t num_colors, uint32_t channels,
+                                        uint8_t indices[16]);
+
+static uint32_t nearest_colors_scalar(const block_t block,
+                                      const uint8_t palette[][4],
+                                      uint32_t num_colors, uint32_t channels,
+                                      uint8_t indices[16]) {
+  uint32_t total_error = 0;
+  for (uint32_t i = 0; i < 16; i++) {
+    uint32_t best_error = UINT32_MAX;
+    for (uint32_t p = 0; p < num_colors; p++) {
+      uint32_t error = 0;
+      for (uint32_t c = 0; c < channels; c++)
+        error += sq(block[i][c] - palette[p][c]);
+      if (error < best_error) {
+        best_error = error;
+        indices[i] = p;
+      }
+    }
+    total_error += best_error;
+  }
+
+  return total_error;
+}
+
+#ifdef O_COMPRESS_X86
+/* Compares each pixel with four entries at a time. The error, below 2^18,
+ * is shifted over the entry's index, so the smallest key is both the best
+ * entry and the first of equal ones.
+ */
+__attribute__((target("sse4.1"))) static uint32_t nearest_colors_sse4(
+    const block_t block, const uint8_t palette[][4], uint32_t num_colors,
+    uint32_t channels, uint8_t indices[16]) {
+  assert(num_colors % 4 == 0 && num_colors <= 16);
+
+  const __m128i mask = _mm_set1_epi32(channels == 4 ? -1 : 0x00ffffff);
+  __m128i entries[4];
+  for (uint32_t g = 0; g < num_colors / 4; g++)
+    entries[g] = _mm_and_si128(
+        _mm_loadu_si128((const __m128i *)palette[g * 4]), mask);
+
+  uint32_t total_error = 0;
+  for (uint32_t i = 0; i < 16; i++) {
+    uint32_t value;
+    memcpy(&value, block[i], 4);
+    const __m128i pixel = _mm_and_si128(_mm_set1_epi32(value), mask);
+
+    __m128i best = _mm_set1_epi32(-1);
+    for (uint32_t g = 0; g < num_colors / 4; g++) {
+      const __m128i diff = _mm_or_si128(_mm_subs_epu8(pixel, entries[g]),
+                                        _mm_subs_epu8(entries[g], pixel));
+      const __m128i low = _mm_cvtepu8_epi16(diff);
+      const __m128i high = _mm_cvtepu8_epi16(_mm_srli_si128(diff, 8));
+      const __m128i errors = _mm_hadd_epi32(_mm_madd_epi16(low, low),
+                                            _mm_madd_epi16(high, high));
+      const __m128i keys =
+          _mm_or_si128(_mm_slli_epi32(errors, 4),
+                       _mm_setr_epi32(g * 4, g * 4 + 1, g * 4 + 2, g * 4 + 3));
+      best = _mm_min_epu32(best, keys);
+    }
+    best = _mm_min_epu32(best, _mm_shuffle_epi32(best, 0x4e));
+    best = _mm_min_epu32(best, _mm_shuffle_epi32(best, 0xb1));
+
+    const uint32_t key = _mm_cvtsi128_si32(best);
+    indices[i] = key & 15;
+    total_error += key >> 4;
+  }
+
+  return total_error;
+}
+#endif
+
+static nearest_colors_func nearest_colors = nearest_colors_scalar;
+static pthread_once_t nearest_colors_once = PTHREAD_ONCE_INIT;
+
+static void select_nearest_colors(void) {
+#ifdef O_COMPRESS_X86
+  if (o_convert_best_isa() >= O_CONVERT_ISA_SSE4)
+    nearest_colors = nearest_colors_sse4;
+#endif
+}
+
+/* BC1. */
+
+static uint16_t pack565(const float c[4]) {
+  uint32_t r = lrintf(clampf(c[0], 0, 255) * 31 / 255);
+  uint32_t g = lrintf(clampf(c[1], 0, 255) * 63 / 255);
+  uint32_t b = lrintf(clampf(c[2], 0, 255) * 31 / 255);
+
+  return r << 11 | g << 5 | b;
+}
+
+static void unpack565(uint16_t v, int32_t rgb[3]) {
+  int32_t r = v >> 11 & 31;
+  int32_t g = v >> 5 & 63;
+  int32_t b = v & 31;
+  rgb[0] = r << 3 | r >> 2;
+  rgb[1] = g << 2 | g >> 4;
+  rgb[2] = b << 3 | b >> 2;
+}
+
+/* Four-color palette for c0 > c1; equal endpoints give a flat palette. */
+static void bc1_palette(uint16_t c0, uint16_t c1, int32_t palette[4][3]) {
+  unpack565(c0, palette[0]);
+  unpack565(c1, palette[1]);
+  for (uint32_t c = 0; c < 3; c++) {
+    if (c0 == c1) {
+      palette[2][c] = palette[3][c] = palette[0][c];
+    } else {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+  }
+}
+
+static uint32_t bc1_indices(const block_t block, uint16_t c0, uint16_t c1,
+                            uint32_t *error) {
+  int32_t palette[4][3];
+  bc1_palette(c0, c1, palette);
+
+  uint8_t colors[4][4] = {{0}};
+  for (uint32_t p = 0; p < 4; p++) {
+    for (uint32_t c = 0; c < 3; c++) colors[p][c] = palette[p][c];
+  }
+
+  uint8_t nearest[16];
+  *error = nearest_colors(block, colors, 4, 3, nearest);
+
+  uint32_t indices = 0;
+  for (uint32_t i = 0; i < 16; i++) indices |= (uint32_t)nearest[i] << (i * 2);
+
+  return indices;
+}
+
+static void bc1_encode_block(const block_t block,
+                             enum o_compress_quality quality, uint8_t *out) {
+  static const float WEIGHTS[4] = {1, 0, 2.0f / 3, 1.0f / 3};
+
+  float e0[4], e1[4];
+  fit_endpoints(block, 3, quality, e0, e1);
+
+  /* Four-color blocks need c0 > c1. */
+  uint16_t c0 = pack565(e1);
+  uint16_t c1 = pack565(e0);
+  if (c0 < c1) {
+    uint16_t t = c0;
+    c0 = c1;
+    c1 = t;
+  }
+  uint32_t error;
+  uint32_t indices = bc1_indices(block, c0, c1, &error);
+
+  for (uint32_t iteration = 0;
+       quality == O_COMPRESS_QUALITY_BEST && iteration < 2 && error > 0;
+       iteration++) {
+    float weights[16];
+    for (uint32_t i = 0; i < 16; i++)
+      weights[i] = WEIGHTS[indices >> (i * 2) & 3];
+    if (!refine_endpoints(block, 3, weights, e0, e1)) break;
+
+    uint16_t r0 = pack565(e0);
+    uint16_t r1 = pack565(e1);
+    if (r0 < r1) {
+      uint16_t t = r0;
+      r0 = r1;
+      r1 = t;
+    }
+    uint32_t refined_error;
+    uint32_t refined = bc1_indices(block, r0, r1, &refined_error);
+    if (refined_error >= error) break;
+
+    c0 = r0;
+    c1 = r1;
+    indices = refined;
+    error = refined_error;
+  }
+
+  if (c0 == c1) indices = 0;
+
+  out[0] = c0;
+  out[1] = c0 >> 8;
+  out[2] = c1;
+  out[3] = c1 >> 8;
+  for (uint32_t i = 0; i < 4; i++) out[4 + i] = indices >> (i * 8);
+}
+
+static void bc1_decode_block(const uint8_t *in, block_t block) {
+  uint16_t c0 = in[0] | in[1] << 8;
+  uint16_t c1 = in[2] | in[3] << 8;
+  uint32_t indices = in[4] | in[5] << 8 | in[6] << 16 | (uint32_t)in[7] << 24;
+
+  int32_t palette[4][4];
+  unpack565(c0, palette[0]);
+  unpack565(c1, palette[1]);
+  for (uint32_t c = 0; c < 3; c++) {
+    if (c0 > c1) {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    } else {
+      palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+      palette[3][c] = 0;
+    }
+  }
+  palette[0][3] = palette[1][3] = palette[2][3] = 255;
+  palette[3][3] = c0 > c1 ? 255 : 0;
+
+  for (uint32_t i = 0; i < 16; i++) {
+    const int32_t *color = palette[indices >> (i * 2) & 3];
+    for (uint32_t c = 0; c < 4; c++) block[i][c] = color[c];
+  }
+}
+
+/* ETC1, as the individual and differential modes of ETC2 RGB8. */
+
+static const int32_t ETC_MODIFIERS[8][2] = {
+    {2, 8}, {5, 17}, {9, 29}, {13, 42}, {18, 60}, {24, 80}, {33, 106},
+    {47, 183},
+};
+
+/* Pixel index codes 0-3 stand for +a, +b, -a, -b. */
+static inline int32_t etc_modifier(uint32_t table, uint32_t code) {
+  int32_t modifier = ETC_MODIFIERS[table][code & 1];
+  return code & 2 ? -modifier : modifier;
+}
+
+static inline bool etc_in_subblock(uint32_t x, uint32_t y, bool flip,
+                                   uint32_t subblock) {
+  return (flip ? y >= 2 : x >= 2) == (subblock == 1);
+}
+
+/* Finds the best table and pixel codes of a subblock around @base. */
+static uint32_t etc_fit_subblock(const block_t block, bool flip,
+                                 uint32_t subblock, const int32_t base[3],
+                                 uint32_t *table, uint8_t codes[16]) {
+  uint32_t best_error = UINT32_MAX;
+  for (uint32_t t = 0; t < 8; t++) {
+    uint32_t error = 0;
+    uint8_t t_codes[16];
+    for (uint32_t y = 0; y < 4; y++) {
+      for (uint32_t x = 0; x < 4; x++) {
+        if (!etc_in_subblock(x, y, flip, subblock)) continue;
+
+        const uint8_t *p = block[y * 4 + x];
+        uint32_t best_pixel_error = UINT32_MAX;
+        for (uint32_t code = 0; code < 4; code++) {
+          int32_t m = etc_modifier(t, code);
+          uint32_t e = sq(clamp255(base[0] + m) - p[0]) +
+                       sq(clamp255(base[1] + m) - p[1]) +
+                       sq(clamp255(base[2] + m) - p[2]);
+          if (e < best_pixel_error) {
+            best_pixel_error = e;
+            t_codes[x * 4 + y] = code;
+          }
+        }
+        error += best_pixel_error;
+      }
+    }
+
+    if (error < best_error) {
+      best_error = error;
+      *table = t;
+      for (uint32_t y = 0; y < 4; y++) {
+        for (uint32_t x = 0; x < 4; x++) {
+          if (etc_in_subblock(x, y, flip, subblock))
+            codes[x * 4 + y] = t_codes[x * 4 + y];
+        }
+      }
+    }
+  }
+
+  return best_error;
+}
+
+struct etc_candidate {
+  bool diff;
+  bool flip;
+  /* 5-bit colors in differential mode, 4-bit otherwise. */
+  int32_t colors[2][3];
+  uint32_t tables[2];
+  uint8_t codes[16];
+  uint32_t error;
+};
+
+static void etc_expand(const struct etc_candidate *candidate,
+                       uint32_t subblock, int32_t base[3]) {
+  for (uint32_t c = 0; c < 3; c++) {
+    int32_t v = candidate->colors[subblock][c];
+    base[c] = candidate->diff ? v << 3 | v >> 2 : v * 17;
+  }
+}
+
+static bool etc_valid(const struct etc_candidate *candidate) {
+  int32_t max = candidate->diff ? 31 : 15;
+  for (uint32_t s = 0; s < 2; s++) {
+    for (uint32_t c = 0; c < 3; c++) {
+      if (candidate->colors[s][c] < 0 || candidate->colors[s][c] > max)
+        return false;
+      /* Larger deltas would select the ETC2 T, H or planar modes. */
+      int32_t delta = candidate->colors[1][c] - candidate->colors[0][c];
+      if (candidate->diff && (delta < -4 || delta > 3)) return false;
+    }
+  }
+
+  return true;
+}
+
+static uint32_t etc_evaluate(const block_t block,
+                             struct etc_candidate *candidate) {
+  candidate->error = 0;
+  for (uint32_t s = 0; s < 2; s++) {
+    int32_t base[3];
+    etc_expand(candidate, s, base);
+    candidate->error += etc_fit_subblock(block, candidate->flip, s, base,
+                                         &candidate->tables[s],
+                                         candidate->codes);
+  }
+
+  return candidate->error;
+}
+
+static uint64_t etc_pack(const struct etc_candidate *candidate) {
+  const int32_t(*colors)[3] = candidate->colors;
+  uint64_t word = 0;
+
+  if (candidate->diff) {
+    for (uint32_t c = 0; c < 3; c++) {
+      word |= (uint64_t)colors[0][c] << (59 - c * 8);
+      word |= (uint64_t)((colors[1][c] - colors[0][c]) & 7) << (56 - c * 8);
+    }
+  } else {
+    for (uint32_t c = 0; c < 3; c++) {
+      word |= (uint64_t)colors[0][c] << (60 - c * 8);
+      word |= (uint64_t)colors[1][c] << (56 - c * 8);
+    }
+  }
+
+  word |= (uint64_t)candidate->tables[0] << 37;
+  word |= (uint64_t)candidate->tables[1] << 34;
+  word |= (uint64_t)candidate->diff << 33;
+  word |= (uint64_t)candidate->flip << 32;
+
+  for (uint32_t i = 0; i < 16; i++) {
+    word |= (uint64_t)(candidate->codes[i] >> 1) << (16 + i);
+    word |= (uint64_t)(candidate->codes[i] & 1) << i;
+  }
+
+  return word;
+}
+
+static uint64_t etc_encode_block(const block_t block,
+                                 enum o_compress_quality quality) {
+  struct etc_candidate best = {.error = UINT32_MAX};
+
+  for (uint32_t flip = 0; flip < 2; flip++) {
+    float mean[2][3] = {{0}};
+    for (uint32_t y = 0; y < 4; y++) {
+      for (uint32_t x = 0; x < 4; x++) {
+        uint32_t s = etc_in_subblock(x, y, flip, 1);
+        for (uint32_t c = 0; c < 3; c++)
+          mean[s][c] += block[y * 4 + x][c] / 8.0f;
+      }
+    }
+
+    for (uint32_t diff = 0; diff < 2; diff++) {
+      struct etc_candidate candidate = {.diff = diff, .flip = flip};
+      float scale = diff ? 31.0f / 255 : 15.0f / 255;
+      for (uint32_t s = 0; s < 2; s++) {
+        for (uint32_t c = 0; c < 3; c++)
+          candidate.colors[s][c] = lrintf(mean[s][c] * scale);
+      }
+
+      if (!etc_valid(&candidate)) continue;
+      etc_evaluate(block, &candidate);
+
+      /* Nudge the brightness of each subblock's base color. */
+      for (uint32_t s = 0; quality == O_COMPRESS_QUALITY_BEST && s < 2; s++) {
+        for (int32_t delta = -1; delta <= 1; delta += 2) {
+          struct etc_candidate nudged = candidate;
+          for (uint32_t c = 0; c < 3; c++) nudged.colors[s][c] += delta;
+          if (etc_valid(&nudged) &&
+              etc_evaluate(block, &nudged) < candidate.error)
+            candidate = nudged;
+        }
+      }
+
+      if (candidate.error < best.error) best = candidate;
+    }
+
+    /* FAST keeps the first layout. */
+    if (quality == O_COMPRESS_QUALITY_FAST) break;
+  }
+
+  return etc_pack(&best);
+}
+
+static void etc_decode_block(uint64_t word, block_t block) {
+  bool diff = word >> 33 & 1;
+  bool flip = word >> 32 & 1;
+  uint32_t tables[2] = {word >> 37 & 7, word >> 34 & 7};
+
+  int32_t bases[2][3];
+  for (uint32_t c = 0; c < 3; c++) {
+    if (diff) {
+      int32_t c0 = word >> (59 - c * 8) & 31;
+      int32_t delta = word >> (56 - c * 8) & 7;
+      int32_t c1 = c0 + (delta >= 4 ? delta - 8 : delta);
+      bases[0][c] = c0 << 3 | c0 >> 2;
+      bases[1][c] = c1 << 3 | c1 >> 2;
+    } else {
+      bases[0][c] = (word >> (60 - c * 8) & 15) * 17;
+      bases[1][c] = (word >> (56 - c * 8) & 15) * 17;
+    }
+  }
+
+  for (uint32_t y = 0; y < 4; y++) {
+    for (uint32_t x = 0; x < 4; x++) {
+      uint32_t i = x * 4 + y;
+      uint32_t s = etc_in_subblock(x, y, flip, 1);
+      uint32_t code = (word >> (16 + i) & 1) << 1 | (word >> i & 1);
+      int32_t m = etc_modifier(tables[s], code);
+      for (uint32_t c = 0; c < 3; c++)
+        block[y * 4 + x][c] = clamp255(bases[s][c] + m);
+      block[y * 4 + x][3] = 255;
+    }
+  }
+}
+
+/* EAC alpha. */
+
+static const int32_t EAC_MODIFIERS[16][8] = {
+    {-3, -6, -9, -15, 2, 5, 8, 14},  {-3, -7, -10, -13, 2, 6, 9, 12},
+    {-2, -5, -8, -13, 1, 4, 7, 12},  {-2, -4, -6, -13, 1, 3, 5, 12},
+    {-3, -6, -8, -12, 2, 5, 7, 11},  {-3, -7, -9, -11, 2, 6, 8, 10},
+    {-4, -7, -8, -11, 3, 6, 7, 10},  {-3, -5, -8, -11, 2, 4, 7, 10},
+    {-2, -6, -8, -10, 1, 5, 7, 9},   {-2, -5, -8, -10, 1, 4, 7, 9},
+    {-2, -4, -8, -10, 1, 3, 7, 9},   {-2, -5, -7, -10, 1, 4, 6, 9},
+    {-3, -4, -7, -10, 2, 3, 6, 9},   {-1, -2, -3, -10, 0, 1, 2, 9},
+    {-4, -6, -8, -9, 3, 5, 7, 8},    {-3, -5, -7, -9, 2, 4, 6, 8},
+};
+
+static uint32_t eac_fit(const block_t block, int32_t base,
+                        int32_t multiplier, uint32_t table,
+                        uint64_t *indices) {
+  uint32_t error = 0;
+  *indices = 0;
+  for (uint32_t y = 0; y < 4; y++) {
+    for (uint32_t x = 0; x < 4; x++) {
+      int32_t alpha = block[y * 4 + x][3];
+      uint32_t best = 0;
+      uint32_t best_error = UINT32_MAX;
+      for (uint32_t index = 0; index < 8; index++) {
+        int32_t value =
+            clamp255(base + EAC_MODIFIERS[table][index] * multiplier);
+        if (sq(value - alpha) < best_error) {
+          best_error = sq(value - alpha);
+          best = index;
+        }
+      }
+      *indices |= (uint64_t)best << (45 - (x * 4 + y) * 3);
+      error += best_error;
+    }
+  }
+
+  return error;
+}
+
+static uint64_t eac_encode_block(const block_t block,
+                                 enum o_compress_quality quality) {
+  int32_t lo = 255;
+  int32_t hi = 0;
+  for (uint32_t i = 0; i < 16; i++) {
+    lo = block[i][3] < lo ? block[i][3] : lo;
+    hi = block[i][3] > hi ? block[i][3] : hi;
+  }
+
+  int32_t radius = quality == O_COMPRESS_QUALITY_FAST ? 0
+                   : quality == O_COMPRESS_QUALITY_NORMAL ? 1
+                                                          : 2;
+
+  uint32_t best_error = UINT32_MAX;
+  uint64_t best_word = 0;
+  for (uint32_t table = 0; table < 16 && best_error > 0; table++) {
+    const int32_t *modifiers = EAC_MODIFIERS[table];
+    int32_t span = modifiers[7] - modifiers[3];
+
+    int32_t multiplier = (hi - lo + span / 2) / span;
+    multiplier = multiplier < 1 ? 1 : multiplier > 15 ? 15 : multiplier;
+    for (int32_t m = multiplier - radius; m <= multiplier + radius; m++) {
+      if (m < 1 || m > 15) continue;
+
+      int32_t mid = (hi + lo - (modifiers[7] + modifiers[3]) * m) / 2;
+      for (int32_t base = mid - radius; base <= mid + radius; base++) {
+        if (base < 0 || base > 255) continue;
+
+        uint64_t indices;
+        uint32_t error = eac_fit(block, base, m, table, &indices);
+        if (error < best_error) {
+          best_error = error;
+          best_word = (uint64_t)base << 56 | (uint64_t)m << 52 |
+                      (uint64_t)table << 48 | indices;
+        }
+      }
+    }
+  }
+
+  return best_word;
+}
+
+static void eac_decode_block(uint64_t word, block_t block) {
+  int32_t base = word >> 56 & 255;
+  int32_t multiplier = word >> 52 & 15;
+  uint32_t table = word >> 48 & 15;
+
+  for (uint32_t y = 0; y < 4; y++) {
+    for (uint32_t x = 0; x < 4; x++) {
+      uint32_t index = word >> (45 - (x * 4 + y) * 3) & 7;
+      block[y * 4 + x][3] =
+          clamp255(base + EAC_MODIFIERS[table][index] * multiplier);
+    }
+  }
+}
+
+static void write_u64_be(uint8_t *out, uint64_t word) {
+  for (uint32_t i = 0; i < 8; i++) out[i] = word >> (56 - i * 8);
+}
+
+static uint64_t read_u64_be(const uint8_t *in) {
+  uint64_t word = 0;
+  for (uint32_t i = 0; i < 8; i++) word = word << 8 | in[i];
+
+  return word;
+}
+
+/* BC7 mode 6. */
+
+static const int32_t BC7_WEIGHTS[16] = {0,  4,  9,  13, 17, 21, 26, 30,
+                                        34, 38, 43, 47, 51, 55, 60, 64};
+
+struct bc7_candidate {
+  /* 7-bit endpoints and their p-bits. */
+  int32_t colors[2][4];
+  uint32_t pbits[2];
+  uint8_t indices[16];
+  uint32_t error;
+};
+
+static void bc7_quantize(const float e[4], uint32_t pbit, int32_t out[4]) {
+  for (uint32_t c = 0; c < 4; c++) {
+    int32_t v = lrintf((e[c] - pbit) / 2);
+    out[c] = v < 0 ? 0 : v > 127 ? 127 : v;
+  }
+}
+
+static uint32_t bc7_evaluate(const block_t block,
+                             struct bc7_candidate *candidate) {
+  int32_t e[2][4];
+  for (uint32_t j = 0; j < 2; j++) {
+    for (uint32_t c = 0; c < 4; c++)
+      e[j][c] = candidate->colors[j][c] << 1 | candidate->pbits[j];
+  }
+
+  uint8_t palette[16][4];
+  for (uint32_t w = 0; w < 16; w++) {
+    for (uint32_t c = 0; c < 4; c++) {
+      palette[w][c] =
+          ((64 - BC7_WEIGHTS[w]) * e[0][c] + BC7_WEIGHTS[w] * e[1][c] + 32) >>
+          6;
+    }
+  }
+
+  candidate->error = nearest_colors(block, palette, 16, 4, candidate->indices);
+
+  return candidate->error;
+}
+
+/* Quantizes a pair of endpoints, choosing p-bits by the endpoints' own
+ * rounding error, or by the block error for BEST.
+ */
+static void bc7_fit(const block_t block, const float e0[4], const float e1[4],
+                    enum o_compress_quality quality,
+                    struct bc7_candidate *best) {
+  const float *endpoints[2] = {e0, e1};
+  best->error = UINT32_MAX;
+
+  if (quality == O_COMPRESS_QUALITY_BEST) {
+    for (uint32_t p = 0; p < 4; p++) {
+      struct bc7_candidate candidate = {.pbits = {p & 1, p >> 1}};
+      bc7_quantize(e0, candidate.pbits[0], candidate.colors[0]);
+      bc7_quantize(e1, candidate.pbits[1], candidate.colors[1]);
+      if (bc7_evaluate(block, &candidate) < best->error) *best = candidate;
+    }
+    return;
+  }
+
+  for (uint32_t j = 0; j < 2; j++) {
+    float best_error = INFINITY;
+    for (uint32_t p = 0; p < 2; p++) {
+      int32_t colors[4];
+      bc7_quantize(endpoints[j], p, colors);
+      float error = 0;
+      for (uint32_t c = 0; c < 4; c++) {
+        float d = (colors[c] << 1 | p) - endpoints[j][c];
+        error += d * d;
+      }
+      if (error < best_error) {
+        best_error = error;
+        best->pbits[j] = p;
+        memcpy(best->colors[j], colors, sizeof(colors));
+      }
+    }
+  }
+  bc7_evaluate(block, best);
+}
+
+static void put_bits(uint8_t *out, uint32_t *position, uint32_t value,
+                     uint32_t count) {
+  for (uint32_t i = 0; i < count; i++, (*position)++) {
+    if (value >> i & 1) out[*position / 8] |= 1 << (*position % 8);
+  }
+}
+
+static uint32_t get_bits(const uint8_t *in, uint32_t *position,
+                         uint32_t count) {
+  uint32_t value = 0;
+  for (uint32_t i = 0; i < count; i++, (*position)++)
+    value |= (uint32_t)(in[*position / 8] >> (*position % 8) & 1) << i;
+
+  return value;
+}
+
+static void bc7_encode_block(const block_t block,
+                             enum o_compress_quality quality, uint8_t *out) {
+  float e0[4], e1[4];
+  fit_endpoints(block, 4, quality, e0, e1);
+
+  struct bc7_candidate best;
+  bc7_fit(block, e0, e1, quality, &best);
+
+  for (uint32_t iteration = 0;
+       quality == O_COMPRESS_QUALITY_BEST && iteration < 2 && best.error > 0;
+       iteration++) {
+    float weights[16];
+    for (uint32_t i = 0; i < 16; i++)
+      weights[i] = (64 - BC7_WEIGHTS[best.indices[i]]) / 64.0f;
+    if (!refine_endpoints(block, 4, weights, e0, e1)) break;
+
+    struct bc7_candidate refined;
+    bc7_fit(block, e0, e1, quality, &refined);
+    if (refined.error >= best.error) break;
+    best = refined;
+  }
+
+  /* The first index is stored without its top bit, which must be clear. */
+  if (best.indices[0] >= 8) {
+    for (uint32_t c = 0; c < 4; c++) {
+      int32_t t = best.colors[0][c];
+      best.colors[0][c] = best.colors[1][c];
+      best.colors[1][c] = t;
+    }
+    uint32_t t = best.pbits[0];
+    best.pbits[0] = best.pbits[1];
+    best.pbits[1] = t;
+    for (uint32_t i = 0; i < 16; i++) best.indices[i] = 15 - best.indices[i];
+  }
+
+  memset(out, 0x00, 16);
+  uint32_t position = 0;
+  put_bits(out, &position, 1 << 6, 7);
+  for (uint32_t c = 0; c < 4; c++) {
+    put_bits(out, &position, best.colors[0][c], 7);
+    put_bits(out, &position, best.colors[1][c], 7);
+  }
+  put_bits(out, &position, best.pbits[0], 1);
+  put_bits(out, &position, best.pbits[1], 1);
+  for (uint32_t i = 0; i < 16; i++)
+    put_bits(out, &position, best.indices[i], i == 0 ? 3 : 4);
+  assert(position == 128);
+}
+
+static void bc7_decode_block(const uint8_t *in, block_t block) {
+  uint32_t position = 0;
+  if (get_bits(in, &position, 7) != 1 << 6) {
+    /* Only mode 6 is ever written. */
+    memset(block, 0x00, sizeof(block_t));
+    return;
+  }
+
+  int32_t e[2][4];
+  for (uint32_t c = 0; c < 4; c++) {
+    e[0][c] = get_bits(in, &position, 7) << 1;
+    e[1][c] = get_bits(in, &position, 7) << 1;
+  }
+  uint32_t p0 = get_bits(in, &position, 1);
+  uint32_t p1 = get_bits(in, &position, 1);
+  for (uint32_t c = 0; c < 4; c++) {
+    e[0][c] |= p0;
+    e[1][c] |= p1;
+  }
+
+  for (uint32_t i = 0; i < 16; i++) {
+    int32_t w = BC7_WEIGHTS[get_bits(in, &position, i == 0 ? 3 : 4)];
+    for (uint32_t c = 0; c < 4; c++)
+      block[i][c] = ((64 - w) * e[0][c] + w * e[1][c] + 32) >> 6;
+  }
+}
+
+/* Whole images. */
+
+const char *o_compress_format_name(enum o_compress_format format) {
+  static const char *const NAMES[O_COMPRESS_NUM_FORMATS] = {
+      "etc2-rgb8", "etc2-rgba8", "bc1", "bc7"};
+  assert(format < O_COMPRESS_NUM_FORMATS);
+
+  return NAMES[format];
+}
+
+uint32_t o_compress_block_size(enum o_compress_format format) {
+  assert(format < O_COMPRESS_NUM_FORMATS);
+
+  return format == O_COMPRESS_ETC2_RGB8 || format == O_COMPRESS_BC1 ? 8 : 16;
+}
+
+size_t o_compress_image_size(enum o_compress_format format, uint32_t width,
+                             uint32_t height) {
+  return (size_t)((width + 3) / 4) * ((height + 3) / 4) *
+         o_compress_block_size(format);
+}
+
+static void encode_block(enum o_compress_format format,
+                         enum o_compress_quality quality, const block_t block,
+                         uint8_t *out) {
+  switch (format) {
+    case O_COMPRESS_ETC2_RGB8:
+      write_u64_be(out, etc_encode_block(block, quality));
+      break;
+    case O_COMPRESS_ETC2_RGBA8:
+      write_u64_be(out, eac_encode_block(block, quality));
+      write_u64_be(out + 8, etc_encode_block(block, quality));
+      break;
+    case O_COMPRESS_BC1:
+      bc1_encode_block(block, quality, out);
+      break;
+    case O_COMPRESS_BC7:
+      bc7_encode_block(block, quality, out);
+      break;
+    default:
+      assert(false);
+  }
+}
+
+static void decode_block(enum o_compress_format format, const uint8_t *in,
+                         block_t block) {
+  switch (format) {
+    case O_COMPRESS_ETC2_RGB8:
+      etc_decode_block(read_u64_be(in), block);
+      break;
+    case O_COMPRESS_ETC2_RGBA8:
+      etc_decode_block(read_u64_be(in + 8), block);
+      eac_decode_block(read_u64_be(in), block);
+      break;
+    case O_COMPRESS_BC1:
+      bc1_decode_block(in, block);
+      break;
+    case O_COMPRESS_BC7:
+      bc7_decode_block(in, block);
+      break;
+    default:
+      assert(false);
+  }
+}
+
+struct compress_job {
+  enum o_compress_format format;
+  enum o_compress_quality quality;
+  const uint8_t *pixels;
+  uint32_t width;
+  uint32_t height;
+  uint8_t *dst;
+
+  /* Rows of blocks [first_row, end_row). */
+  uint32_t first_row;
+  uint32_t end_row;
+};
+
+static void *compress_thread_func(void *data) {
+  const struct compress_job *job = data;
+  uint32_t block_size = o_compress_block_size(job->format);
+  uint32_t columns = (job->width + 3) / 4;
+
+  for (uint32_t by = job->first_row; by < job->end_row; by++) {
+    for (uint32_t bx = 0; bx < columns; bx++) {
+      block_t block;
+      load_block(job->pixels, job->width, job->height, bx, by, block);
+      encode_block(job->format, job->quality, block,
+                   job->dst + ((size_t)by * columns + bx) * block_size);
+    }
+  }
+
+  return NULL;
+}
+
+bool o_compress_image(enum o_compress_format format,
+                      enum o_compress_quality quality, const uint8_t *pixels,
+                      uint32_t width, uint32_t height, uint8_t *dst,
+                      uint32_t num_threads) {
+  assert(format < O_COMPRESS_NUM_FORMATS);
+  assert(quality < O_COMPRESS_NUM_QUALITIES);
+  assert(pixels != NULL);
+  assert(dst != NULL);
+  assert(width > 0 && height > 0);
+
+  pthread_once(&nearest_colors_once, select_nearest_colors);
+
+  uint32_t rows = (height + 3) / 4;
+  if (num_threads == 0) {
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    num_threads = num_cpus > 0 ? num_cpus : 1;
+  }
+  if (num_threads > rows) num_threads = rows;
+
+  struct compress_job *jobs = calloc(num_threads, sizeof(*jobs));
+  pthread_t *threads = calloc(num_threads, sizeof(pthread_t));
+  if (jobs == NULL || threads == NULL) {
+    free(jobs);
+    free(threads);
+    return false;
+  }
+
+  /* The calling thread takes the first share. */
+  uint32_t num_started = 0;
+  for (uint32_t i = 0; i < num_threads; i++) {
+    jobs[i] = (struct compress_job){
+        format,
+        quality,
+        pixels,
+        width,
+        height,
+        dst,
+        (uint64_t)rows * i / num_threads,
+        (uint64_t)rows * (i + 1) / num_threads,
+    };
+    if (i > 0 &&
+        pthread_create(&threads[i], NULL, compress_thread_func, &jobs[i]) != 0)
+      break;
+    num_started = i + 1;
+  }
+
+  compress_thread_func(&jobs[0]);
+  for (uint32_t i = 1; i < num_started; i++) pthread_join(threads[i], NULL);
+
+  /* Encode the shares of threads that failed to start. */
+  for (uint32_t i = num_started; i < num_threads; i++)
+    compress_thread_func(&jobs[i]);
+
+  free(jobs);
+  free(threads);
+
+  return true;
+}
+
+void o_compress_decode_image(enum o_compress_format format,
+                             const uint8_t *src, uint32_t width,
+                             uint32_t height, uint8_t *pixels) {
+  assert(format < O_COMPRESS_NUM_FORMATS);
+  assert(src != NULL);
+  assert(pixels != NULL);
+
+  uint32_t block_size = o_compress_block_size(format);
+  uint32_t columns = (width + 3) / 4;
+  uint32_t rows = (height + 3) / 4;
+
+  for (uint32_t by = 0; by < rows; by++) {
+    for (uint32_t bx = 0; bx < columns; bx++) {
+      block_t block;
+      decode_block(format, src + ((size_t)by * columns + bx) * block_size,
+                   block);
+      store_block(block, width, height, bx, by, pixels);
+    }
+  }
+}
+
+double o_compress_psnr(const uint8_t *a, const uint8_t *b, uint32_t width,
+                       uint32_t height, uint8_t channels) {
+  assert(a != NULL && b != NULL);
+  assert(channels > 0 && channels <= 4);
+
+  uint64_t sum = 0;
+  for (size_t i = 0; i < (size_t)width * height; i++) {
+    for (uint32_t c = 0; c < channels; c++)
+      sum += sq(a[i * 4 + c] - b[i * 4 + c]);
+  }
+
+  if (sum == 0) return INFINITY;
+
+  double mse = (double)sum / ((double)width * height * channels);
+
+  return 10 * log10(255.0 * 255.0 / mse);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* CPU encoders for GPU block-compressed texture formats, so that textures
+ * take 4-8x less GPU memory and upload bandwidth than RGBA8.
+ */
+
+enum o_compress_format {
+  /* ETC1-compatible blocks (individual and differential modes). */
+  O_COMPRESS_ETC2_RGB8,
+  /* EAC alpha block followed by an ETC2 RGB8 block. */
+  O_COMPRESS_ETC2_RGBA8,
+  /* Opaque four-color blocks. */
+  O_COMPRESS_BC1,
+  /* Mode 6 blocks: one RGBA subset with 4-bit indices. */
+  O_COMPRESS_BC7,
+  O_COMPRESS_NUM_FORMATS,
+};
+
+/* Trades encoding speed for image quality. */
+enum o_compress_quality {
+  /* Bounding-box endpoints, no refinement. */
+  O_COMPRESS_QUALITY_FAST,
+  /* Principal-axis endpoints. */
+  O_COMPRESS_QUALITY_NORMAL,
+  /* Least-squares refined endpoints and wider mode searches. */
+  O_COMPRESS_QUALITY_BEST,
+  O_COMPRESS_NUM_QUALITIES,
+};
+
+const char *o_compress_format_name(enum o_compress_format format);
+
+/* Bytes per 4x4 block. */
+uint32_t o_compress_block_size(enum o_compress_format format);
+
+/* Bytes needed for a whole image; partial blocks on the edges count fully. */
+size_t o_compress_image_size(enum o_compress_format format, uint32_t width,
+                             uint32_t height);
+
+/* Compresses tightly packed RGBA8 @pixels into @dst, splitting the rows of
+ * blocks across @num_threads threads (one per online CPU if 0). Edge blocks
+ * replicate the last row and column.
+ */
+bool o_compress_image(enum o_compress_format format,
+                      enum o_compress_quality quality, const uint8_t *pixels,
+                      uint32_t width, uint32_t height, uint8_t *dst,
+                      uint32_t num_threads);
+
+/* Decodes blocks written by o_compress_image() back to RGBA8. */
+void o_compress_decode_image(enum o_compress_format format,
+                             const uint8_t *src, uint32_t width,
+                             uint32_t height, uint8_t *pixels);
+
+/* Peak signal-to-noise ratio, in dB, of the first @channels channels of two
+ * RGBA8 images. Identical images give INFINITY.
+ */
+double o_compress_psnr(const uint8_t *a, const uint8_t *b, uint32_t width,
+                       uint32_t height, uint8_t channels);
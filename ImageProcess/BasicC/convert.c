@@ -0,0 +1,339 @@
+#include "convert.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define O_CONVERT_X86 1
+#include <immintrin.h>
+#endif
+
+#define ALPHA_MASK 0xff000000u
+
+/* Scalar kernels, also used for the tails of the SIMD ones. */
+
+static void rgb8_to_rgba8_scalar(uint8_t *dst, const uint8_t *src,
+                                 size_t num_pixels, const uint32_t *palette) {
+  (void)palette;
+
+  for (size_t i = 0; i < num_pixels; i++) {
+    dst[i * 4 + 0] = src[i * 3 + 0];
+    dst[i * 4 + 1] = src[i * 3 + 1];
+    dst[i * 4 + 2] = src[i * 3 + 2];
+    dst[i * 4 + 3] = 0xff;
+  }
+}
+
+static void gray8_to_rgba8_scalar(uint8_t *dst, const uint8_t *src,
+                                  size_t num_pixels, const uint32_t *palette) {
+  (void)palette;
+
+  for (size_t i = 0; i < num_pixels; i++) {
+    dst[i * 4 + 0] = src[i];
+    dst[i * 4 + 1] = src[i];
+    dst[i * 4 + 2] = src[i];
+    dst[i * 4 + 3] = 0xff;
+  }
+}
+
+static void gray_alpha8_to_rgba8_scalar(uint8_t *dst, const uint8_t *src,
+                                        size_t num_pixels,
+                                        const uint32_t *palette) {
+  (void)palette;
+
+  for (size_t i = 0; i < num_pixels; i++) {
+    dst[i * 4 + 0] = src[i * 2];
+    dst[i * 4 + 1] = src[i * 2];
+    dst[i * 4 + 2] = src[i * 2];
+    dst[i * 4 + 3] = src[i * 2 + 1];
+  }
+}
+
+static void palette8_to_rgba8_scalar(uint8_t *dst, const uint8_t *src,
+                                     size_t num_pixels,
+                                     const uint32_t *palette) {
+  for (size_t i = 0; i < num_pixels; i++)
+    memcpy(dst + i * 4, &palette[src[i]], 4);
+}
+
+static void narrow16_to_8_scalar(uint8_t *dst, const uint8_t *src,
+                                 size_t num_pixels, const uint32_t *palette) {
+  (void)palette;
+
+  for (size_t i = 0; i < num_pixels; i++) dst[i] = src[i * 2];
+}
+
+#ifdef O_CONVERT_X86
+
+/* SSE4.1 kernels. */
+
+__attribute__((target("sse4.1"))) static void rgb8_to_rgba8_sse4(
+    uint8_t *dst, const uint8_t *src, size_t num_pixels,
+    const uint32_t *palette) {
+  const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1,
+                                        9, 10, 11, -1);
+  const __m128i alpha = _mm_set1_epi32(ALPHA_MASK);
+
+  /* Each iteration reads 16 bytes but consumes 12 (4 pixels). */
+  size_t i = 0;
+  for (; i + 6 <= num_pixels; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + i * 3));
+    v = _mm_or_si128(_mm_shuffle_epi8(v, shuffle), alpha);
+    _mm_storeu_si128((__m128i *)(dst + i * 4), v);
+  }
+
+  rgb8_to_rgba8_scalar(dst + i * 4, src + i * 3, num_pixels - i, palette);
+}
+
+__attribute__((target("sse4.1"))) static void gray8_to_rgba8_sse4(
+    uint8_t *dst, const uint8_t *src, size_t num_pixels,
+    const uint32_t *palette) {
+  const __m128i splat = _mm_set1_epi32(0x00010101);
+  const __m128i alpha = _mm_set1_epi32(ALPHA_MASK);
+
+  size_t i = 0;
+  for (; i + 4 <= num_pixels; i += 4) {
+    int32_t gray;
+    memcpy(&gray, src + i, 4);
+    __m128i v = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(gray));
+    v = _mm_or_si128(_mm_mullo_epi32(v, splat), alpha);
+    _mm_storeu_si128((__m128i *)(dst + i * 4), v);
+  }
+
+  gray8_to_rgba8_scalar(dst + i * 4, src + i, num_pixels - i, palette);
+}
+
+__attribute__((target("sse4.1"))) static void gray_alpha8_to_rgba8_sse4(
+    uint8_t *dst, const uint8_t *src, size_t num_pixels,
+    const uint32_t *palette) {
+  const __m128i shuffle_lo =
+      _mm_setr_epi8(0, 0, 0, 1, 2, 2, 2, 3, 4, 4, 4, 5, 6, 6, 6, 7);
+  const __m128i shuffle_hi = _mm_setr_epi8(8, 8, 8, 9, 10, 10, 10, 11, 12, 12,
+                                           12, 13, 14, 14, 14, 15);
+
+  size_t i = 0;
+  for (; i + 8 <= num_pixels; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + i * 2));
+    _mm_storeu_si128((__m128i *)(dst + i * 4),
+                     _mm_shuffle_epi8(v, shuffle_lo));
+    _mm_storeu_si128((__m128i *)(dst + i * 4 + 16),
+                     _mm_shuffle_epi8(v, shuffle_hi));
+  }
+
+  gray_alpha8_to_rgba8_scalar(dst + i * 4, src + i * 2, num_pixels - i,
+                              palette);
+}
+
+__attribute__((target("sse4.1"))) static void narrow16_to_8_sse4(
+    uint8_t *dst, const uint8_t *src, size_t num_pixels,
+    const uint32_t *palette) {
+  /* Big-endian samples: the most significant byte is the even one. */
+  const __m128i low_bytes = _mm_set1_epi16(0x00ff);
+
+  size_t i = 0;
+  for (; i + 16 <= num_pixels; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(src + i * 2));
+    __m128i b = _mm_loadu_si128((const __m128i *)(src + i * 2 + 16));
+    a = _mm_and_si128(a, low_bytes);
+    b = _mm_and_si128(b, low_bytes);
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(a, b));
+  }
+
+  narrow16_to_8_scalar(dst + i, src + i * 2, num_pixels - i, palette);
+}
+
+/* AVX2 kernels. */
+
+__attribute__((target("avx2"))) static void rgb8_to_rgba8_avx2(
+    uint8_t *dst, const uint8_t *src, size_t num_pixels,
+    const uint32_t *palette) {
+  const __m256i shuffle = _mm256_setr_epi8(
+      0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1, 0, 1, 2, -1, 3, 4,
+      5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  const __m256i alpha = _mm256_set1_epi32(ALPHA_MASK);
+
+  /* Two 16-byte loads, 12 bytes apart, give 8 pixels in two lanes. */
+  size_t i = 0;
+  for (; i + 10 <= num_pixels; i += 8) {
+    __m128i lo = _mm_loadu_si128((const __m128i *)(src + i * 3));
+    __m128i hi = _mm_loadu_si128((const __m128i *)(src + i * 3 + 12));
+    __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+    v = _mm256_or_si256(_mm256_shuffle_epi8(v, shuffle), alpha);
+    _mm256_storeu_si256((__m256i *)(dst + i * 4), v);
+  }
+
+  rgb8_to_rgba8_sse4(dst + i * 4, src + i * 3, num_pixels - i, palette);
+}
+
+__attribute__((target("avx2"))) static void gray8_to_rgba8_avx2(
+    uint8_t *dst, const uint8_t *src, size_t num_pixels,
+    const uint32_t *palette) {
+  const __m256i splat = _mm256_set1_epi32(0x00010101);
+  const __m256i alpha = _mm256_set1_epi32(ALPHA_MASK);
+
+  size_t i = 0;
+  for (; i + 8 <= num_pixels; i += 8) {
+    __m256i v =
+        _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i)));
+    v = _mm256_or_si256(_mm256_mullo_epi32(v, splat), alpha);
+    _mm256_storeu_si256((__m256i *)(dst + i * 4), v);
+  }
+
+  gray8_to_rgba8_scalar(dst + i * 4, src + i, num_pixels - i, palette);
+}
+
+__attribute__((target("avx2"))) static void gray_alpha8_to_rgba8_avx2(
+    uint8_t *dst, const uint8_t *src, size_t num_pixels,
+    const uint32_t *palette) {
+  /* The 16 source bytes are broadcast to both lanes; the low lane expands
+   * pixels 0-3 and the high lane pixels 4-7.
+   */
+  const __m256i shuffle = _mm256_setr_epi8(
+      0, 0, 0, 1, 2, 2, 2, 3, 4, 4, 4, 5, 6, 6, 6, 7, 8, 8, 8, 9, 10, 10, 10,
+      11, 12, 12, 12, 13, 14, 14, 14, 15);
+
+  size_t i = 0;
+  for (; i + 8 <= num_pixels; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + i * 2));
+    __m256i w = _mm256_broadcastsi128_si256(v);
+    _mm256_storeu_si256((__m256i *)(dst + i * 4),
+                        _mm256_shuffle_epi8(w, shuffle));
+  }
+
+  gray_alpha8_to_rgba8_scalar(dst + i * 4, src + i * 2, num_pixels - i,
+                              palette);
+}
+
+__attribute__((target("avx2"))) static void palette8_to_rgba8_avx2(
+    uint8_t *dst, const uint8_t *src, size_t num_pixels,
+    const uint32_t *palette) {
+  size_t i = 0;
+  for (; i + 8 <= num_pixels; i += 8) {
+    __m256i index =
+        _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i)));
+    __m256i v = _mm256_i32gather_epi32((const int32_t *)palette, index, 4);
+    _mm256_storeu_si256((__m256i *)(dst + i * 4), v);
+  }
+
+  palette8_to_rgba8_scalar(dst + i * 4, src + i, num_pixels - i, palette);
+}
+
+__attribute__((target("avx2"))) static void narrow16_to_8_avx2(
+    uint8_t *dst, const uint8_t *src, size_t num_pixels,
+    const uint32_t *palette) {
+  const __m256i low_bytes = _mm256_set1_epi16(0x00ff);
+
+  size_t i = 0;
+  for (; i + 32 <= num_pixels; i += 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(src + i * 2));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(src + i * 2 + 32));
+    a = _mm256_and_si256(a, low_bytes);
+    b = _mm256_and_si256(b, low_bytes);
+    /* packus works per 128-bit lane, restore the sample order. */
+    __m256i v = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b),
+                                         _MM_SHUFFLE(3, 1, 2, 0));
+    _mm256_storeu_si256((__m256i *)(dst + i), v);
+  }
+
+  narrow16_to_8_scalar(dst + i, src + i * 2, num_pixels - i, palette);
+}
+
+#endif /* O_CONVERT_X86 */
+
+static const o_convert_func KERNELS[O_CONVERT_NUM_ISAS]
+                                   [O_CONVERT_NUM_KERNELS] = {
+    [O_CONVERT_ISA_SCALAR] =
+        {
+            rgb8_to_rgba8_scalar,
+            gray8_to_rgba8_scalar,
+            gray_alpha8_to_rgba8_scalar,
+            palette8_to_rgba8_scalar,
+            narrow16_to_8_scalar,
+        },
+#ifdef O_CONVERT_X86
+    /* There is no SSE gather, the scalar palette lookup is as fast. */
+    [O_CONVERT_ISA_SSE4] =
+        {
+            rgb8_to_rgba8_sse4,
+            gray8_to_rgba8_sse4,
+            gray_alpha8_to_rgba8_sse4,
+            palette8_to_rgba8_scalar,
+            narrow16_to_8_sse4,
+        },
+    [O_CONVERT_ISA_AVX2] =
+        {
+            rgb8_to_rgba8_avx2,
+            gray8_to_rgba8_avx2,
+            gray_alpha8_to_rgba8_avx2,
+            palette8_to_rgba8_avx2,
+            narrow16_to_8_avx2,
+        },
+#endif
+};
+
+static bool isa_supported(enum o_convert_isa isa) {
+  switch (isa) {
+    case O_CONVERT_ISA_SCALAR:
+      return true;
+#ifdef O_CONVERT_X86
+    case O_CONVERT_ISA_SSE4:
+      return __builtin_cpu_supports("sse4.1");
+    case O_CONVERT_ISA_AVX2:
+      return __builtin_cpu_supports("avx2");
+#endif
+    default:
+      return false;
+  }
+}
+
+enum o_convert_isa o_convert_best_isa(void) {
+  for (int32_t isa = O_CONVERT_NUM_ISAS - 1; isa > O_CONVERT_ISA_SCALAR;
+       isa--) {
+    if (isa_supported(isa)) return isa;
+  }
+
+  return O_CONVERT_ISA_SCALAR;
+}
+
+const char *o_convert_isa_name(enum o_convert_isa isa) {
+  static const char *const NAMES[O_CONVERT_NUM_ISAS] = {"scalar", "sse4",
+                                                        "avx2"};
+  assert(isa < O_CONVERT_NUM_ISAS);
+
+  return NAMES[isa];
+}
+
+const char *o_convert_kernel_name(enum o_convert_kernel kernel) {
+  static const char *const NAMES[O_CONVERT_NUM_KERNELS] = {
+      "rgb8_to_rgba8",     "gray8_to_rgba8", "gray_alpha8_to_rgba8",
+      "palette8_to_rgba8", "narrow16_to_8",
+  };
+  assert(kernel < O_CONVERT_NUM_KERNELS);
+
+  return NAMES[kernel];
+}
+
+o_convert_func o_convert_get_kernel(enum o_convert_kernel kernel,
+                                    enum o_convert_isa isa) {
+  assert(kernel < O_CONVERT_NUM_KERNELS);
+  assert(isa < O_CONVERT_NUM_ISAS);
+
+  if (!isa_supported(isa)) return NULL;
+
+  return KERNELS[isa][kernel];
+}
+
+void o_convert_unpack_bits(uint8_t *dst, const uint8_t *src,
+                           size_t num_pixels, uint8_t bit_depth,
+                           uint8_t scale) {
+  assert(bit_depth == 1 || bit_depth == 2 || bit_depth == 4);
+
+  const uint32_t per_byte = 8 / bit_depth;
+  const uint8_t mask = (1 << bit_depth) - 1;
+
+  for (size_t i = 0; i < num_pixels; i++) {
+    uint32_t shift = 8 - bit_depth * (i % per_byte + 1);
+    dst[i] = ((src[i / per_byte] >> shift) & mask) * scale;
+  }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Pixel-format conversion kernels that expand decoded PNG rows to RGBA8, so
+ * textures are always uploaded as GL_RGBA and skip the driver's slow GL_RGB
+ * unpack path.
+ */
+
+enum o_convert_isa {
+  O_CONVERT_ISA_SCALAR,
+  O_CONVERT_ISA_SSE4,
+  O_CONVERT_ISA_AVX2,
+  O_CONVERT_NUM_ISAS,
+};
+
+enum o_convert_kernel {
+  O_CONVERT_RGB8_TO_RGBA8,
+  O_CONVERT_GRAY8_TO_RGBA8,
+  O_CONVERT_GRAY_ALPHA8_TO_RGBA8,
+  O_CONVERT_PALETTE8_TO_RGBA8,
+  /* Keeps the most significant byte of big-endian 16-bit samples. Works in
+   * place, and @num_pixels counts samples rather than pixels.
+   */
+  O_CONVERT_NARROW16_TO_8,
+  O_CONVERT_NUM_KERNELS,
+};
+
+/* @palette holds 256 RGBA8 entries and is only used by the palette kernel. */
+typedef void (*o_convert_func)(uint8_t *dst, const uint8_t *src,
+                               size_t num_pixels, const uint32_t *palette);
+
+/* Best instruction set supported by the running CPU. */
+enum o_convert_isa o_convert_best_isa(void);
+
+const char *o_convert_isa_name(enum o_convert_isa isa);
+
+const char *o_convert_kernel_name(enum o_convert_kernel kernel);
+
+/* Returns NULL if @isa isn't supported by the running CPU. */
+o_convert_func o_convert_get_kernel(enum o_convert_kernel kernel,
+                                    enum o_convert_isa isa);
+
+/* Expands samples of 1, 2 or 4 bits to one byte each, multiplied by @scale
+ * (e.g. 255 for 1-bit grayscale, 1 for palette indices).
+ */
+void o_convert_unpack_bits(uint8_t *dst, const uint8_t *src,
+                           size_t num_pixels, uint8_t bit_depth,
+                           uint8_t scale);
+
+#ifdef __cplusplus
+}
+#endif
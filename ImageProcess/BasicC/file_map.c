@@ -0,0 +1,80 @@
+#define _DEFAULT_SOURCE
+
+#include "file_map.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+bool file_map_open(struct file_map *self, const char *filename) {
+  assert(self != NULL);
+  assert(filename != NULL);
+
+  memset(self, 0x00, sizeof(struct file_map));
+  self->fd = -1;
+
+  self->fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if (self->fd < 0) return false;
+
+  struct stat st;
+  if (fstat(self->fd, &st) != 0) {
+    file_map_close(self);
+    return false;
+  }
+
+  if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+    file_map_close(self);
+    errno = EINVAL;
+    return false;
+  }
+
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, self->fd, 0);
+  if (data == MAP_FAILED) {
+    file_map_close(self);
+    return false;
+  }
+
+  self->data = data;
+  self->size = st.st_size;
+
+  /* The decoders consume the file front to back, exactly once. */
+  posix_fadvise(self->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  madvise(data, self->size, MADV_SEQUENTIAL);
+
+  return true;
+}
+
+void file_map_close(struct file_map *self) {
+  assert(self != NULL);
+
+  if (self->data != NULL) {
+    munmap((void *)self->data, self->size);
+    self->data = NULL;
+  }
+
+  if (self->fd >= 0) {
+    close(self->fd);
+    self->fd = -1;
+  }
+
+  self->size = 0;
+}
+
+void file_map_prefetch(const struct file_map *self, size_t offset,
+                       size_t length) {
+  assert(self != NULL);
+
+  if (self->data == NULL || offset >= self->size) return;
+
+  if (length > self->size - offset) length = self->size - offset;
+
+  /* madvise() wants a page-aligned start address. */
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t start = offset - offset % page_size;
+
+  madvise((void *)(self->data + start), length + (offset - start),
+          MADV_WILLNEED);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+/* A read-only memory mapping of a whole file. */
+struct file_map {
+  int32_t fd;
+
+  const uint8_t *data;
+  size_t size;
+};
+
+bool file_map_open(struct file_map *self, const char *filename);
+
+void file_map_close(struct file_map *self);
+
+/* Hints the kernel to start reading [offset, offset + length) into the page
+ * cache, so that later accesses to that range don't block on I/O.
+ */
+void file_map_prefetch(const struct file_map *self, size_t offset,
+                       size_t length);
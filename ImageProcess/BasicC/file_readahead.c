@@ -0,0 +1,358 @@
+#define _GNU_SOURCE
+
+#include "file_readahead.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#ifdef O_HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Reads the whole of [offset, offset + length), or up to the end of the file.
+ * Returns the bytes read or a negative errno.
+ */
+static ssize_t read_fully(int32_t fd, uint8_t *data, size_t offset,
+                          size_t length) {
+  size_t done = 0;
+  while (done < length) {
+    ssize_t result = pread(fd, data + done, length - done, offset + done);
+    if (result < 0 && errno == EINTR) continue;
+    if (result < 0) return -errno;
+    if (result == 0) break;
+    done += result;
+  }
+
+  return done;
+}
+
+static void *reader_thread_func(void *data) {
+  struct file_readahead *self = data;
+
+  pthread_mutex_lock(&self->lock);
+  for (;;) {
+    while (self->completed == self->submitted && !self->stopping)
+      pthread_cond_wait(&self->buffer_submitted, &self->lock);
+    if (self->stopping) break;
+
+    struct file_readahead_buffer *buffer =
+        &self->buffers[self->completed % self->num_buffers];
+    pthread_mutex_unlock(&self->lock);
+
+    ssize_t result =
+        read_fully(self->fd, buffer->data, buffer->offset, buffer->length);
+
+    pthread_mutex_lock(&self->lock);
+    buffer->result = result;
+    buffer->ready = true;
+    self->completed++;
+    pthread_cond_signal(&self->buffer_ready);
+  }
+  pthread_mutex_unlock(&self->lock);
+
+  return NULL;
+}
+
+/* Refills every free buffer with the next range of the file. */
+static void submit_reads(struct file_readahead *self) {
+  uint64_t first = self->submitted;
+
+  /* The reader thread picks buffers up as soon as they are counted. */
+  if (self->ring == NULL) pthread_mutex_lock(&self->lock);
+
+  while (self->submitted - self->consumed < self->num_buffers &&
+         self->next_offset < self->size) {
+    struct file_readahead_buffer *buffer =
+        &self->buffers[self->submitted % self->num_buffers];
+    buffer->offset = self->next_offset;
+    buffer->length = self->size - self->next_offset < self->buffer_size
+                         ? self->size - self->next_offset
+                         : self->buffer_size;
+    buffer->result = 0;
+    buffer->ready = false;
+    self->next_offset += buffer->length;
+
+#ifdef O_HAVE_LIBURING
+    if (self->ring != NULL) {
+      struct io_uring_sqe *sqe = io_uring_get_sqe(self->ring);
+      assert(sqe != NULL);
+      io_uring_prep_read(sqe, self->fd, buffer->data, buffer->length,
+                         buffer->offset);
+      io_uring_sqe_set_data(sqe, buffer);
+      self->ring_pending++;
+    }
+#endif
+
+    self->submitted++;
+  }
+
+#ifdef O_HAVE_LIBURING
+  if (self->ring != NULL) {
+    if (self->submitted > first) io_uring_submit(self->ring);
+    return;
+  }
+#endif
+
+  if (self->submitted == first) {
+    pthread_mutex_unlock(&self->lock);
+    return;
+  }
+
+  pthread_cond_signal(&self->buffer_submitted);
+  pthread_mutex_unlock(&self->lock);
+
+  /* The reader thread reads one buffer at a time; let the kernel start on
+   * the others meanwhile.
+   */
+  const struct file_readahead_buffer *last =
+      &self->buffers[(self->submitted - 1) % self->num_buffers];
+  const struct file_readahead_buffer *next =
+      &self->buffers[first % self->num_buffers];
+  posix_fadvise(self->fd, next->offset,
+                last->offset + last->length - next->offset,
+                POSIX_FADV_WILLNEED);
+}
+
+/* Waits for the oldest buffer, completing a short read synchronously. */
+static bool wait_head(struct file_readahead *self) {
+  struct file_readahead_buffer *buffer =
+      &self->buffers[self->consumed % self->num_buffers];
+  uint64_t start = now_ns();
+  bool waited = false;
+
+#ifdef O_HAVE_LIBURING
+  if (self->ring != NULL) {
+    /* Completions come in any order; mark them until the head is in. */
+    while (!buffer->ready) {
+      struct io_uring_cqe *cqe;
+      int32_t ret = io_uring_wait_cqe(self->ring, &cqe);
+      if (ret == -EINTR) continue;
+      if (ret < 0) {
+        errno = -ret;
+        return false;
+      }
+
+      struct file_readahead_buffer *done = io_uring_cqe_get_data(cqe);
+      done->result = cqe->res;
+      done->ready = true;
+      io_uring_cqe_seen(self->ring, cqe);
+      self->ring_pending--;
+      waited = true;
+    }
+  }
+#endif
+
+  if (self->ring == NULL) {
+    pthread_mutex_lock(&self->lock);
+    while (!buffer->ready) {
+      pthread_cond_wait(&self->buffer_ready, &self->lock);
+      waited = true;
+    }
+    pthread_mutex_unlock(&self->lock);
+  }
+
+  if (waited) self->stats.wait_ns += now_ns() - start;
+
+  if (buffer->result < 0) {
+    errno = -buffer->result;
+    return false;
+  }
+
+  if ((size_t)buffer->result < buffer->length) {
+    ssize_t result = read_fully(self->fd, buffer->data + buffer->result,
+                                buffer->offset + buffer->result,
+                                buffer->length - buffer->result);
+    if (result < 0) {
+      errno = -result;
+      return false;
+    }
+    buffer->result += result;
+
+    /* The file shrank under us. */
+    if ((size_t)buffer->result < buffer->length) {
+      errno = EIO;
+      return false;
+    }
+  }
+
+  self->stats.bytes_read += buffer->length;
+  self->stats.num_reads++;
+
+  return true;
+}
+
+bool file_readahead_open(struct file_readahead *self, const char *filename,
+                         uint32_t num_buffers, size_t buffer_size) {
+  assert(self != NULL);
+  assert(filename != NULL);
+  assert(num_buffers > 0 && buffer_size > 0);
+
+  memset(self, 0x00, sizeof(struct file_readahead));
+
+  int32_t fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+
+  if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+    close(fd);
+    errno = EINVAL;
+    return false;
+  }
+
+  /* No point in buffers beyond the end of the file. */
+  size_t max_buffers = (st.st_size + buffer_size - 1) / buffer_size;
+  if (num_buffers > max_buffers) num_buffers = max_buffers;
+
+  self->buffers = calloc(num_buffers, sizeof(struct file_readahead_buffer));
+  if (self->buffers == NULL) {
+    close(fd);
+    errno = ENOMEM;
+    return false;
+  }
+
+  self->fd = fd;
+  self->size = st.st_size;
+  self->num_buffers = num_buffers;
+  self->buffer_size = buffer_size;
+
+  for (uint32_t i = 0; i < num_buffers; i++) {
+    self->buffers[i].data = malloc(buffer_size);
+    if (self->buffers[i].data == NULL) {
+      file_readahead_close(self);
+      errno = ENOMEM;
+      return false;
+    }
+  }
+
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+#ifdef O_HAVE_LIBURING
+  /* Falls back to the thread if io_uring is unavailable or forbidden. */
+  self->ring = malloc(sizeof(struct io_uring));
+  if (self->ring != NULL &&
+      io_uring_queue_init(num_buffers, self->ring, 0) != 0) {
+    free(self->ring);
+    self->ring = NULL;
+  }
+#endif
+
+  if (self->ring == NULL) {
+    pthread_mutex_init(&self->lock, NULL);
+    pthread_cond_init(&self->buffer_submitted, NULL);
+    pthread_cond_init(&self->buffer_ready, NULL);
+
+    if (pthread_create(&self->thread, NULL, reader_thread_func, self) != 0) {
+      pthread_cond_destroy(&self->buffer_ready);
+      pthread_cond_destroy(&self->buffer_submitted);
+      pthread_mutex_destroy(&self->lock);
+
+      file_readahead_close(self);
+      errno = EAGAIN;
+      return false;
+    }
+    self->has_thread = true;
+  }
+
+  submit_reads(self);
+
+  return true;
+}
+
+void file_readahead_close(struct file_readahead *self) {
+  assert(self != NULL);
+
+  if (self->buffers == NULL) return;
+
+#ifdef O_HAVE_LIBURING
+  if (self->ring != NULL) {
+    /* The kernel may still be writing into the buffers. */
+    while (self->ring_pending > 0) {
+      struct io_uring_cqe *cqe;
+      if (io_uring_wait_cqe(self->ring, &cqe) != 0) continue;
+      io_uring_cqe_seen(self->ring, cqe);
+      self->ring_pending--;
+    }
+    io_uring_queue_exit(self->ring);
+    free(self->ring);
+  }
+#endif
+
+  if (self->has_thread) {
+    pthread_mutex_lock(&self->lock);
+    self->stopping = true;
+    pthread_cond_signal(&self->buffer_submitted);
+    pthread_mutex_unlock(&self->lock);
+
+    pthread_join(self->thread, NULL);
+    pthread_cond_destroy(&self->buffer_ready);
+    pthread_cond_destroy(&self->buffer_submitted);
+    pthread_mutex_destroy(&self->lock);
+  }
+
+  for (uint32_t i = 0; i < self->num_buffers; i++)
+    free(self->buffers[i].data);
+  free(self->buffers);
+
+  close(self->fd);
+
+  memset(self, 0x00, sizeof(struct file_readahead));
+}
+
+bool file_readahead_is_open(const struct file_readahead *self) {
+  assert(self != NULL);
+
+  return self->buffers != NULL;
+}
+
+bool file_readahead_uses_io_uring(const struct file_readahead *self) {
+  assert(self != NULL);
+
+  return self->ring != NULL;
+}
+
+ssize_t file_readahead_read(struct file_readahead *self, void *data,
+                            size_t length) {
+  assert(self != NULL);
+  assert(file_readahead_is_open(self));
+  assert(length == 0 || data != NULL);
+
+  size_t copied = 0;
+  while (copied < length && self->consumed < self->submitted) {
+    if (self->head_offset == 0 && !wait_head(self)) return -1;
+
+    const struct file_readahead_buffer *buffer =
+        &self->buffers[self->consumed % self->num_buffers];
+    size_t chunk = buffer->length - self->head_offset;
+    if (chunk > length - copied) chunk = length - copied;
+
+    memcpy((uint8_t *)data + copied, buffer->data + self->head_offset, chunk);
+    copied += chunk;
+    self->head_offset += chunk;
+
+    /* Hand the drained buffer back for the next range. */
+    if (self->head_offset == buffer->length) {
+      self->consumed++;
+      self->head_offset = 0;
+      submit_reads(self);
+    }
+  }
+
+  return copied;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+struct io_uring;
+
+struct file_readahead_stats {
+  /* Time the consumer waited for a read to complete. */
+  uint64_t wait_ns;
+  uint64_t bytes_read;
+  uint32_t num_reads;
+};
+
+struct file_readahead_buffer {
+  uint8_t *data;
+  size_t offset;
+  size_t length;
+
+  /* Bytes read, or a negative errno. */
+  ssize_t result;
+  bool ready;
+};
+
+/* Reads a file front to back through a ring of large buffers, keeping reads
+ * in flight ahead of the consumer so that I/O overlaps with whatever the
+ * consumer does with the bytes. The reads go through io_uring when it's
+ * built in and the kernel allows it, and through a reader thread otherwise.
+ */
+struct file_readahead {
+  int32_t fd;
+  size_t size;
+
+  struct file_readahead_buffer *buffers;
+  uint32_t num_buffers;
+  size_t buffer_size;
+
+  /* Buffers submitted and consumed since the start of the file. */
+  uint64_t submitted;
+  uint64_t consumed;
+  size_t next_offset;
+  /* Bytes of the oldest buffer already consumed. */
+  size_t head_offset;
+
+  /* io_uring backend, NULL when the reader thread is used. */
+  struct io_uring *ring;
+  uint32_t ring_pending;
+
+  pthread_t thread;
+  bool has_thread;
+  pthread_mutex_t lock;
+  pthread_cond_t buffer_submitted;
+  pthread_cond_t buffer_ready;
+  uint64_t completed;
+  bool stopping;
+
+  struct file_readahead_stats stats;
+};
+
+/* Starts reading the first @num_buffers buffers of @buffer_size bytes. On
+ * failure @self is left zeroed, so file_readahead_close() is always safe.
+ */
+bool file_readahead_open(struct file_readahead *self, const char *filename,
+                         uint32_t num_buffers, size_t buffer_size);
+
+void file_readahead_close(struct file_readahead *self);
+
+bool file_readahead_is_open(const struct file_readahead *self);
+
+/* Whether reads go through io_uring rather than the reader thread. */
+bool file_readahead_uses_io_uring(const struct file_readahead *self);
+
+/* Copies the next @length bytes of the file into @data, waiting for them if
+ * needed. Returns fewer bytes only at the end of the file, or -1 on errors.
+ */
+ssize_t file_readahead_read(struct file_readahead *self, void *data,
+                            size_t length);
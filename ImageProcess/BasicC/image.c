@@ -2,32 +2,128 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <string.h>
+
+static bool use_readahead;
+
+void o_image_set_readahead(bool enabled) { use_readahead = enabled; }
+
+static bool o_image_init_from_png(struct o_image *self) {
+  self->type = O_IMAGE_TYPE_PNG;
+  self->width = self->png.width;
+  self->height = self->png.height;
+  self->row_stride = self->png.row_stride;
+
+  /* Every PNG color type is expanded to RGBA8 while decoding. */
+  self->format = O_IMAGE_FORMAT_RGBA;
+
+  return true;
+}
+
+static bool o_image_init_from_pnm(struct o_image *self) {
+  self->type = O_IMAGE_TYPE_PNM;
+  self->width = self->pnm.width;
+  self->height = self->pnm.height;
+  self->row_stride = self->pnm.row_stride;
+  self->format =
+      self->pnm.channels == 4 ? O_IMAGE_FORMAT_RGBA : O_IMAGE_FORMAT_RGB;
+
+  return true;
+}
+
+static bool o_image_init_from_qoi(struct o_image *self) {
+  self->type = O_IMAGE_TYPE_QOI;
+  self->width = self->qoi.width;
+  self->height = self->qoi.height;
+  self->row_stride = self->qoi.row_stride;
+  self->format =
+      self->qoi.channels == 4 ? O_IMAGE_FORMAT_RGBA : O_IMAGE_FORMAT_RGB;
+
+  return true;
+}
+
+static bool o_image_init_from_cache(struct o_image *self) {
+  self->type = O_IMAGE_TYPE_CACHE;
+  self->width = self->cache.width;
+  self->height = self->cache.height;
+  self->row_stride = self->cache.row_stride;
+  self->format =
+      self->cache.channels == 4 ? O_IMAGE_FORMAT_RGBA : O_IMAGE_FORMAT_RGB;
+
+  return true;
+}
+
+/* Starts storing the decoded pixels in the cache. PNM files are skipped:
+ * their rows are stored raw already, so an entry would only copy them.
+ */
+static void o_image_cache_decoded(struct o_image *self) {
+  if (self->type == O_IMAGE_TYPE_PNM) return;
+
+  o_image_cache_store_begin(&self->cache, self->width, self->height,
+                            self->row_stride,
+                            self->format == O_IMAGE_FORMAT_RGBA ? 4 : 3);
+}
 
 bool o_image_init_from_filename(struct o_image *self, const char *filename) {
+  return o_image_init_from_filename_in_arena(self, filename, NULL);
+}
+
+bool o_image_init_from_filename_in_arena(struct o_image *self,
+                                         const char *filename,
+                                         struct png_arena *arena) {
   assert(self != NULL);
   assert(filename != NULL);
 
-  bool ok = png_decoder_init_from_filename(&self->png, filename);
-  if (ok) {
-    self->type = O_IMAGE_TYPE_PNG;
-    self->width = self->png.width;
-    self->height = self->png.height;
-
-    switch (self->png.format) {
-      case PNG_COLOR_TYPE_RGB:
-        self->format = O_IMAGE_FORMAT_RGB;
-        break;
-      case PNG_COLOR_TYPE_RGB_ALPHA:
-        self->format = O_IMAGE_FORMAT_RGBA;
-        break;
-      default:
-        printf("PNG image format %d not handled\n", self->png.format);
-        return false;
-    }
-
-    return true;
+  if (o_image_cache_lookup(&self->cache, filename))
+    return o_image_init_from_cache(self);
+
+  bool ok;
+  if (use_readahead
+          ? png_decoder_init_from_filename_readahead(&self->png, filename,
+                                                     arena)
+          : png_decoder_init_from_filename(&self->png, filename, arena)) {
+    ok = o_image_init_from_png(self);
+  } else if (errno == ENOMEM) {
+    /* A PNG over the memory budget is no other format either. */
+    return false;
+  } else if (pnm_decoder_init_from_filename(&self->pnm, filename)) {
+    ok = o_image_init_from_pnm(self);
+  } else if (qoi_decoder_init_from_filename(&self->qoi, filename)) {
+    ok = o_image_init_from_qoi(self);
+  } else {
+    printf("Unknown or unhandled image format.\n");
+    return false;
   }
 
+  if (ok) o_image_cache_decoded(self);
+
+  return ok;
+}
+
+bool o_image_init_from_memory(struct o_image *self, const void *data,
+                              size_t size) {
+  return o_image_init_from_memory_in_arena(self, data, size, NULL);
+}
+
+bool o_image_init_from_memory_in_arena(struct o_image *self, const void *data,
+                                       size_t size, struct png_arena *arena) {
+  assert(self != NULL);
+  assert(data != NULL);
+
+  o_image_cache_entry_init(&self->cache);
+
+  if (png_decoder_init_from_memory(&self->png, data, size, arena))
+    return o_image_init_from_png(self);
+
+  /* A PNG over the memory budget is no other format either. */
+  if (errno == ENOMEM) return false;
+
+  if (pnm_decoder_init_from_memory(&self->pnm, data, size))
+    return o_image_init_from_pnm(self);
+
+  if (qoi_decoder_init_from_memory(&self->qoi, data, size))
+    return o_image_init_from_qoi(self);
+
   printf("Unknown or unhandled image format.\n");
   return false;
 }
@@ -36,17 +132,191 @@ void o_image_clear(struct o_image *self) {
   assert(self != NULL);
 
   if (self->type == O_IMAGE_TYPE_PNG) png_clear(&self->png);
+
+  if (self->type == O_IMAGE_TYPE_PNM) pnm_clear(&self->pnm);
+
+  if (self->type == O_IMAGE_TYPE_QOI) qoi_clear(&self->qoi);
+
+  o_image_cache_clear(&self->cache);
 }
 
 ssize_t o_image_read(struct o_image *self, void *buffer, size_t size,
                      size_t *first_row, size_t *num_rows) {
   assert(self != NULL);
 
+  ssize_t result;
+  switch (self->type) {
+    case O_IMAGE_TYPE_PNG:
+      result = png_read(&self->png, buffer, size, first_row, num_rows);
+      break;
+    case O_IMAGE_TYPE_PNM:
+      return pnm_read(&self->pnm, buffer, size, first_row, num_rows);
+    case O_IMAGE_TYPE_QOI:
+      result = qoi_read(&self->qoi, buffer, size, first_row, num_rows);
+      break;
+    case O_IMAGE_TYPE_CACHE:
+      return o_image_cache_read(&self->cache, buffer, size, first_row,
+                                num_rows);
+    default:
+      errno = ENXIO;
+      return -1;
+  }
+
+  if (result > 0) o_image_cache_store_rows(&self->cache, buffer, result);
+
+  return result;
+}
+
+ssize_t o_image_read_direct(struct o_image *self, const void **data,
+                            size_t size, size_t *first_row, size_t *num_rows) {
+  assert(self != NULL);
+
+  switch (self->type) {
+    case O_IMAGE_TYPE_PNM:
+      return pnm_read_direct(&self->pnm, data, size, first_row, num_rows);
+    case O_IMAGE_TYPE_CACHE:
+      return o_image_cache_read_direct(&self->cache, data, size, first_row,
+                                       num_rows);
+    case O_IMAGE_TYPE_PNG:
+    case O_IMAGE_TYPE_QOI:
+      errno = ENOTSUP;
+      return -1;
+    default:
+      errno = ENXIO;
+      return -1;
+  }
+}
+
+/* Next row the decoder of @self returns. */
+static size_t o_image_next_row(const struct o_image *self) {
+  switch (self->type) {
+    case O_IMAGE_TYPE_PNG:
+      return self->png.last_decoded_row;
+    case O_IMAGE_TYPE_PNM:
+      return self->pnm.last_decoded_row;
+    case O_IMAGE_TYPE_QOI:
+      return self->qoi.last_decoded_row;
+    case O_IMAGE_TYPE_CACHE:
+      return self->cache.last_decoded_row;
+    default:
+      return 0;
+  }
+}
+
+static bool o_image_skip_rows(struct o_image *self, size_t num_rows) {
+  switch (self->type) {
+    case O_IMAGE_TYPE_PNG:
+      return png_skip_rows(&self->png, num_rows);
+    case O_IMAGE_TYPE_QOI:
+      return qoi_skip_rows(&self->qoi, num_rows);
+    case O_IMAGE_TYPE_PNM:
+    case O_IMAGE_TYPE_CACHE:
+      /* Stored raw, so skipping is only moving the cursor. */
+      while (num_rows > 0) {
+        const void *data;
+        size_t skipped;
+        if (o_image_read_direct(self, &data, num_rows * self->row_stride,
+                                NULL, &skipped) <= 0)
+          return false;
+        num_rows -= skipped;
+      }
+      return true;
+    default:
+      errno = ENXIO;
+      return false;
+  }
+}
+
+/* Copies the columns of @region out of rows served in place. */
+static ssize_t o_image_read_direct_columns(struct o_image *self,
+                                           const struct o_image_region *region,
+                                           void *buffer, size_t size,
+                                           size_t *first_row,
+                                           size_t *num_rows) {
+  size_t bytes_per_pixel = self->row_stride / self->width;
+  size_t row_stride = (size_t)region->width * bytes_per_pixel;
+
+  const uint8_t *data;
+  ssize_t size_read =
+      o_image_read_direct(self, (const void **)&data,
+                          size / row_stride * self->row_stride, first_row,
+                          num_rows);
+  if (size_read <= 0) return size_read;
+
+  for (size_t i = 0; i < *num_rows; i++)
+    memcpy((uint8_t *)buffer + i * row_stride,
+           data + i * self->row_stride + region->x * bytes_per_pixel,
+           row_stride);
+
+  return *num_rows * row_stride;
+}
+
+ssize_t o_image_read_region(struct o_image *self,
+                            const struct o_image_region *region, void *buffer,
+                            size_t size, size_t *first_row,
+                            size_t *num_rows) {
+  assert(self != NULL);
+  assert(region != NULL);
+  assert(region->width > 0 && region->height > 0);
+  assert(region->x + region->width <= self->width);
+  assert(region->y + region->height <= self->height);
+
+  size_t row_stride = self->row_stride / self->width * region->width;
+  assert(buffer != NULL && size >= row_stride);
+
+  size_t _first_row = 0;
+  size_t _num_rows = 0;
+  ssize_t result = 0;
+
+  size_t next_row = o_image_next_row(self);
+  size_t end_row = (size_t)region->y + region->height;
+  if (next_row >= end_row) goto out;
+
+  /* A partial image can't be cached. */
+  if (self->type != O_IMAGE_TYPE_CACHE) o_image_cache_clear(&self->cache);
+
+  if (next_row < region->y) {
+    if (!o_image_skip_rows(self, region->y - next_row)) return -1;
+    next_row = region->y;
+  }
+
+  /* Never decode past the bottom of the region. */
+  size_t max_rows = size / row_stride;
+  if (max_rows > end_row - next_row) max_rows = end_row - next_row;
+  size = max_rows * row_stride;
+
   switch (self->type) {
     case O_IMAGE_TYPE_PNG:
-      return png_read(&self->png, buffer, size, first_row, num_rows);
+      result = png_read_columns(&self->png, region->x, region->width, buffer,
+                                size, &_first_row, &_num_rows);
+      break;
+    case O_IMAGE_TYPE_QOI:
+      result = qoi_read_columns(&self->qoi, region->x, region->width, buffer,
+                                size, &_first_row, &_num_rows);
+      break;
+    case O_IMAGE_TYPE_PNM:
+    case O_IMAGE_TYPE_CACHE:
+      result = o_image_read_direct_columns(self, region, buffer, size,
+                                           &_first_row, &_num_rows);
+      break;
     default:
       errno = ENXIO;
       return -1;
   }
+  if (result < 0) return result;
+
+  _first_row -= region->y;
+
+out:
+  if (first_row != NULL) *first_row = _first_row;
+
+  if (num_rows != NULL) *num_rows = _num_rows;
+
+  return result;
+}
+
+bool o_image_can_read_direct(const struct o_image *self) {
+  assert(self != NULL);
+
+  return self->type == O_IMAGE_TYPE_PNM || self->type == O_IMAGE_TYPE_CACHE;
 }
@@ -3,7 +3,10 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "cache.h"
 #include "png.h"
+#include "pnm.h"
+#include "qoi.h"
 
 enum o_image_format {
   O_IMAGE_FORMAT_INVALID,
@@ -14,21 +17,80 @@ enum o_image_format {
 enum o_image_type {
   O_IMAGE_TYPE_INVALID,
   O_IMAGE_TYPE_PNG,
+  O_IMAGE_TYPE_PNM,
+  O_IMAGE_TYPE_QOI,
+  /* Decoded pixels served from the on-disk cache. */
+  O_IMAGE_TYPE_CACHE,
+};
+
+/* A rectangle of pixels, in image coordinates. */
+struct o_image_region {
+  uint32_t x;
+  uint32_t y;
+  uint32_t width;
+  uint32_t height;
 };
 
 struct o_image {
   uint32_t width;
   uint32_t height;
+  size_t row_stride;
 
   uint8_t type;
   uint32_t format;
 
   struct png_ctx png;
+  struct pnm_ctx pnm;
+  struct qoi_ctx qoi;
+  struct o_image_cache_entry cache;
 };
 
+/* Makes PNG files opened from now on be read through a readahead ring
+ * instead of being mapped.
+ */
+void o_image_set_readahead(bool enabled);
+
+/* Serves the pixels from the decoded-pixel cache when it's enabled and holds
+ * this file, and otherwise stores them there as they get decoded.
+ */
 bool o_image_init_from_filename(struct o_image *self, const char *filename);
 
+/* Decodes an image already held in memory, without any file I/O. The @data
+ * buffer is not copied and must outlive the image.
+ */
+bool o_image_init_from_memory(struct o_image *self, const void *data,
+                              size_t size);
+
+/* Same as above, with PNG decoding allocating only from @arena, within its
+ * budget.
+ */
+bool o_image_init_from_filename_in_arena(struct o_image *self,
+                                         const char *filename,
+                                         struct png_arena *arena);
+
+bool o_image_init_from_memory_in_arena(struct o_image *self, const void *data,
+                                       size_t size, struct png_arena *arena);
+
 void o_image_clear(struct o_image *self);
 
 ssize_t o_image_read(struct o_image *self, void *buffer, size_t size,
                      size_t *first_row, size_t *num_rows);
+
+/* Decodes only the pixels of @region into @buffer, in rows of @region->width
+ * pixels, top to bottom, with @first_row counted from the top of the region.
+ * Rows above the region are decoded and dropped without being stored, rows
+ * below it are never decoded, and 0 is returned once the region is complete.
+ * Must not be mixed with o_image_read() on the same image.
+ */
+ssize_t o_image_read_region(struct o_image *self,
+                            const struct o_image_region *region, void *buffer,
+                            size_t size, size_t *first_row, size_t *num_rows);
+
+/* Zero-copy variant of o_image_read() for formats stored uncompressed: @data
+ * is pointed at the next rows instead of filling a caller buffer. Fails with
+ * ENOTSUP for formats that need decoding.
+ */
+ssize_t o_image_read_direct(struct o_image *self, const void **data,
+                            size_t size, size_t *first_row, size_t *num_rows);
+
+bool o_image_can_read_direct(const struct o_image *self);
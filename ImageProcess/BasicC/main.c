@@ -1,14 +1,23 @@
 // https://github.com/elima/gpu-playground/tree/master/gl-image-loader
 
-#include <GLES2/gl2.h>
+#include <GLES3/gl3.h>
+/* After gl3.h, for the BC compressed formats. */
+#include <GLES2/gl2ext.h>
 #include <GLFW/glfw3.h>
 #include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "batch.h"
+#include "compress.h"
 #include "image.h"
+#include "mipmap.h"
+#include "stream.h"
+#include "tiled_texture.h"
 
 static bool gl_utils_print_shader_log(GLuint shader) {
   GLint length;
@@ -39,30 +48,53 @@ static GLuint gl_utils_load_shader(const char *shader_source, GLenum type) {
   return shader;
 }
 
-static GLuint create_shader_program(void) {
-  const char *VERTEX_SOURCE =
-      "attribute vec2 pos;\n"
-      "attribute vec2 texture;\n"
-      "varying vec2 v_texture;\n"
-      "void main() {\n"
-      "  v_texture = texture;\n"
-      "  gl_Position = vec4(pos, 0, 1);\n"
-      "}\n";
-
-  const char *FRAGMENT_SOURCE =
-      "precision mediump float;\n"
-      "uniform sampler2D u_tex;\n"
-      "varying vec2 v_texture;\n"
-      "void main() {\n"
-      "  gl_FragColor = texture2D(u_tex, v_texture);\n"
-      "}\n";
-
-  GLuint vertex_shader = gl_utils_load_shader(VERTEX_SOURCE, GL_VERTEX_SHADER);
+static const char *VERTEX_SOURCE =
+    "attribute vec2 pos;\n"
+    "attribute vec2 texture;\n"
+    "varying vec2 v_texture;\n"
+    "void main() {\n"
+    "  v_texture = texture;\n"
+    "  gl_Position = vec4(pos, 0, 1);\n"
+    "}\n";
+
+static const char *FRAGMENT_SOURCE =
+    "precision mediump float;\n"
+    "uniform sampler2D u_tex;\n"
+    "varying vec2 v_texture;\n"
+    "void main() {\n"
+    "  gl_FragColor = texture2D(u_tex, v_texture);\n"
+    "}\n";
+
+/* Texture arrays need GLSL ES 3.00. */
+static const char *ARRAY_VERTEX_SOURCE =
+    "#version 300 es\n"
+    "in vec2 pos;\n"
+    "in vec2 texture;\n"
+    "out vec2 v_texture;\n"
+    "void main() {\n"
+    "  v_texture = texture;\n"
+    "  gl_Position = vec4(pos, 0, 1);\n"
+    "}\n";
+
+static const char *ARRAY_FRAGMENT_SOURCE =
+    "#version 300 es\n"
+    "precision mediump float;\n"
+    "uniform mediump sampler2DArray u_tex;\n"
+    "uniform float u_layer;\n"
+    "in vec2 v_texture;\n"
+    "out vec4 color;\n"
+    "void main() {\n"
+    "  color = texture(u_tex, vec3(v_texture, u_layer));\n"
+    "}\n";
+
+static GLuint create_shader_program(const char *vertex_source,
+                                    const char *fragment_source) {
+  GLuint vertex_shader = gl_utils_load_shader(vertex_source, GL_VERTEX_SHADER);
   assert(vertex_shader >= 0);
   assert(glGetError() == GL_NO_ERROR);
 
   GLuint fragment_shader =
-      gl_utils_load_shader(FRAGMENT_SOURCE, GL_FRAGMENT_SHADER);
+      gl_utils_load_shader(fragment_source, GL_FRAGMENT_SHADER);
   assert(fragment_shader >= 0);
   assert(glGetError() == GL_NO_ERROR);
 
@@ -85,36 +117,568 @@ static GLuint create_shader_program(void) {
   return program;
 }
 
+enum { BAND_SIZE = 1 << 20, NUM_BANDS = 4 };
+
+/* Default tile edge for --tiled, and the largest window opened. */
+enum { TILE_SIZE = 2048, MAX_WINDOW_SIZE = 2048 };
+
+/* Default size cap of the decoded-pixel cache, in MiB. */
+enum { CACHE_SIZE = 1024 };
+
+/* Where decoded rows go: the bound texture, optionally with its mip chain
+ * built along, or a tile grid.
+ */
+struct upload_target {
+  uint32_t width;
+  GLenum format;
+  struct o_tiled_texture *tiles;
+  struct o_mipmap *mipmap;
+};
+
+/* Uploads rows of a mip level of the bound texture as they are produced. */
+static void upload_mip_rows(void *user_data, uint32_t level,
+                            const void *pixels, size_t first_row,
+                            size_t num_rows, uint32_t width) {
+  const struct upload_target *target = user_data;
+
+  glTexSubImage2D(GL_TEXTURE_2D, level, 0, first_row, width, num_rows,
+                  target->format, GL_UNSIGNED_BYTE, pixels);
+  assert(glGetError() == GL_NO_ERROR);
+}
+
+static void upload_rows(const struct upload_target *target,
+                        const void *pixels, size_t first_row,
+                        size_t num_rows) {
+  if (target->tiles != NULL) {
+    o_tiled_texture_write(target->tiles, pixels, first_row, num_rows);
+    return;
+  }
+
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first_row, target->width, num_rows,
+                  target->format, GL_UNSIGNED_BYTE, pixels);
+  assert(glGetError() == GL_NO_ERROR);
+
+  if (target->mipmap != NULL)
+    o_mipmap_write(target->mipmap, pixels, num_rows);
+}
+
+/* Maps the whole pixel-unpack buffer currently bound for writing, orphaning
+ * its previous storage so that a pending upload from it doesn't stall.
+ */
+static void *map_unpack_buffer(size_t size) {
+  void *data = glMapBufferRange(
+      GL_PIXEL_UNPACK_BUFFER, 0, size,
+      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+  assert(glGetError() == GL_NO_ERROR);
+
+  return data;
+}
+
+/* Loads the image into the bound texture progressively. A decoder thread
+ * fills a bounded ring of row bands while this thread uploads them, so
+ * inflating and uploading overlap.
+ */
+static bool load_texture_streamed(struct o_image *image,
+                                  const struct upload_target *target,
+                                  size_t band_size, bool use_pbo) {
+  /* With --pbo, the bands are mapped pixel-unpack buffers: the decoder
+   * writes rows straight into driver memory and the texture is updated from
+   * the buffer, without an extra CPU copy of the pixels.
+   */
+  GLuint pbos[NUM_BANDS] = {0};
+  void *pbo_data[NUM_BANDS] = {NULL};
+  if (use_pbo) {
+    glGenBuffers(NUM_BANDS, pbos);
+    for (int32_t i = 0; i < NUM_BANDS; i++) {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[i]);
+      glBufferData(GL_PIXEL_UNPACK_BUFFER, band_size, NULL, GL_STREAM_DRAW);
+      assert(glGetError() == GL_NO_ERROR);
+      pbo_data[i] = map_unpack_buffer(band_size);
+      assert(pbo_data[i] != NULL);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  }
+
+  static struct o_image_stream stream;
+  if (!o_image_stream_init(&stream, image, band_size, NUM_BANDS,
+                           use_pbo ? pbo_data : NULL) ||
+      !o_image_stream_start(&stream))
+    return false;
+
+  uint64_t load_start = o_image_stream_now_ns();
+  uint64_t upload_ns = 0;
+
+  ssize_t size_read;
+  do {
+    struct o_image_band *band = o_image_stream_acquire(&stream);
+    size_read = band->size_read;
+    assert(size_read >= 0);
+    if (size_read > 0) {
+      uint64_t start = o_image_stream_now_ns();
+      const void *pixels = band->data;
+      if (use_pbo) {
+        /* Source the upload from offset 0 of the band's buffer. */
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[band - stream.bands]);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        pixels = NULL;
+      }
+
+      upload_rows(target, pixels, band->first_row, band->num_rows);
+
+      if (use_pbo) {
+        /* Hand fresh storage back to the decoder. */
+        band->data = map_unpack_buffer(band_size);
+        assert(band->data != NULL);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      }
+      upload_ns += o_image_stream_now_ns() - start;
+    }
+    o_image_stream_release(&stream);
+  } while (size_read > 0);
+
+  uint64_t load_ns = o_image_stream_now_ns() - load_start;
+  o_image_stream_clear(&stream);
+
+  if (use_pbo) {
+    for (int32_t i = 0; i < NUM_BANDS; i++) {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[i]);
+      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(NUM_BANDS, pbos);
+  }
+
+  printf("Time to texture: %.2f ms\n", load_ns / 1e6);
+  printf("  decode: %.2f ms (stalled %.2f ms)\n",
+         stream.stats.decode_ns / 1e6, stream.stats.decode_stall_ns / 1e6);
+  printf("  upload: %.2f ms (stalled %.2f ms)\n", upload_ns / 1e6,
+         stream.stats.consume_stall_ns / 1e6);
+
+  return true;
+}
+
+/* Loads a raw image into the bound texture straight from its mapped file. */
+static bool load_texture_direct(struct o_image *image,
+                                const struct upload_target *target,
+                                size_t band_size) {
+  uint64_t load_start = o_image_stream_now_ns();
+
+  const void *pixels;
+  size_t first_row;
+  size_t num_rows;
+
+  ssize_t size_read;
+  do {
+    size_read = o_image_read_direct(image, &pixels, band_size, &first_row,
+                                    &num_rows);
+    if (size_read < 0) return false;
+    if (size_read > 0)
+      upload_rows(target, pixels, first_row, num_rows);
+  } while (size_read > 0);
+
+  printf("Time to texture: %.2f ms (zero-copy)\n",
+         (o_image_stream_now_ns() - load_start) / 1e6);
+
+  return true;
+}
+
+/* Decodes and uploads only the pixels of @region. */
+static bool load_texture_region(struct o_image *image,
+                                const struct o_image_region *region,
+                                const struct upload_target *target,
+                                size_t band_size) {
+  uint64_t load_start = o_image_stream_now_ns();
+
+  void *band = malloc(band_size);
+  if (band == NULL) return false;
+
+  size_t first_row;
+  size_t num_rows;
+
+  ssize_t size_read;
+  do {
+    size_read = o_image_read_region(image, region, band, band_size,
+                                    &first_row, &num_rows);
+    if (size_read > 0) upload_rows(target, band, first_row, num_rows);
+  } while (size_read > 0);
+
+  free(band);
+  if (size_read < 0) return false;
+
+  printf("Time to texture: %.2f ms (%ux%u region)\n",
+         (o_image_stream_now_ns() - load_start) / 1e6, region->width,
+         region->height);
+
+  return true;
+}
+
+/* Draws @tex over the whole viewport. */
+static void draw_texture(GLenum target, GLuint tex) {
+  /* Bind the texture. */
+  glBindTexture(target, tex);
+  assert(glGetError() == GL_NO_ERROR);
+
+  /* Draw a quad. */
+  static const GLfloat s_vertices[4][2] = {
+      {-1.0, 1.0},
+      {1.0, 1.0},
+      {-1.0, -1.0},
+      {1.0, -1.0},
+  };
+
+  static const GLfloat s_texturePos[4][2] = {
+      {0, 0},
+      {1, 0},
+      {0, 1},
+      {1, 1},
+  };
+
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, s_vertices);
+  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, s_texturePos);
+
+  glEnableVertexAttribArray(0);
+  glEnableVertexAttribArray(1);
+
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+  glDisableVertexAttribArray(0);
+  glDisableVertexAttribArray(1);
+}
+
+/* Decodes the whole image, compresses it into @name blocks on all cores and
+ * uploads them to the bound texture.
+ */
+static bool load_texture_compressed(struct o_image *image, const char *name,
+                                    enum o_compress_quality quality) {
+  /* BC formats are desktop formats, only exposed by some ES drivers. */
+  const char *extension = NULL;
+  if (strcmp(name, "bc1") == 0)
+    extension = "GL_EXT_texture_compression_s3tc";
+  else if (strcmp(name, "bc7") == 0)
+    extension = "GL_EXT_texture_compression_bptc";
+  else if (strcmp(name, "etc2") != 0)
+    return false;
+
+  const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+  if (extension != NULL &&
+      (extensions == NULL || strstr(extensions, extension) == NULL)) {
+    printf("%s is not supported\n", extension);
+    return false;
+  }
+
+  uint64_t load_start = o_image_stream_now_ns();
+
+  uint32_t width = image->width;
+  uint32_t height = image->height;
+  size_t size = image->row_stride * height;
+  uint8_t *pixels = malloc((size_t)width * height * 4);
+  uint8_t *rows =
+      image->format == O_IMAGE_FORMAT_RGB ? malloc(size) : pixels;
+  if (pixels == NULL || rows == NULL) {
+    if (rows != pixels) free(rows);
+    free(pixels);
+    return false;
+  }
+
+  size_t offset = 0;
+  ssize_t size_read;
+  do {
+    size_read = o_image_read(image, rows + offset, size - offset, NULL, NULL);
+    if (size_read > 0) offset += size_read;
+  } while (size_read > 0 && offset < size);
+
+  if (rows != pixels) {
+    o_convert_func expand = o_convert_get_kernel(O_CONVERT_RGB8_TO_RGBA8,
+                                                 o_convert_best_isa());
+    for (uint32_t y = 0; y < height; y++)
+      expand(pixels + (size_t)y * width * 4, rows + y * image->row_stride,
+             width, NULL);
+    free(rows);
+  }
+
+  if (offset < size) {
+    free(pixels);
+    return false;
+  }
+
+  /* Opaque images don't need the alpha block of ETC2. */
+  bool opaque = true;
+  for (size_t i = 0; i < (size_t)width * height && opaque; i++)
+    opaque = pixels[i * 4 + 3] == 255;
+
+  enum o_compress_format format;
+  GLenum internal_format;
+  if (strcmp(name, "bc1") == 0) {
+    format = O_COMPRESS_BC1;
+    internal_format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+  } else if (strcmp(name, "bc7") == 0) {
+    format = O_COMPRESS_BC7;
+    internal_format = GL_COMPRESSED_RGBA_BPTC_UNORM_EXT;
+  } else {
+    format = opaque ? O_COMPRESS_ETC2_RGB8 : O_COMPRESS_ETC2_RGBA8;
+    internal_format =
+        opaque ? GL_COMPRESSED_RGB8_ETC2 : GL_COMPRESSED_RGBA8_ETC2_EAC;
+  }
+
+  size_t compressed_size = o_compress_image_size(format, width, height);
+  uint8_t *blocks = malloc(compressed_size);
+  if (blocks == NULL) {
+    free(pixels);
+    return false;
+  }
+
+  uint64_t start = o_image_stream_now_ns();
+  o_compress_image(format, quality, pixels, width, height, blocks, 0);
+  uint64_t encode_ns = o_image_stream_now_ns() - start;
+
+  glCompressedTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0,
+                         compressed_size, blocks);
+  assert(glGetError() == GL_NO_ERROR);
+
+  printf("Time to texture: %.2f ms\n",
+         (o_image_stream_now_ns() - load_start) / 1e6);
+  printf("  %s: %.2f ms, %zu bytes (%.1fx smaller)\n",
+         o_compress_format_name(format), encode_ns / 1e6, compressed_size,
+         (double)width * height * 4 / compressed_size);
+
+  /* Measure the quality against the source pixels. */
+  uint8_t *decoded = malloc((size_t)width * height * 4);
+  if (decoded != NULL) {
+    o_compress_decode_image(format, blocks, width, height, decoded);
+    bool alpha = format == O_COMPRESS_ETC2_RGBA8 || format == O_COMPRESS_BC7;
+    printf("  PSNR: %.2f dB\n",
+           o_compress_psnr(pixels, decoded, width, height, alpha ? 4 : 3));
+    free(decoded);
+  }
+
+  free(blocks);
+  free(pixels);
+
+  return true;
+}
+
+/* Decodes @num_files images of the same size on all cores into the layers
+ * of a texture array, uploading each one as soon as any worker finishes it.
+ */
+static GLuint load_texture_array(const char *const *filenames,
+                                 size_t num_files, uint32_t width,
+                                 uint32_t height) {
+  GLuint tex;
+  glGenTextures(1, &tex);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, tex);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA8, width, height, num_files);
+  assert(glGetError() == GL_NO_ERROR);
+
+  static struct o_image_batch batch;
+  if (!o_image_batch_init(&batch, filenames, num_files, width, height, 0,
+                          NUM_BANDS) ||
+      !o_image_batch_start(&batch))
+    return 0;
+
+  uint64_t load_start = o_image_stream_now_ns();
+  uint64_t upload_ns = 0;
+  size_t num_failed = 0;
+
+  struct o_image_batch_item *item;
+  while ((item = o_image_batch_acquire(&batch)) != NULL) {
+    if (item->ok) {
+      uint64_t start = o_image_stream_now_ns();
+      glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, item->index, width,
+                      height, 1, GL_RGBA, GL_UNSIGNED_BYTE, item->pixels);
+      assert(glGetError() == GL_NO_ERROR);
+      upload_ns += o_image_stream_now_ns() - start;
+    } else {
+      printf("Failed to decode %s\n", filenames[item->index]);
+      num_failed++;
+    }
+    o_image_batch_release(&batch, item);
+  }
+
+  uint64_t load_ns = o_image_stream_now_ns() - load_start;
+  o_image_batch_clear(&batch);
+
+  printf("Time to texture array: %.2f ms for %zu layers on %u threads\n",
+         load_ns / 1e6, num_files, batch.num_threads);
+  printf("  decode: %.2f ms (summed over threads)\n",
+         batch.stats.decode_ns / 1e6);
+  printf("  upload: %.2f ms (stalled %.2f ms)\n", upload_ns / 1e6,
+         batch.stats.consume_stall_ns / 1e6);
+
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+  if (num_failed > 0) {
+    glDeleteTextures(1, &tex);
+    return 0;
+  }
+
+  return tex;
+}
+
+/* Loads a batch of images into a texture array and shows one layer per
+ * second.
+ */
+static bool show_texture_array(GLFWwindow *window,
+                               const char *const *filenames, size_t num_files,
+                               uint32_t width, uint32_t height) {
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+  GLuint tex = load_texture_array(filenames, num_files, width, height);
+  if (tex == 0) return false;
+
+  GLuint program =
+      create_shader_program(ARRAY_VERTEX_SOURCE, ARRAY_FRAGMENT_SOURCE);
+  glUseProgram(program);
+  GLint layer_location = glGetUniformLocation(program, "u_layer");
+  assert(glGetError() == GL_NO_ERROR);
+
+  while (!glfwWindowShouldClose(window)) {
+    glClearColor(0.25, 0.25, 0.25, 0.5);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    glUniform1f(layer_location, (uint64_t)glfwGetTime() % num_files);
+    glActiveTexture(GL_TEXTURE0);
+    draw_texture(GL_TEXTURE_2D_ARRAY, tex);
+
+    glfwSwapBuffers(window);
+    glfwPollEvents();
+  }
+
+  glDeleteTextures(1, &tex);
+
+  return true;
+}
+
 int32_t main(int32_t argc, char *argv[]) {
-  printf("Usage: %s <path-to-PNG-image>\n", argv[0]);
+  printf(
+      "Usage: %s [--pbo] [--mipmap] [--tiled] [--tile-size <n>] "
+      "[--cache <dir>] [--cache-size <MiB>] [--compress etc2|bc1|bc7] "
+      "[--quality 0-2] [--region <x>,<y>,<w>,<h>] [--readahead] "
+      "<path-to-image> "
+      "[<path-to-image>...]\n",
+      argv[0]);
 
   /* Load an decode an image. */
   static struct o_image image;
 
-  const char *image_url;
-  if (argc > 1)
-    image_url = argv[1];
-  else
+  /* More than one image is loaded as a batch, into a texture array. */
+  const char **image_urls = calloc(argc, sizeof(const char *));
+  size_t num_images = 0;
+  if (image_urls == NULL) return EXIT_FAILURE;
+
+  bool use_pbo = false;
+  bool use_mipmap = false;
+  bool use_tiles = false;
+  uint32_t tile_size = TILE_SIZE;
+  const char *cache_dir = NULL;
+  uint64_t cache_size = CACHE_SIZE;
+  const char *compress = NULL;
+  uint32_t quality = O_COMPRESS_QUALITY_NORMAL;
+  const char *region_arg = NULL;
+  bool use_readahead = false;
+  for (int32_t i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--pbo") == 0)
+      use_pbo = true;
+    else if (strcmp(argv[i], "--mipmap") == 0)
+      use_mipmap = true;
+    else if (strcmp(argv[i], "--tiled") == 0)
+      use_tiles = true;
+    else if (strcmp(argv[i], "--tile-size") == 0 && i + 1 < argc)
+      tile_size = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+      cache_dir = argv[++i];
+    else if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc)
+      cache_size = strtoull(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--compress") == 0 && i + 1 < argc)
+      compress = argv[++i];
+    else if (strcmp(argv[i], "--quality") == 0 && i + 1 < argc)
+      quality = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--region") == 0 && i + 1 < argc)
+      region_arg = argv[++i];
+    else if (strcmp(argv[i], "--readahead") == 0)
+      use_readahead = true;
+    else
+      image_urls[num_images++] = argv[i];
+  }
+
+  if (num_images == 0 || tile_size == 0 ||
+      quality >= O_COMPRESS_NUM_QUALITIES)
+    return EXIT_FAILURE;
+
+  /* Compressed textures are uploaded whole, without a mip chain. */
+  if (compress != NULL) use_mipmap = false;
+
+  o_image_set_readahead(use_readahead);
+
+  if (cache_dir != NULL && !o_image_cache_enable(cache_dir, cache_size << 20))
     return EXIT_FAILURE;
 
   /* This loads the image header (metadata), but doesn't load any pixel
    * data or do any decoding.
    */
-  if (!o_image_init_from_filename(&image, image_url)) return EXIT_FAILURE;
+  if (!o_image_init_from_filename(&image, image_urls[0])) return EXIT_FAILURE;
+
+  /* A cache miss stores the decoded rows, and the mip chain is built from
+   * them, but they can't be read back from write-only unpack buffers.
+   */
+  if ((cache_dir != NULL || use_mipmap) && !o_image_can_read_direct(&image))
+    use_pbo = false;
+
+  /* Everything below is sized by the region, the whole image by default. */
+  struct o_image_region region = {0, 0, image.width, image.height};
+  if (region_arg != NULL) {
+    if (sscanf(region_arg, "%u,%u,%u,%u", &region.x, &region.y,
+               &region.width, &region.height) != 4 ||
+        region.width == 0 || region.height == 0 ||
+        region.x >= image.width || region.y >= image.height) {
+      o_image_clear(&image);
+      return EXIT_FAILURE;
+    }
+    if (region.width > image.width - region.x)
+      region.width = image.width - region.x;
+    if (region.height > image.height - region.y)
+      region.height = image.height - region.y;
+
+    /* Only the region's columns are kept, copied out on the CPU. */
+    use_pbo = false;
+    compress = NULL;
+  }
 
   GLFWwindow *window;
 
   /* Initialize GLFW. */
   if (!glfwInit()) return EXIT_FAILURE;
 
-  /* Select an OpenGL-ES 2.0 profile. */
+  /* Select an OpenGL-ES 2.0 profile, or 3.0 for pixel-unpack buffers,
+   * texture arrays and mipmaps of non-power-of-two textures.
+   */
   glfwWindowHint(GLFW_CLIENT_API, GLFW_OPENGL_ES_API);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR,
+                 use_pbo || use_mipmap || compress != NULL || num_images > 1
+                     ? 3
+                     : 2);
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
 
-  /* Create a windowed mode window and its OpenGL context */
-  window = glfwCreateWindow(image.width, image.height, "GL Image Loader", NULL,
-                            NULL);
+  /* Create a windowed mode window and its OpenGL context, scaled down to fit
+   * the screen for large images.
+   */
+  uint32_t window_width = region.width;
+  uint32_t window_height = region.height;
+  if (window_width > MAX_WINDOW_SIZE || window_height > MAX_WINDOW_SIZE) {
+    double scale = (double)MAX_WINDOW_SIZE /
+                   (window_width > window_height ? window_width
+                                                 : window_height);
+    window_width = window_width * scale > 1 ? window_width * scale : 1;
+    window_height = window_height * scale > 1 ? window_height * scale : 1;
+  }
+  window = glfwCreateWindow(window_width, window_height, "GL Image Loader",
+                            NULL, NULL);
   if (window == NULL) {
     glfwTerminate();
     return EXIT_FAILURE;
@@ -127,50 +691,140 @@ int32_t main(int32_t argc, char *argv[]) {
   const GLubyte *gles_version = glGetString(GL_VERSION);
   printf("%s\n", (char *)gles_version);
 
-  /* Create a texture for the image. */
-  GLuint tex;
-  glGenTextures(1, &tex);
-  assert(glGetError() == GL_NO_ERROR);
-  assert(tex > 0);
-  glBindTexture(GL_TEXTURE_2D, tex);
-  assert(glGetError() == GL_NO_ERROR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  if (num_images > 1) {
+    /* The workers reopen every image, including the first. */
+    o_image_clear(&image);
 
-  /* Load the image into the texture, progressively in chunks of max
-   * BLOCK_SIZE bytes. */
-  enum { BLOCK_SIZE = 8192 };
+    bool ok = show_texture_array(window, image_urls, num_images, image.width,
+                                 image.height);
+    free(image_urls);
+    glfwTerminate();
 
-  uint8_t buf[BLOCK_SIZE] = {
-      0,
-  };
-  size_t first_row;
-  size_t num_rows;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  /* Images larger than the biggest texture are split into tiles. */
+  GLint max_texture_size;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+  if (region.width > (uint32_t)max_texture_size ||
+      region.height > (uint32_t)max_texture_size)
+    use_tiles = true;
+  if (tile_size > (uint32_t)max_texture_size) tile_size = max_texture_size;
+
+  /* Load the image into the texture in bands of rows. */
+  size_t band_size = BAND_SIZE;
+  size_t row_stride = image.row_stride / image.width * region.width;
+  if (band_size < row_stride) band_size = row_stride;
 
   GLuint format = image.format == O_IMAGE_FORMAT_RGB ? GL_RGB : GL_RGBA;
 
-  /* Allocate the texture size. */
-  glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format,
-               GL_UNSIGNED_BYTE, NULL);
-  assert(glGetError() == GL_NO_ERROR);
+  /* Rows are tightly packed in the bands. */
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
-  ssize_t size_read;
-  do {
-    size_read = o_image_read(&image, buf, BLOCK_SIZE, &first_row, &num_rows);
-    assert(size_read >= 0);
-    if (size_read > 0) {
-      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first_row, image.width, num_rows,
-                      format, GL_UNSIGNED_BYTE, buf);
+  GLuint tex = 0;
+  static struct o_tiled_texture tiles;
+  if (use_tiles) {
+    if (!o_tiled_texture_init(&tiles, region.width, region.height, format,
+                              tile_size)) {
+      glfwTerminate();
+      return EXIT_FAILURE;
+    }
+    printf("Tiled: %ux%u tiles of %u pixels\n", tiles.columns, tiles.rows,
+           tile_size);
+
+    /* Tiles are repacked on the CPU, so bands can't live in unpack buffers.
+     * They have no mip chains either.
+     */
+    use_pbo = false;
+    use_mipmap = false;
+    compress = NULL;
+  } else {
+    /* Create a texture for the image. */
+    glGenTextures(1, &tex);
+    assert(glGetError() == GL_NO_ERROR);
+    assert(tex > 0);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    assert(glGetError() == GL_NO_ERROR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    use_mipmap ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    /* Allocate the texture size, and that of every mip level. Compressed
+     * textures are allocated by the upload.
+     */
+    uint32_t num_levels =
+        use_mipmap ? o_mipmap_num_levels(region.width, region.height)
+        : compress != NULL ? 0
+                           : 1;
+    for (uint32_t level = 0; level < num_levels; level++) {
+      uint32_t width = region.width >> level > 0 ? region.width >> level : 1;
+      uint32_t height =
+          region.height >> level > 0 ? region.height >> level : 1;
+      glTexImage2D(GL_TEXTURE_2D, level, format, width, height, 0, format,
+                   GL_UNSIGNED_BYTE, NULL);
       assert(glGetError() == GL_NO_ERROR);
     }
-  } while (size_read > 0);
+  }
+
+  struct upload_target target = {
+      .width = region.width,
+      .format = format,
+      .tiles = use_tiles ? &tiles : NULL,
+  };
+
+  /* The mip levels are downsampled from each band of decoded rows and
+   * uploaded as soon as their own rows are complete.
+   */
+  static struct o_mipmap mipmap;
+  if (use_mipmap) {
+    if (!o_mipmap_init(&mipmap, region.width, region.height,
+                       format == GL_RGBA ? 4 : 3, band_size,
+                       o_convert_best_isa(), upload_mip_rows, &target)) {
+      glfwTerminate();
+      return EXIT_FAILURE;
+    }
+    target.mipmap = &mipmap;
+  }
+
+  bool ok;
+  if (compress != NULL)
+    ok = load_texture_compressed(&image, compress, quality);
+  else if (region_arg != NULL)
+    ok = load_texture_region(&image, &region, &target, band_size);
+  else if (o_image_can_read_direct(&image))
+    ok = load_texture_direct(&image, &target, band_size);
+  else
+    ok = load_texture_streamed(&image, &target, band_size, use_pbo);
+
+  if (use_mipmap) o_mipmap_clear(&mipmap);
+
+  if (!ok) {
+    glfwTerminate();
+    return EXIT_FAILURE;
+  }
 
   glBindTexture(GL_TEXTURE_2D, 0);
 
+  const struct file_readahead *readahead = &image.png.readahead;
+  if (file_readahead_is_open(readahead)) {
+    printf("Readahead (%s): %u reads, %" PRIu64 " bytes, waited %.2f ms\n",
+           file_readahead_uses_io_uring(readahead) ? "io_uring" : "thread",
+           readahead->stats.num_reads, readahead->stats.bytes_read,
+           readahead->stats.wait_ns / 1e6);
+  }
+
+  if (cache_dir != NULL) {
+    struct o_image_cache_stats stats;
+    o_image_cache_get_stats(&stats);
+    printf("Cache: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64
+           " evictions\n",
+           stats.hits, stats.misses, stats.evictions);
+  }
+
   /* Create shader program to sample the texture. */
-  GLuint program = create_shader_program();
+  GLuint program = create_shader_program(VERTEX_SOURCE, FRAGMENT_SOURCE);
   glUseProgram(program);
   assert(glGetError() == GL_NO_ERROR);
 
@@ -180,40 +834,15 @@ int32_t main(int32_t argc, char *argv[]) {
     glClearColor(0.25, 0.25, 0.25, 0.5);
     glClear(GL_COLOR_BUFFER_BIT);
 
-    /* Bind the texture. */
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, tex);
-    assert(glGetError() == GL_NO_ERROR);
-
     /* Enable blending for transparent PNGs. */
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-    /* Draw a quad. */
-    static const GLfloat s_vertices[4][2] = {
-        {-1.0, 1.0},
-        {1.0, 1.0},
-        {-1.0, -1.0},
-        {1.0, -1.0},
-    };
-
-    static const GLfloat s_texturePos[4][2] = {
-        {0, 0},
-        {1, 0},
-        {0, 1},
-        {1, 1},
-    };
-
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, s_vertices);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, s_texturePos);
-
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-
-    glDisableVertexAttribArray(0);
-    glDisableVertexAttribArray(1);
+    glActiveTexture(GL_TEXTURE0);
+    if (use_tiles)
+      o_tiled_texture_draw(&tiles);
+    else
+      draw_texture(GL_TEXTURE_2D, tex);
 
     /* Swap front and back buffers */
     glfwSwapBuffers(window);
@@ -222,6 +851,10 @@ int32_t main(int32_t argc, char *argv[]) {
     glfwPollEvents();
   }
 
+  if (use_tiles) o_tiled_texture_clear(&tiles);
+
+  free(image_urls);
+
   glfwTerminate();
 
   return EXIT_SUCCESS;
@@ -0,0 +1,257 @@
+#include "mipmap.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define O_MIPMAP_X86 1
+#include <immintrin.h>
+#endif
+
+/* 2x2 box over any number of channels. The last column of an odd-width row
+ * is dropped, like the last row of an odd-height level, except for
+ * one-pixel-wide rows which are averaged with themselves.
+ */
+static void downsample_scalar(uint8_t *dst, const uint8_t *row0,
+                              const uint8_t *row1, uint32_t src_width,
+                              uint32_t dst_width, uint8_t channels) {
+  for (uint32_t x = 0; x < dst_width; x++) {
+    uint32_t x0 = x * 2;
+    uint32_t x1 = x0 + 1 < src_width ? x0 + 1 : x0;
+
+    for (uint8_t c = 0; c < channels; c++) {
+      uint32_t sum = row0[x0 * channels + c] + row0[x1 * channels + c] +
+                     row1[x0 * channels + c] + row1[x1 * channels + c];
+      dst[x * channels + c] = (sum + 2) >> 2;
+    }
+  }
+}
+
+static void downsample_rgba8_scalar(uint8_t *dst, const uint8_t *row0,
+                                    const uint8_t *row1, size_t dst_width) {
+  downsample_scalar(dst, row0, row1, dst_width * 2, dst_width, 4);
+}
+
+#ifdef O_MIPMAP_X86
+
+/* Widens four pixels of each row to 16 bits and sums each 2x2 quad, leaving
+ * the two output pixels in the low bytes.
+ */
+__attribute__((target("sse4.1"))) static void downsample_rgba8_sse4(
+    uint8_t *dst, const uint8_t *row0, const uint8_t *row1,
+    size_t dst_width) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i round = _mm_set1_epi16(2);
+
+  size_t x = 0;
+  for (; x + 2 <= dst_width; x += 2) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(row0 + x * 8));
+    __m128i b = _mm_loadu_si128((const __m128i *)(row1 + x * 8));
+
+    __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+                               _mm_unpacklo_epi8(b, zero));
+    __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+                               _mm_unpackhi_epi8(b, zero));
+    lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+    hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+
+    __m128i sum = _mm_unpacklo_epi64(lo, hi);
+    sum = _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+    _mm_storel_epi64((__m128i *)(dst + x * 4), _mm_packus_epi16(sum, sum));
+  }
+
+  downsample_rgba8_scalar(dst + x * 4, row0 + x * 8, row1 + x * 8,
+                          dst_width - x);
+}
+
+__attribute__((target("avx2"))) static void downsample_rgba8_avx2(
+    uint8_t *dst, const uint8_t *row0, const uint8_t *row1,
+    size_t dst_width) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i round = _mm256_set1_epi16(2);
+
+  /* Same as the SSE kernel in each 128-bit lane, then the two lanes' output
+   * pixels are gathered into the low 128 bits.
+   */
+  size_t x = 0;
+  for (; x + 4 <= dst_width; x += 4) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(row0 + x * 8));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(row1 + x * 8));
+
+    __m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(a, zero),
+                                  _mm256_unpacklo_epi8(b, zero));
+    __m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(a, zero),
+                                  _mm256_unpackhi_epi8(b, zero));
+    lo = _mm256_add_epi16(lo, _mm256_srli_si256(lo, 8));
+    hi = _mm256_add_epi16(hi, _mm256_srli_si256(hi, 8));
+
+    __m256i sum = _mm256_unpacklo_epi64(lo, hi);
+    sum = _mm256_srli_epi16(_mm256_add_epi16(sum, round), 2);
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(sum, sum),
+                                              _MM_SHUFFLE(3, 1, 2, 0));
+    _mm_storeu_si128((__m128i *)(dst + x * 4),
+                     _mm256_castsi256_si128(packed));
+  }
+
+  downsample_rgba8_sse4(dst + x * 4, row0 + x * 8, row1 + x * 8,
+                        dst_width - x);
+}
+
+#endif /* O_MIPMAP_X86 */
+
+o_mipmap_downsample_func o_mipmap_get_downsample(enum o_convert_isa isa) {
+  assert(isa < O_CONVERT_NUM_ISAS);
+
+  /* Shares the CPU feature checks of the conversion kernels. */
+  if (o_convert_get_kernel(O_CONVERT_RGB8_TO_RGBA8, isa) == NULL) return NULL;
+
+  switch (isa) {
+#ifdef O_MIPMAP_X86
+    case O_CONVERT_ISA_SSE4:
+      return downsample_rgba8_sse4;
+    case O_CONVERT_ISA_AVX2:
+      return downsample_rgba8_avx2;
+#endif
+    default:
+      return downsample_rgba8_scalar;
+  }
+}
+
+uint32_t o_mipmap_num_levels(uint32_t width, uint32_t height) {
+  uint32_t num_levels = 1;
+  while (width > 1 || height > 1) {
+    width = width > 1 ? width / 2 : 1;
+    height = height > 1 ? height / 2 : 1;
+    num_levels++;
+  }
+
+  return num_levels;
+}
+
+bool o_mipmap_init(struct o_mipmap *self, uint32_t width, uint32_t height,
+                   uint8_t channels, size_t band_size,
+                   enum o_convert_isa isa, o_mipmap_emit_func emit,
+                   void *user_data) {
+  assert(self != NULL);
+  assert(width > 0 && height > 0);
+  assert(channels == 3 || channels == 4);
+  assert(emit != NULL);
+
+  memset(self, 0x00, sizeof(struct o_mipmap));
+
+  self->width = width;
+  self->height = height;
+  self->channels = channels;
+  self->downsample = o_mipmap_get_downsample(isa);
+  self->emit = emit;
+  self->user_data = user_data;
+
+  self->num_levels = o_mipmap_num_levels(width, height);
+  self->levels = calloc(self->num_levels, sizeof(struct o_mipmap_level));
+  if (self->levels == NULL) {
+    errno = ENOMEM;
+    return false;
+  }
+
+  self->levels[0].width = width;
+  self->levels[0].height = height;
+  self->levels[0].row_stride = (size_t)width * channels;
+
+  for (uint32_t i = 1; i < self->num_levels; i++) {
+    struct o_mipmap_level *level = &self->levels[i];
+    const struct o_mipmap_level *parent = &self->levels[i - 1];
+
+    level->width = parent->width > 1 ? parent->width / 2 : 1;
+    level->height = parent->height > 1 ? parent->height / 2 : 1;
+    level->row_stride = (size_t)level->width * channels;
+
+    level->band_rows = band_size / level->row_stride;
+    if (level->band_rows < 1) level->band_rows = 1;
+    if (level->band_rows > level->height) level->band_rows = level->height;
+
+    level->carry = malloc(parent->row_stride);
+    level->band = malloc(level->band_rows * level->row_stride);
+    if (level->carry == NULL || level->band == NULL) {
+      o_mipmap_clear(self);
+      errno = ENOMEM;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void o_mipmap_clear(struct o_mipmap *self) {
+  assert(self != NULL);
+
+  if (self->levels != NULL) {
+    for (uint32_t i = 1; i < self->num_levels; i++) {
+      free(self->levels[i].carry);
+      free(self->levels[i].band);
+    }
+    free(self->levels);
+    self->levels = NULL;
+  }
+}
+
+static void push_row(struct o_mipmap *self, uint32_t index,
+                     const uint8_t *row);
+
+/* Appends the row just written at the end of the band of level @index. */
+static void finish_row(struct o_mipmap *self, uint32_t index) {
+  struct o_mipmap_level *level = &self->levels[index];
+  const uint8_t *row = level->band + level->band_filled * level->row_stride;
+  level->band_filled++;
+
+  if (index + 1 < self->num_levels) push_row(self, index + 1, row);
+
+  if (level->band_filled == level->band_rows ||
+      level->band_first_row + level->band_filled == level->height) {
+    self->emit(self->user_data, index, level->band, level->band_first_row,
+               level->band_filled, level->width);
+    level->band_first_row += level->band_filled;
+    level->band_filled = 0;
+  }
+}
+
+/* Feeds a row of the level above @index into it. */
+static void push_row(struct o_mipmap *self, uint32_t index,
+                     const uint8_t *row) {
+  struct o_mipmap_level *level = &self->levels[index];
+  const struct o_mipmap_level *parent = &self->levels[index - 1];
+  size_t y = level->next_input_row++;
+
+  const uint8_t *row0;
+  if (parent->height == 1) {
+    row0 = row;
+  } else if (y % 2 == 0) {
+    /* The last row of an odd-height level has no pair and is dropped. */
+    if (y / 2 < level->height) memcpy(level->carry, row, parent->row_stride);
+    return;
+  } else {
+    row0 = level->carry;
+  }
+
+  uint8_t *dst = level->band + level->band_filled * level->row_stride;
+  if (self->channels == 4 && parent->width > 1)
+    self->downsample(dst, row0, row, level->width);
+  else
+    downsample_scalar(dst, row0, row, parent->width, level->width,
+                      self->channels);
+
+  finish_row(self, index);
+}
+
+void o_mipmap_write(struct o_mipmap *self, const void *pixels,
+                    size_t num_rows) {
+  assert(self != NULL);
+  assert(pixels != NULL);
+
+  if (self->num_levels < 2) return;
+
+  const uint8_t *rows = pixels;
+  for (size_t i = 0; i < num_rows; i++)
+    push_row(self, 1, rows + i * self->levels[0].row_stride);
+}
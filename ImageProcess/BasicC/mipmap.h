@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "convert.h"
+
+/* Receives @num_rows finished rows of mip @level, @width pixels each. */
+typedef void (*o_mipmap_emit_func)(void *user_data, uint32_t level,
+                                   const void *pixels, size_t first_row,
+                                   size_t num_rows, uint32_t width);
+
+/* Averages a pair of rows into a row of half the width, with a 2x2 box. Only
+ * used for RGBA8 levels at least two pixels wide.
+ */
+typedef void (*o_mipmap_downsample_func)(uint8_t *dst, const uint8_t *row0,
+                                         const uint8_t *row1,
+                                         size_t dst_width);
+
+/* One level below the image; level 0 is the image itself. */
+struct o_mipmap_level {
+  uint32_t width;
+  uint32_t height;
+  size_t row_stride;
+
+  /* Even source row, waiting for the odd row it is averaged with. */
+  uint8_t *carry;
+  size_t next_input_row;
+
+  /* Finished rows not emitted yet. */
+  uint8_t *band;
+  size_t band_rows;
+  size_t band_first_row;
+  size_t band_filled;
+};
+
+/* Builds the whole mip chain of an image while its rows are decoded, so that
+ * every level is complete as soon as level 0 is, without ever holding more
+ * than a band of rows per level.
+ */
+struct o_mipmap {
+  uint32_t width;
+  uint32_t height;
+  uint8_t channels;
+
+  uint32_t num_levels;
+  struct o_mipmap_level *levels;
+
+  o_mipmap_downsample_func downsample;
+  o_mipmap_emit_func emit;
+  void *user_data;
+};
+
+/* Number of levels of a full mip chain, level 0 included. */
+uint32_t o_mipmap_num_levels(uint32_t width, uint32_t height);
+
+/* Levels 1 and below are emitted in bands of at most @band_size bytes. */
+bool o_mipmap_init(struct o_mipmap *self, uint32_t width, uint32_t height,
+                   uint8_t channels, size_t band_size,
+                   enum o_convert_isa isa, o_mipmap_emit_func emit,
+                   void *user_data);
+
+void o_mipmap_clear(struct o_mipmap *self);
+
+/* Feeds consecutive rows of level 0, top to bottom. */
+void o_mipmap_write(struct o_mipmap *self, const void *pixels,
+                    size_t num_rows);
+
+/* Returns NULL if @isa isn't supported by the running CPU. */
+o_mipmap_downsample_func o_mipmap_get_downsample(enum o_convert_isa isa);
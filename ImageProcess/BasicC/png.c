@@ -1,34 +1,312 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "png.h"
 
 #include <assert.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <zlib.h>
+
+/* Size of the window prefetched ahead of the read cursor of mapped files. */
+#define PREFETCH_SIZE (4 << 20)
+
+/* Reads kept in flight ahead of the inflate cursor of unmapped files. */
+#define READAHEAD_BUFFERS 4
+#define READAHEAD_BUFFER_SIZE (1 << 20)
+
+/* Filtered bytes per encoder band. Every band boundary costs a few bytes
+ * and a restart of the match search, so bands are kept well above the
+ * deflate window.
+ */
+#define BAND_SIZE (256 << 10)
+#define WINDOW_SIZE (32 << 10)
+
+/* Bytes reserved around the deflated data of a band, for the zlib header
+ * (first band) and the Adler-32 trailer (last band).
+ */
+#define ZLIB_HEADER_SIZE 2
+#define ZLIB_TRAILER_SIZE 4
+
+/* Every arena block starts with a header, and is aligned like malloc(). */
+#define ARENA_ALIGNMENT 16
+
+struct png_arena_block {
+  /* Bytes after the header. */
+  size_t size;
+  struct png_arena_block *next;
+};
+
+#define ARENA_HEADER_SIZE 16
+_Static_assert(sizeof(struct png_arena_block) <= ARENA_HEADER_SIZE,
+               "arena block header too large");
+
+static const uint8_t PNG_SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a,
+                                         '\n'};
 
-bool png_decoder_init_from_filename(struct png_ctx *self,
-                                    const char *filename) {
+bool png_arena_init(struct png_arena *self, size_t size) {
   assert(self != NULL);
-  assert(filename != NULL);
 
-  memset(self, 0x00, sizeof(struct png_ctx));
+  memset(self, 0x00, sizeof(struct png_arena));
 
-  self->file_obj = fopen(filename, "rb");
-  if (self->file_obj == NULL) return false;
+  self->data = malloc(size);
+  if (self->data == NULL) {
+    errno = ENOMEM;
+    return false;
+  }
+  self->size = size;
 
-  /* Check PNG signature. */
-  uint8_t header[8];
-  ssize_t read_size = fread(header, 1, 8, self->file_obj);
-  assert(read_size > 0);
+  return true;
+}
+
+void png_arena_clear(struct png_arena *self) {
+  assert(self != NULL);
+
+  free(self->data);
+  memset(self, 0x00, sizeof(struct png_arena));
+}
+
+size_t png_arena_budget(uint32_t width) {
+  /* libpng keeps the current and previous rows, and the decoder one more,
+   * of up to 8 bytes per pixel. Add the inflate window and state, the
+   * structs and the chunk buffers.
+   */
+  return ((size_t)width * 8 + ARENA_HEADER_SIZE * 2) * 4 + (256 << 10);
+}
+
+static void png_arena_reset(struct png_arena *self) {
+  self->top = 0;
+  self->free_list = NULL;
+  self->peak = 0;
+  self->exhausted = false;
+}
+
+static void *png_arena_alloc(struct png_arena *self, size_t size) {
+  size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+  /* libpng frees little and reallocates the same sizes, so the first fit
+   * is good enough.
+   */
+  for (struct png_arena_block **link = &self->free_list; *link != NULL;
+       link = &(*link)->next) {
+    struct png_arena_block *block = *link;
+    if (block->size >= size) {
+      *link = block->next;
+      return (uint8_t *)block + ARENA_HEADER_SIZE;
+    }
+  }
+
+  if (size > self->size - self->top ||
+      ARENA_HEADER_SIZE > self->size - self->top - size) {
+    self->exhausted = true;
+    return NULL;
+  }
+
+  struct png_arena_block *block =
+      (struct png_arena_block *)(self->data + self->top);
+  block->size = size;
+  self->top += ARENA_HEADER_SIZE + size;
+  if (self->top > self->peak) self->peak = self->top;
+
+  return (uint8_t *)block + ARENA_HEADER_SIZE;
+}
+
+static void png_arena_free(struct png_arena *self, void *ptr) {
+  struct png_arena_block *block =
+      (struct png_arena_block *)((uint8_t *)ptr - ARENA_HEADER_SIZE);
+  block->next = self->free_list;
+  self->free_list = block;
+
+  /* Give the free blocks at the top back to the bump allocator. */
+  bool popped;
+  do {
+    popped = false;
+    for (struct png_arena_block **link = &self->free_list; *link != NULL;
+         link = &(*link)->next) {
+      struct png_arena_block *free_block = *link;
+      uint8_t *end = (uint8_t *)free_block + ARENA_HEADER_SIZE +
+                     free_block->size;
+      if (end == self->data + self->top) {
+        *link = free_block->next;
+        self->top -= ARENA_HEADER_SIZE + free_block->size;
+        popped = true;
+        break;
+      }
+    }
+  } while (popped);
+}
+
+static png_voidp arena_malloc_fn(png_structp png_ptr, png_alloc_size_t size) {
+  return png_arena_alloc(png_get_mem_ptr(png_ptr), size);
+}
+
+static void arena_free_fn(png_structp png_ptr, png_voidp ptr) {
+  if (ptr != NULL) png_arena_free(png_get_mem_ptr(png_ptr), ptr);
+}
+
+/* errno for a libpng error: running out of the arena, or a broken file. */
+static int32_t png_error_errno(const struct png_ctx *self) {
+  return self->arena != NULL && self->arena->exhausted ? ENOMEM : EINVAL;
+}
+
+/* Pulls the next @length bytes of the file, from the readahead ring or from
+ * the mapped or in-memory bytes.
+ */
+static bool png_pull(struct png_ctx *self, uint8_t *data, size_t length) {
+  if (file_readahead_is_open(&self->readahead))
+    return file_readahead_read(&self->readahead, data, length) ==
+           (ssize_t)length;
+
+  struct png_source *source = &self->source;
+  if (length > source->size - source->offset) return false;
+
+  /* Keep the kernel reading ahead of the inflate cursor. */
+  if (source->offset + length + PREFETCH_SIZE / 2 > source->prefetch_end &&
+      source->prefetch_end < source->size) {
+    file_map_prefetch(&self->file_map, source->prefetch_end, PREFETCH_SIZE);
+    source->prefetch_end += PREFETCH_SIZE;
+  }
+
+  memcpy(data, source->data + source->offset, length);
+  source->offset += length;
+
+  return true;
+}
+
+static void read_data_fn(png_structp png_ptr, png_bytep data, size_t length) {
+  struct png_ctx *self = png_get_io_ptr(png_ptr);
+
+  if (!png_pull(self, data, length))
+    png_error(png_ptr, "Read past the end of the PNG data");
+}
+
+/* Selects the kernels that expand the rows of the file to RGBA8. */
+static bool png_setup_conversion(struct png_ctx *self) {
+  enum o_convert_isa isa = o_convert_best_isa();
+
+  /* A tRNS chunk keys one gray or RGB color to transparent. libpng turns it
+   * into an alpha channel, matching the key before narrowing 16-bit samples,
+   * and the rows then expand like those of any gray-alpha or RGBA file.
+   */
+  if ((self->format == PNG_COLOR_TYPE_GRAY ||
+       self->format == PNG_COLOR_TYPE_RGB) &&
+      png_get_valid(self->png_ptr, self->info_ptr, PNG_INFO_tRNS)) {
+    png_set_tRNS_to_alpha(self->png_ptr);
+    png_set_strip_16(self->png_ptr);
+    png_read_update_info(self->png_ptr, self->info_ptr);
+
+    self->format = png_get_color_type(self->png_ptr, self->info_ptr);
+    self->bit_depth = png_get_bit_depth(self->png_ptr, self->info_ptr);
+  }
+
+  self->row_stride = (size_t)self->width * 4;
+  self->raw_row_stride = png_get_rowbytes(self->png_ptr, self->info_ptr);
+
+  switch (self->format) {
+    case PNG_COLOR_TYPE_RGB_ALPHA:
+      break;
+    case PNG_COLOR_TYPE_RGB:
+      self->convert = o_convert_get_kernel(O_CONVERT_RGB8_TO_RGBA8, isa);
+      break;
+    case PNG_COLOR_TYPE_GRAY:
+      self->convert = o_convert_get_kernel(O_CONVERT_GRAY8_TO_RGBA8, isa);
+      break;
+    case PNG_COLOR_TYPE_GRAY_ALPHA:
+      self->convert =
+          o_convert_get_kernel(O_CONVERT_GRAY_ALPHA8_TO_RGBA8, isa);
+      break;
+    case PNG_COLOR_TYPE_PALETTE: {
+      png_colorp colors = NULL;
+      int32_t num_colors = 0;
+      png_get_PLTE(self->png_ptr, self->info_ptr, &colors, &num_colors);
+
+      png_bytep alphas = NULL;
+      int32_t num_alphas = 0;
+      if (png_get_valid(self->png_ptr, self->info_ptr, PNG_INFO_tRNS))
+        png_get_tRNS(self->png_ptr, self->info_ptr, &alphas, &num_alphas, NULL);
+
+      /* Out-of-range indices map to opaque black. */
+      for (int32_t i = 0; i < 256; i++) {
+        uint8_t rgba[4] = {0, 0, 0, 0xff};
+        if (i < num_colors) {
+          rgba[0] = colors[i].red;
+          rgba[1] = colors[i].green;
+          rgba[2] = colors[i].blue;
+        }
+        if (i < num_alphas) rgba[3] = alphas[i];
+        memcpy(&self->palette[i], rgba, 4);
+      }
+
+      self->convert = o_convert_get_kernel(O_CONVERT_PALETTE8_TO_RGBA8, isa);
+      break;
+    }
+    default:
+      return false;
+  }
+
+  if (self->bit_depth == 16)
+    self->narrow = o_convert_get_kernel(O_CONVERT_NARROW16_TO_8, isa);
+
+  /* 8-bit RGBA rows are decoded straight into the caller buffer. */
+  if (self->convert == NULL && self->narrow == NULL) return true;
+
+  self->raw_row = png_malloc_warn(self->png_ptr, self->raw_row_stride);
+  if (self->raw_row == NULL) return false;
+
+  if (self->bit_depth < 8) {
+    self->unpacked_row = png_malloc_warn(self->png_ptr, self->width);
+    if (self->unpacked_row == NULL) return false;
+  }
+
+  return true;
+}
 
-  if (png_sig_cmp((png_const_bytep)header, 0, 8) != 0) {
+/* Expands @width pixels from column @x of the row decoded in raw_row to RGBA8
+ * into @row.
+ */
+static void png_convert_row(struct png_ctx *self, uint8_t *row, uint32_t x,
+                            uint32_t width) {
+  uint32_t channels = png_get_channels(self->png_ptr, self->info_ptr);
+  const uint8_t *src = self->raw_row + (size_t)x * channels;
+
+  if (self->bit_depth == 16) {
+    /* Narrowed in place, only over the columns kept. */
+    self->narrow(self->raw_row + (size_t)x * channels,
+                 self->raw_row + (size_t)x * channels * 2,
+                 (size_t)width * channels, NULL);
+  } else if (self->bit_depth < 8) {
+    /* Grayscale is scaled to the full range, palette indices are not. */
+    uint8_t scale = self->format == PNG_COLOR_TYPE_PALETTE
+                        ? 1
+                        : 0xff / ((1 << self->bit_depth) - 1);
+    o_convert_unpack_bits(self->unpacked_row, self->raw_row, self->width,
+                          self->bit_depth, scale);
+    src = self->unpacked_row + x;
+  }
+
+  if (self->convert != NULL)
+    self->convert(row, src, width, self->palette);
+  else
+    memcpy(row, src, (size_t)width * 4);
+}
+
+static bool png_decoder_init(struct png_ctx *self) {
+  /* Check PNG signature. */
+  uint8_t signature[8];
+  if (!png_pull(self, signature, sizeof(signature)) ||
+      png_sig_cmp(signature, 0, sizeof(signature)) != 0) {
     png_clear(self);
     errno = EINVAL;
     return false;
   }
 
-  /* Create the PNG decoder object. */
-  self->png_ptr =
-      png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  if (self->arena != NULL) png_arena_reset(self->arena);
+
+  /* Create the PNG decoder object, allocating from the arena if any. */
+  self->png_ptr = png_create_read_struct_2(
+      PNG_LIBPNG_VER_STRING, NULL, NULL, NULL, self->arena,
+      self->arena != NULL ? arena_malloc_fn : NULL,
+      self->arena != NULL ? arena_free_fn : NULL);
   if (self->png_ptr == NULL) {
     png_clear(self);
     errno = ENOMEM;
@@ -45,12 +323,13 @@ bool png_decoder_init_from_filename(struct png_ctx *self,
 
   /* Initialize error handling. */
   if (setjmp(png_jmpbuf(self->png_ptr)) != 0) {
+    int32_t error = png_error_errno(self);
     png_clear(self);
-    errno = ENOMEM;
+    errno = error;
     return false;
   }
 
-  png_init_io(self->png_ptr, self->file_obj);
+  png_set_read_fn(self->png_ptr, self, read_data_fn);
   png_set_sig_bytes(self->png_ptr, 8);
 
   /* @FIXME: does this generates errors? */
@@ -61,28 +340,517 @@ bool png_decoder_init_from_filename(struct png_ctx *self,
   assert(self->width > 0 && self->height > 0);
 
   self->format = png_get_color_type(self->png_ptr, self->info_ptr);
-  self->row_stride = png_get_rowbytes(self->png_ptr, self->info_ptr);
+  self->bit_depth = png_get_bit_depth(self->png_ptr, self->info_ptr);
+
+  if (!png_setup_conversion(self)) {
+    int32_t error = self->arena != NULL && self->arena->exhausted ? ENOMEM
+                                                                  : ENOTSUP;
+    png_clear(self);
+    errno = error;
+    return false;
+  }
 
   self->status = PNG_STATUS_DECODE_READY;
 
   return true;
 }
 
+bool png_decoder_init_from_filename(struct png_ctx *self, const char *filename,
+                                    struct png_arena *arena) {
+  assert(self != NULL);
+  assert(filename != NULL);
+
+  memset(self, 0x00, sizeof(struct png_ctx));
+  self->arena = arena;
+
+  if (!file_map_open(&self->file_map, filename)) return false;
+
+  self->source.data = self->file_map.data;
+  self->source.size = self->file_map.size;
+
+  return png_decoder_init(self);
+}
+
+bool png_decoder_init_from_filename_readahead(struct png_ctx *self,
+                                              const char *filename,
+                                              struct png_arena *arena) {
+  assert(self != NULL);
+  assert(filename != NULL);
+
+  memset(self, 0x00, sizeof(struct png_ctx));
+  self->file_map.fd = -1;
+  self->arena = arena;
+
+  if (!file_readahead_open(&self->readahead, filename, READAHEAD_BUFFERS,
+                           READAHEAD_BUFFER_SIZE))
+    return false;
+
+  return png_decoder_init(self);
+}
+
+bool png_decoder_init_from_memory(struct png_ctx *self, const void *data,
+                                  size_t size, struct png_arena *arena) {
+  assert(self != NULL);
+  assert(data != NULL);
+
+  memset(self, 0x00, sizeof(struct png_ctx));
+  self->arena = arena;
+  self->file_map.fd = -1;
+
+  self->source.data = data;
+  self->source.size = size;
+  self->source.prefetch_end = size;
+
+  return png_decoder_init(self);
+}
+
+static void write_u32_be(uint8_t *data, uint32_t value) {
+  data[0] = value >> 24;
+  data[1] = value >> 16;
+  data[2] = value >> 8;
+  data[3] = value;
+}
+
+static bool write_chunk(FILE *file_obj, const char *type, const void *data,
+                        uint32_t size) {
+  uint8_t header[8];
+  write_u32_be(header, size);
+  memcpy(header + 4, type, 4);
+
+  uint32_t crc = crc32(0, header + 4, 4);
+  if (size > 0) crc = crc32(crc, data, size);
+
+  uint8_t footer[4];
+  write_u32_be(footer, crc);
+
+  return fwrite(header, 1, sizeof(header), file_obj) == sizeof(header) &&
+         (size == 0 || fwrite(data, 1, size, file_obj) == size) &&
+         fwrite(footer, 1, sizeof(footer), file_obj) == sizeof(footer);
+}
+
+static inline uint8_t paeth_predictor(uint8_t a, uint8_t b, uint8_t c) {
+  int32_t p = a + b - c;
+  int32_t pa = abs(p - a);
+  int32_t pb = abs(p - b);
+  int32_t pc = abs(p - c);
+
+  if (pa <= pb && pa <= pc) return a;
+  if (pb <= pc) return b;
+  return c;
+}
+
+/* Writes the filter type byte of @filter, then @row filtered against the
+ * row above, @prev. The strategies match the PNG filter types, except the
+ * adaptive one.
+ */
+static void filter_row(uint8_t *dst, enum png_filter_strategy filter,
+                       const uint8_t *row, const uint8_t *prev, size_t size,
+                       uint8_t bpp) {
+  assert(filter < PNG_FILTER_STRATEGY_ADAPTIVE);
+
+  *dst++ = filter;
+
+  switch (filter) {
+    case PNG_FILTER_STRATEGY_NONE:
+      memcpy(dst, row, size);
+      break;
+    case PNG_FILTER_STRATEGY_SUB:
+      memcpy(dst, row, bpp);
+      for (size_t i = bpp; i < size; i++) dst[i] = row[i] - row[i - bpp];
+      break;
+    case PNG_FILTER_STRATEGY_UP:
+      for (size_t i = 0; i < size; i++) dst[i] = row[i] - prev[i];
+      break;
+    case PNG_FILTER_STRATEGY_AVERAGE:
+      for (size_t i = 0; i < bpp; i++) dst[i] = row[i] - (prev[i] >> 1);
+      for (size_t i = bpp; i < size; i++)
+        dst[i] = row[i] - ((row[i - bpp] + prev[i]) >> 1);
+      break;
+    case PNG_FILTER_STRATEGY_PAETH:
+      for (size_t i = 0; i < bpp; i++) dst[i] = row[i] - prev[i];
+      for (size_t i = bpp; i < size; i++)
+        dst[i] =
+            row[i] - paeth_predictor(row[i - bpp], prev[i], prev[i - bpp]);
+      break;
+    default:
+      break;
+  }
+}
+
+/* Sum of the filtered bytes taken as signed, the usual estimate of how well
+ * a filtered row compresses.
+ */
+static uint64_t filter_cost(const uint8_t *filtered, size_t size) {
+  uint64_t cost = 0;
+  for (size_t i = 0; i < size; i++)
+    cost += filtered[i] < 128 ? filtered[i] : 256 - filtered[i];
+
+  return cost;
+}
+
+/* Filters the next row into the band being filled. */
+static void png_filter_next_row(struct png_ctx *self, uint8_t *dst,
+                                const uint8_t *row) {
+  struct png_sink *sink = &self->sink;
+  size_t size = self->row_stride;
+
+  if (sink->filter != PNG_FILTER_STRATEGY_ADAPTIVE) {
+    filter_row(dst, sink->filter, row, sink->previous_row, size,
+               sink->channels);
+    return;
+  }
+
+  uint64_t best_cost = UINT64_MAX;
+  uint8_t *best = NULL;
+  for (uint32_t f = 0; f < PNG_FILTER_STRATEGY_ADAPTIVE; f++) {
+    uint8_t *candidate = sink->candidates + f * (size + 1);
+    filter_row(candidate, f, row, sink->previous_row, size, sink->channels);
+
+    uint64_t cost = filter_cost(candidate + 1, size);
+    if (cost < best_cost) {
+      best_cost = cost;
+      best = candidate;
+    }
+  }
+
+  memcpy(dst, best, size + 1);
+}
+
+/* Deflates the filtered rows of @band as a raw piece of the zlib stream that
+ * ends on a byte boundary, so that pieces can be concatenated.
+ */
+static void deflate_band(const struct png_sink *sink, struct png_band *band) {
+  band->deflated_ok = false;
+  band->deflated_size = 0;
+  band->adler = adler32(adler32(0, Z_NULL, 0), band->filtered,
+                        band->filtered_size);
+
+  z_stream stream;
+  memset(&stream, 0x00, sizeof(z_stream));
+  if (deflateInit2(&stream, sink->level, Z_DEFLATED, -15, 8,
+                   sink->filter == PNG_FILTER_STRATEGY_NONE
+                       ? Z_DEFAULT_STRATEGY
+                       : Z_FILTERED) != Z_OK)
+    return;
+
+  if (band->dictionary_size > 0)
+    deflateSetDictionary(&stream, band->dictionary, band->dictionary_size);
+
+  /* Room for the sync flush marker on top of the deflate bound. */
+  size_t capacity = deflateBound(&stream, band->filtered_size) + 16 +
+                    ZLIB_HEADER_SIZE + ZLIB_TRAILER_SIZE;
+  if (band->deflated_capacity < capacity) {
+    uint8_t *deflated = realloc(band->deflated, capacity);
+    if (deflated == NULL) {
+      deflateEnd(&stream);
+      return;
+    }
+    band->deflated = deflated;
+    band->deflated_capacity = capacity;
+  }
+
+  size_t avail_out =
+      band->deflated_capacity - ZLIB_HEADER_SIZE - ZLIB_TRAILER_SIZE;
+  stream.next_in = band->filtered;
+  stream.avail_in = band->filtered_size;
+  stream.next_out = band->deflated + ZLIB_HEADER_SIZE;
+  stream.avail_out = avail_out;
+
+  int32_t ret = deflate(&stream, band->last ? Z_FINISH : Z_SYNC_FLUSH);
+  band->deflated_ok = band->last ? ret == Z_STREAM_END
+                                 : ret == Z_OK && stream.avail_in == 0 &&
+                                       stream.avail_out > 0;
+  band->deflated_size = avail_out - stream.avail_out;
+
+  deflateEnd(&stream);
+}
+
+static void *deflate_thread(void *user_data) {
+  struct png_sink *sink = user_data;
+
+  pthread_mutex_lock(&sink->lock);
+  for (;;) {
+    while (sink->taken == sink->submitted && !sink->stopping)
+      pthread_cond_wait(&sink->band_submitted, &sink->lock);
+    if (sink->taken == sink->submitted) break;
+
+    struct png_band *band = &sink->bands[sink->taken++ % sink->num_bands];
+    pthread_mutex_unlock(&sink->lock);
+
+    deflate_band(sink, band);
+
+    pthread_mutex_lock(&sink->lock);
+    band->done = true;
+    pthread_cond_broadcast(&sink->band_deflated);
+  }
+  pthread_mutex_unlock(&sink->lock);
+
+  return NULL;
+}
+
+/* Writes the oldest band not written yet, waiting for it to be deflated. */
+static bool png_write_band(struct png_ctx *self) {
+  struct png_sink *sink = &self->sink;
+  struct png_band *band = &sink->bands[sink->written % sink->num_bands];
+
+  if (sink->threads != NULL) {
+    pthread_mutex_lock(&sink->lock);
+    while (!band->done) pthread_cond_wait(&sink->band_deflated, &sink->lock);
+    pthread_mutex_unlock(&sink->lock);
+  }
+  band->done = false;
+
+  if (!band->deflated_ok) return false;
+
+  uint8_t *data = band->deflated + ZLIB_HEADER_SIZE;
+  size_t size = band->deflated_size;
+
+  if (sink->written == 0) {
+    /* 32K window, and the level hint zlib itself would write. */
+    uint8_t flags = sink->level == Z_DEFAULT_COMPRESSION ? 0x9c
+                    : sink->level < 2                    ? 0x01
+                    : sink->level < 6                    ? 0x5e
+                    : sink->level == 6                   ? 0x9c
+                                                         : 0xda;
+    data -= ZLIB_HEADER_SIZE;
+    data[0] = 0x78;
+    data[1] = flags;
+    size += ZLIB_HEADER_SIZE;
+  }
+
+  sink->adler =
+      adler32_combine(sink->adler, band->adler, band->filtered_size);
+  if (band->last) {
+    write_u32_be(data + size, sink->adler);
+    size += ZLIB_TRAILER_SIZE;
+  }
+
+  band->filtered_size = 0;
+  sink->written++;
+
+  return write_chunk(sink->file_obj, "IDAT", data, size);
+}
+
+/* Hands the band just filled to the workers, then writes whatever bands are
+ * ready, waiting only if the ring is full or the image complete.
+ */
+static bool png_submit_band(struct png_ctx *self, bool last) {
+  struct png_sink *sink = &self->sink;
+  struct png_band *band = &sink->bands[sink->submitted % sink->num_bands];
+
+  band->last = last;
+  memcpy(band->dictionary, sink->window, sink->window_size);
+  band->dictionary_size = sink->window_size;
+
+  /* Slide the window over the new band. */
+  if (band->filtered_size >= WINDOW_SIZE) {
+    memcpy(sink->window, band->filtered + band->filtered_size - WINDOW_SIZE,
+           WINDOW_SIZE);
+    sink->window_size = WINDOW_SIZE;
+  } else {
+    size_t keep = WINDOW_SIZE - band->filtered_size;
+    if (keep > sink->window_size) keep = sink->window_size;
+    memmove(sink->window, sink->window + sink->window_size - keep, keep);
+    memcpy(sink->window + keep, band->filtered, band->filtered_size);
+    sink->window_size = keep + band->filtered_size;
+  }
+
+  if (sink->threads == NULL) {
+    deflate_band(sink, band);
+    sink->submitted++;
+  } else {
+    pthread_mutex_lock(&sink->lock);
+    sink->submitted++;
+    pthread_cond_signal(&sink->band_submitted);
+    pthread_mutex_unlock(&sink->lock);
+  }
+
+  while (sink->written < sink->submitted) {
+    if (!last && sink->submitted - sink->written < sink->num_bands) {
+      bool done = true;
+      if (sink->threads != NULL) {
+        pthread_mutex_lock(&sink->lock);
+        done = sink->bands[sink->written % sink->num_bands].done;
+        pthread_mutex_unlock(&sink->lock);
+      }
+      if (!done) break;
+    }
+
+    if (!png_write_band(self)) return false;
+  }
+
+  return true;
+}
+
+bool png_encoder_init_to_filename(struct png_ctx *self, const char *filename,
+                                  uint32_t width, uint32_t height,
+                                  uint8_t channels, int32_t level,
+                                  enum png_filter_strategy filter,
+                                  uint32_t num_threads) {
+  assert(self != NULL);
+  assert(filename != NULL);
+  assert(width > 0 && height > 0);
+  assert(channels == 3 || channels == 4);
+  assert(level >= Z_DEFAULT_COMPRESSION && level <= Z_BEST_COMPRESSION);
+  assert(filter < PNG_FILTER_STRATEGY_NUM);
+
+  memset(self, 0x00, sizeof(struct png_ctx));
+  self->file_map.fd = -1;
+
+  self->width = width;
+  self->height = height;
+  self->row_stride = (size_t)width * channels;
+  self->format =
+      channels == 4 ? PNG_COLOR_TYPE_RGB_ALPHA : PNG_COLOR_TYPE_RGB;
+  self->bit_depth = 8;
+
+  struct png_sink *sink = &self->sink;
+  sink->level = level;
+  sink->filter = filter;
+  sink->channels = channels;
+  sink->adler = adler32(0, Z_NULL, 0);
+
+  size_t filtered_stride = self->row_stride + 1;
+  sink->band_rows = BAND_SIZE / filtered_stride;
+  if (sink->band_rows < 1) sink->band_rows = 1;
+  if (sink->band_rows > height) sink->band_rows = height;
+
+  if (num_threads == 0) {
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    num_threads = num_cpus > 0 ? num_cpus : 1;
+  }
+
+  /* Enough bands to keep every worker busy while the caller fills more. */
+  sink->num_bands = num_threads > 1 ? num_threads * 2 : 1;
+
+  sink->previous_row = calloc(1, self->row_stride);
+  sink->window = malloc(WINDOW_SIZE);
+  sink->bands = calloc(sink->num_bands, sizeof(struct png_band));
+  if (filter == PNG_FILTER_STRATEGY_ADAPTIVE)
+    sink->candidates =
+        malloc(PNG_FILTER_STRATEGY_ADAPTIVE * filtered_stride);
+  if (sink->previous_row == NULL || sink->window == NULL ||
+      sink->bands == NULL ||
+      (filter == PNG_FILTER_STRATEGY_ADAPTIVE && sink->candidates == NULL)) {
+    png_clear(self);
+    errno = ENOMEM;
+    return false;
+  }
+
+  for (uint32_t i = 0; i < sink->num_bands; i++) {
+    struct png_band *band = &sink->bands[i];
+    band->filtered = malloc(sink->band_rows * filtered_stride);
+    band->dictionary = malloc(WINDOW_SIZE);
+    if (band->filtered == NULL || band->dictionary == NULL) {
+      png_clear(self);
+      errno = ENOMEM;
+      return false;
+    }
+  }
+
+  sink->file_obj = fopen(filename, "wb");
+  if (sink->file_obj == NULL) {
+    png_clear(self);
+    return false;
+  }
+
+  uint8_t header[13];
+  write_u32_be(header, width);
+  write_u32_be(header + 4, height);
+  header[8] = self->bit_depth;
+  header[9] = self->format;
+  header[10] = 0; /* deflate */
+  header[11] = 0; /* adaptive filtering */
+  header[12] = 0; /* no interlace */
+
+  if (fwrite(PNG_SIGNATURE, 1, sizeof(PNG_SIGNATURE), sink->file_obj) !=
+          sizeof(PNG_SIGNATURE) ||
+      !write_chunk(sink->file_obj, "IHDR", header, sizeof(header))) {
+    png_clear(self);
+    return false;
+  }
+
+  if (num_threads > 1) {
+    sink->threads = calloc(num_threads, sizeof(pthread_t));
+    if (sink->threads == NULL) {
+      png_clear(self);
+      errno = ENOMEM;
+      return false;
+    }
+
+    pthread_mutex_init(&sink->lock, NULL);
+    pthread_cond_init(&sink->band_submitted, NULL);
+    pthread_cond_init(&sink->band_deflated, NULL);
+
+    for (; sink->num_threads < num_threads; sink->num_threads++) {
+      if (pthread_create(&sink->threads[sink->num_threads], NULL,
+                         deflate_thread, sink) != 0) {
+        png_clear(self);
+        return false;
+      }
+    }
+  }
+
+  self->status = PNG_STATUS_ENCODE_READY;
+
+  return true;
+}
+
 void png_clear(struct png_ctx *self) {
   assert(self != NULL);
 
   if (self->png_ptr != NULL) {
+    /* The row buffers come from libpng's allocator. */
+    png_free(self->png_ptr, self->raw_row);
+    self->raw_row = NULL;
+    png_free(self->png_ptr, self->unpacked_row);
+    self->unpacked_row = NULL;
+
     if (self->info_ptr != NULL)
       png_destroy_info_struct(self->png_ptr, &self->info_ptr);
 
     png_destroy_read_struct(&self->png_ptr, &self->info_ptr, NULL);
   }
 
-  if (self->file_obj != NULL) {
-    fclose(self->file_obj);
-    self->file_obj = NULL;
+  file_map_close(&self->file_map);
+  memset(&self->source, 0x00, sizeof(struct png_source));
+  file_readahead_close(&self->readahead);
+
+
+  struct png_sink *sink = &self->sink;
+  if (sink->threads != NULL) {
+    pthread_mutex_lock(&sink->lock);
+    sink->stopping = true;
+    pthread_cond_broadcast(&sink->band_submitted);
+    pthread_mutex_unlock(&sink->lock);
+
+    for (uint32_t i = 0; i < sink->num_threads; i++)
+      pthread_join(sink->threads[i], NULL);
+
+    pthread_cond_destroy(&sink->band_deflated);
+    pthread_cond_destroy(&sink->band_submitted);
+    pthread_mutex_destroy(&sink->lock);
+    free(sink->threads);
+  }
+
+  if (sink->bands != NULL) {
+    for (uint32_t i = 0; i < sink->num_bands; i++) {
+      free(sink->bands[i].filtered);
+      free(sink->bands[i].dictionary);
+      free(sink->bands[i].deflated);
+    }
+    free(sink->bands);
   }
 
+  if (sink->file_obj != NULL) fclose(sink->file_obj);
+
+  free(sink->previous_row);
+  free(sink->candidates);
+  free(sink->window);
+  memset(sink, 0x00, sizeof(struct png_sink));
+
+  self->arena = NULL;
+
   self->status = PNG_STATUS_NONE;
 }
 
@@ -100,6 +868,15 @@ ssize_t png_read(struct png_ctx *self, void *buffer, size_t size,
 
   if (self->status == PNG_STATUS_DONE) goto out;
 
+  /* Errors while decoding the rows land here, not in the stale frame of
+   * png_decoder_init().
+   */
+  if (setjmp(png_jmpbuf(self->png_ptr)) != 0) {
+    self->status = PNG_STATUS_ERROR;
+    errno = png_error_errno(self);
+    return -1;
+  }
+
   _first_row = self->last_decoded_row;
   uint32_t max_read_rows = size / self->row_stride;
 
@@ -107,12 +884,18 @@ ssize_t png_read(struct png_ctx *self, void *buffer, size_t size,
   _num_rows = MIN(self->height - self->last_decoded_row, max_read_rows);
 #undef MIN
 
-  png_bytepp rows = calloc(_num_rows, sizeof(png_bytep));
-  for (int32_t i = 0; i < _num_rows; i++)
-    rows[i] = buffer + (i * self->row_stride);
-
-  png_read_rows(self->png_ptr, rows, NULL, _num_rows);
-  free(rows);
+  /* png_read_rows() is a loop over png_read_row() too, minus the table of
+   * row pointers it would need.
+   */
+  for (uint32_t i = 0; i < _num_rows; i++) {
+    uint8_t *row = (uint8_t *)buffer + i * self->row_stride;
+    if (self->raw_row != NULL) {
+      png_read_row(self->png_ptr, self->raw_row, NULL);
+      png_convert_row(self, row, 0, self->width);
+    } else {
+      png_read_row(self->png_ptr, row, NULL);
+    }
+  }
 
   self->last_decoded_row += _num_rows;
   result = _num_rows * self->row_stride;
@@ -130,3 +913,123 @@ out:
 
   return result;
 }
+
+ssize_t png_write(struct png_ctx *self, const void *buffer, size_t size) {
+  assert(self != NULL);
+  assert(self->status == PNG_STATUS_ENCODE_READY);
+  assert(size == 0 || buffer != NULL);
+  assert(size % self->row_stride == 0);
+
+  struct png_sink *sink = &self->sink;
+  size_t filtered_stride = self->row_stride + 1;
+
+  size_t num_rows = size / self->row_stride;
+  if (num_rows > self->height - self->last_decoded_row)
+    num_rows = self->height - self->last_decoded_row;
+
+  const uint8_t *rows = buffer;
+  for (size_t i = 0; i < num_rows; i++) {
+    const uint8_t *row = rows + i * self->row_stride;
+    struct png_band *band = &sink->bands[sink->submitted % sink->num_bands];
+
+    png_filter_next_row(self, band->filtered + band->filtered_size, row);
+    band->filtered_size += filtered_stride;
+    memcpy(sink->previous_row, row, self->row_stride);
+    self->last_decoded_row++;
+
+    bool last = self->last_decoded_row == self->height;
+    if ((band->filtered_size == sink->band_rows * filtered_stride || last) &&
+        !png_submit_band(self, last)) {
+      self->status = PNG_STATUS_ERROR;
+      return -1;
+    }
+  }
+
+  if (self->last_decoded_row == self->height) {
+    if (!write_chunk(sink->file_obj, "IEND", NULL, 0) ||
+        fflush(sink->file_obj) != 0) {
+      self->status = PNG_STATUS_ERROR;
+      return -1;
+    }
+
+    self->status = PNG_STATUS_DONE;
+  }
+
+  return num_rows * self->row_stride;
+}
+
+/* Rows are inflated into raw_row even when they need no conversion. */
+static bool png_ensure_raw_row(struct png_ctx *self) {
+  if (self->raw_row != NULL) return true;
+
+  self->raw_row = png_malloc_warn(self->png_ptr, self->raw_row_stride);
+  if (self->raw_row == NULL) {
+    errno = ENOMEM;
+    return false;
+  }
+
+  return true;
+}
+
+bool png_skip_rows(struct png_ctx *self, size_t num_rows) {
+  assert(self != NULL);
+  assert(self->status == PNG_STATUS_DECODE_READY);
+  assert(num_rows <= self->height - self->last_decoded_row);
+
+  if (!png_ensure_raw_row(self)) return false;
+
+  if (setjmp(png_jmpbuf(self->png_ptr)) != 0) {
+    self->status = PNG_STATUS_ERROR;
+    errno = png_error_errno(self);
+    return false;
+  }
+
+  for (size_t i = 0; i < num_rows; i++)
+    png_read_row(self->png_ptr, self->raw_row, NULL);
+  self->last_decoded_row += num_rows;
+
+  return true;
+}
+
+ssize_t png_read_columns(struct png_ctx *self, uint32_t x, uint32_t width,
+                         void *buffer, size_t size, size_t *first_row,
+                         size_t *num_rows) {
+  assert(self != NULL);
+  assert(self->status == PNG_STATUS_DECODE_READY ||
+         self->status == PNG_STATUS_DONE);
+  assert(width > 0 && x + width <= self->width);
+  assert(size >= (size_t)width * 4 && buffer != NULL);
+
+  if (first_row != NULL) *first_row = self->last_decoded_row;
+  if (num_rows != NULL) *num_rows = 0;
+
+  if (self->status == PNG_STATUS_DONE) return 0;
+  if (!png_ensure_raw_row(self)) return -1;
+
+  if (setjmp(png_jmpbuf(self->png_ptr)) != 0) {
+    self->status = PNG_STATUS_ERROR;
+    errno = png_error_errno(self);
+    return -1;
+  }
+
+  size_t row_stride = (size_t)width * 4;
+  size_t _num_rows = size / row_stride;
+  if (_num_rows > self->height - self->last_decoded_row)
+    _num_rows = self->height - self->last_decoded_row;
+
+  for (size_t i = 0; i < _num_rows; i++) {
+    png_read_row(self->png_ptr, self->raw_row, NULL);
+    png_convert_row(self, (uint8_t *)buffer + i * row_stride, x, width);
+  }
+  self->last_decoded_row += _num_rows;
+
+  if (self->last_decoded_row == self->height) {
+    png_read_end(self->png_ptr, self->info_ptr);
+
+    self->status = PNG_STATUS_DONE;
+  }
+
+  if (num_rows != NULL) *num_rows = _num_rows;
+
+  return _num_rows * row_stride;
+}
@@ -1,10 +1,20 @@
 #pragma once
 
 #include <png.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <unistd.h>
 
+#include "convert.h"
+#include "file_map.h"
+#include "file_readahead.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 enum png_status {
   PNG_STATUS_NONE = 0,
   PNG_STATUS_DECODE_READY,
@@ -13,9 +23,113 @@ enum png_status {
   PNG_STATUS_DONE,
 };
 
-struct png_ctx {
+/* Per-row filter applied before deflate. */
+enum png_filter_strategy {
+  PNG_FILTER_STRATEGY_NONE,
+  PNG_FILTER_STRATEGY_SUB,
+  PNG_FILTER_STRATEGY_UP,
+  PNG_FILTER_STRATEGY_AVERAGE,
+  PNG_FILTER_STRATEGY_PAETH,
+  /* Picks, for every row, the filter with the smallest sum of absolute
+   * differences, like libpng does.
+   */
+  PNG_FILTER_STRATEGY_ADAPTIVE,
+  PNG_FILTER_STRATEGY_NUM,
+};
+
+struct png_arena_block;
+
+/* Fixed pool of memory for one decoder at a time. Every allocation of libpng
+ * and of the decoder row buffers is carved out of it, so a decode can never
+ * use more than the pool size, and fails cleanly with ENOMEM if it needs
+ * more. A pool reused across decodes makes them allocation-free.
+ */
+struct png_arena {
+  uint8_t *data;
+  size_t size;
+
+  /* Bump allocator, and the blocks freed below its top. */
+  size_t top;
+  struct png_arena_block *free_list;
+
+  /* High-water mark of the pool during the last decode. */
+  size_t peak;
+  bool exhausted;
+};
+
+/* In-memory bytes libpng pulls the encoded stream from. */
+struct png_source {
+  const uint8_t *data;
+  size_t size;
+  size_t offset;
+
+  /* End of the range already prefetched from the file map. */
+  size_t prefetch_end;
+};
+
+/* Filtered rows deflated as one piece of the IDAT stream. */
+struct png_band {
+  uint8_t *filtered;
+  size_t filtered_size;
+  /* Last filtered bytes of the previous band, so that the band compresses
+   * as well as if the stream wasn't split.
+   */
+  uint8_t *dictionary;
+  size_t dictionary_size;
+
+  uint8_t *deflated;
+  size_t deflated_capacity;
+  size_t deflated_size;
+  uint32_t adler;
+
+  bool last;
+  bool deflated_ok;
+  bool done;
+};
+
+/* Encoder output. Rows are filtered into bands as they are written, the
+ * bands are deflated in parallel by worker threads (like pigz does), and
+ * the results are written to the file in order as IDAT chunks.
+ */
+struct png_sink {
   FILE *file_obj;
+  int32_t level;
+  enum png_filter_strategy filter;
+  uint8_t channels;
 
+  /* Unfiltered row above the next one, zeros before the first. */
+  uint8_t *previous_row;
+  /* One candidate row per filter, for the adaptive strategy. */
+  uint8_t *candidates;
+  /* Last filtered bytes of the stream, the dictionary of the next band. */
+  uint8_t *window;
+  size_t window_size;
+
+  struct png_band *bands;
+  uint32_t num_bands;
+  size_t band_rows;
+  /* Bands handed to the workers, taken by them, and written to the file. */
+  uint64_t submitted;
+  uint64_t taken;
+  uint64_t written;
+  uint32_t adler;
+
+  pthread_t *threads;
+  uint32_t num_threads;
+  pthread_mutex_t lock;
+  pthread_cond_t band_submitted;
+  pthread_cond_t band_deflated;
+  bool stopping;
+};
+
+struct png_ctx {
+  struct file_map file_map;
+  struct png_source source;
+  /* Replaces the file map when reading ahead. */
+  struct file_readahead readahead;
+  struct png_sink sink;
+
+  struct png_arena *arena;
   png_structp png_ptr;
   png_infop info_ptr;
 
@@ -23,15 +137,78 @@ struct png_ctx {
 
   uint32_t width;
   uint32_t height;
+  /* Decoded rows are always RGBA8, whatever the color type of the file. */
   size_t row_stride;
   uint8_t format;
+  uint8_t bit_depth;
+
+  /* Rows not stored as RGBA8 are decoded into raw_row, then expanded. */
+  size_t raw_row_stride;
+  uint8_t *raw_row;
+  uint8_t *unpacked_row;
+  o_convert_func narrow;
+  o_convert_func convert;
+  uint32_t palette[256];
 
   uint32_t last_decoded_row;
 };
 
-bool png_decoder_init_from_filename(struct png_ctx *self, const char *filename);
+/* Reserves @size bytes, the memory budget of every decode using the arena. */
+bool png_arena_init(struct png_arena *self, size_t size);
+
+void png_arena_clear(struct png_arena *self);
+
+/* A budget that fits decoding any PNG up to @width pixels wide, unless it
+ * carries unusually large ancillary chunks.
+ */
+size_t png_arena_budget(uint32_t width);
+
+/* The decoder allocates from @arena, if not NULL, until png_clear(). */
+bool png_decoder_init_from_filename(struct png_ctx *self, const char *filename,
+                                    struct png_arena *arena);
+
+/* Reads the file with large reads kept in flight ahead of the decoder, instead
+ * of mapping it.
+ */
+bool png_decoder_init_from_filename_readahead(struct png_ctx *self,
+                                              const char *filename,
+                                              struct png_arena *arena);
+
+/* The @data buffer is not copied and must outlive the decoder. */
+bool png_decoder_init_from_memory(struct png_ctx *self, const void *data,
+                                  size_t size, struct png_arena *arena);
+
+/* Writes an 8-bit RGB or RGBA PNG. @level is a zlib level (0-9, or -1 for
+ * the default). Bands of rows are deflated on @num_threads threads (one per
+ * online CPU if 0), or on the calling thread if 1.
+ */
+bool png_encoder_init_to_filename(struct png_ctx *self, const char *filename,
+                                  uint32_t width, uint32_t height,
+                                  uint8_t channels, int32_t level,
+                                  enum png_filter_strategy filter,
+                                  uint32_t num_threads);
 
 void png_clear(struct png_ctx *self);
 
 ssize_t png_read(struct png_ctx *self, void *buffer, size_t size,
                  size_t *first_row, size_t *num_rows);
+
+/* Inflates the next @num_rows rows and drops them. */
+bool png_skip_rows(struct png_ctx *self, size_t num_rows);
+
+/* Like png_read(), but only expands the @width columns from @x, into rows of
+ * @width * 4 bytes. Whole rows are still inflated, since each row is filtered
+ * against the one above.
+ */
+ssize_t png_read_columns(struct png_ctx *self, uint32_t x, uint32_t width,
+                         void *buffer, size_t size, size_t *first_row,
+                         size_t *num_rows);
+
+/* Encodes the next rows, top to bottom, from @buffer. @size must be a multiple
+ * of the row stride. The file is complete once the last row is written.
+ */
+ssize_t png_write(struct png_ctx *self, const void *buffer, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,204 @@
+#include "pnm.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct header_parser {
+  const uint8_t *data;
+  size_t size;
+  size_t offset;
+};
+
+static void skip_space_and_comments(struct header_parser *parser) {
+  while (parser->offset < parser->size) {
+    uint8_t c = parser->data[parser->offset];
+    if (c == '#') {
+      while (parser->offset < parser->size &&
+             parser->data[parser->offset] != '\n')
+        parser->offset++;
+    } else if (isspace(c)) {
+      parser->offset++;
+    } else {
+      break;
+    }
+  }
+}
+
+static bool parse_uint(struct header_parser *parser, uint32_t *value) {
+  skip_space_and_comments(parser);
+
+  uint64_t result = 0;
+  size_t start = parser->offset;
+  while (parser->offset < parser->size &&
+         isdigit(parser->data[parser->offset])) {
+    result = result * 10 + (parser->data[parser->offset] - '0');
+    if (result > UINT32_MAX) return false;
+    parser->offset++;
+  }
+
+  *value = result;
+
+  return parser->offset > start;
+}
+
+static bool parse_token(struct header_parser *parser, char *token,
+                        size_t max_size) {
+  skip_space_and_comments(parser);
+
+  size_t length = 0;
+  while (parser->offset < parser->size &&
+         !isspace(parser->data[parser->offset])) {
+    if (length + 1 == max_size) return false;
+    token[length++] = parser->data[parser->offset++];
+  }
+  token[length] = '\0';
+
+  return length > 0;
+}
+
+static bool parse_ppm_header(struct pnm_ctx *self,
+                             struct header_parser *parser) {
+  uint32_t max_value;
+  if (!parse_uint(parser, &self->width) || !parse_uint(parser, &self->height) ||
+      !parse_uint(parser, &max_value))
+    return false;
+
+  /* A single whitespace character separates the header from the pixels. */
+  if (parser->offset >= parser->size ||
+      !isspace(parser->data[parser->offset]))
+    return false;
+  parser->offset++;
+
+  self->channels = 3;
+
+  return max_value == 255;
+}
+
+static bool parse_pam_header(struct pnm_ctx *self,
+                             struct header_parser *parser) {
+  uint32_t depth = 0;
+  uint32_t max_value = 0;
+  char token[32];
+
+  while (parse_token(parser, token, sizeof(token))) {
+    if (strcmp(token, "ENDHDR") == 0) {
+      if (parser->offset >= parser->size ||
+          parser->data[parser->offset] != '\n')
+        return false;
+      parser->offset++;
+
+      self->channels = depth;
+
+      return (depth == 3 || depth == 4) && max_value == 255;
+    } else if (strcmp(token, "WIDTH") == 0) {
+      if (!parse_uint(parser, &self->width)) return false;
+    } else if (strcmp(token, "HEIGHT") == 0) {
+      if (!parse_uint(parser, &self->height)) return false;
+    } else if (strcmp(token, "DEPTH") == 0) {
+      if (!parse_uint(parser, &depth)) return false;
+    } else if (strcmp(token, "MAXVAL") == 0) {
+      if (!parse_uint(parser, &max_value)) return false;
+    } else if (strcmp(token, "TUPLTYPE") == 0) {
+      /* DEPTH alone tells RGB from RGB_ALPHA. */
+      if (!parse_token(parser, token, sizeof(token))) return false;
+    } else {
+      return false;
+    }
+  }
+
+  return false;
+}
+
+static bool pnm_decoder_init(struct pnm_ctx *self, const uint8_t *data,
+                             size_t size) {
+  struct header_parser parser = {data, size, 2};
+
+  bool ok = false;
+  if (size >= 2 && data[0] == 'P' && data[1] == '6')
+    ok = parse_ppm_header(self, &parser);
+  else if (size >= 2 && data[0] == 'P' && data[1] == '7')
+    ok = parse_pam_header(self, &parser);
+
+  if (!ok || self->width == 0 || self->height == 0) {
+    pnm_clear(self);
+    errno = EINVAL;
+    return false;
+  }
+
+  self->row_stride = (size_t)self->width * self->channels;
+  if ((size - parser.offset) / self->row_stride < self->height) {
+    pnm_clear(self);
+    errno = EINVAL;
+    return false;
+  }
+
+  self->pixels = data + parser.offset;
+
+  return true;
+}
+
+bool pnm_decoder_init_from_filename(struct pnm_ctx *self,
+                                    const char *filename) {
+  assert(self != NULL);
+  assert(filename != NULL);
+
+  memset(self, 0x00, sizeof(struct pnm_ctx));
+
+  if (!file_map_open(&self->file_map, filename)) return false;
+
+  return pnm_decoder_init(self, self->file_map.data, self->file_map.size);
+}
+
+bool pnm_decoder_init_from_memory(struct pnm_ctx *self, const void *data,
+                                  size_t size) {
+  assert(self != NULL);
+  assert(data != NULL);
+
+  memset(self, 0x00, sizeof(struct pnm_ctx));
+  self->file_map.fd = -1;
+
+  return pnm_decoder_init(self, data, size);
+}
+
+void pnm_clear(struct pnm_ctx *self) {
+  assert(self != NULL);
+
+  file_map_close(&self->file_map);
+  self->pixels = NULL;
+}
+
+ssize_t pnm_read_direct(struct pnm_ctx *self, const void **data, size_t size,
+                        size_t *first_row, size_t *num_rows) {
+  assert(self != NULL);
+  assert(data != NULL);
+  assert(self->pixels != NULL);
+  assert(size >= self->row_stride);
+
+  size_t _first_row = self->last_decoded_row;
+  size_t _num_rows = size / self->row_stride;
+  if (_num_rows > self->height - _first_row)
+    _num_rows = self->height - _first_row;
+
+  *data = self->pixels + _first_row * self->row_stride;
+  self->last_decoded_row += _num_rows;
+
+  if (first_row != NULL) *first_row = _first_row;
+
+  if (num_rows != NULL) *num_rows = _num_rows;
+
+  return _num_rows * self->row_stride;
+}
+
+ssize_t pnm_read(struct pnm_ctx *self, void *buffer, size_t size,
+                 size_t *first_row, size_t *num_rows) {
+  assert(size == 0 || buffer != NULL);
+
+  const void *data;
+  ssize_t result = pnm_read_direct(self, &data, size, first_row, num_rows);
+  if (result > 0) memcpy(buffer, data, result);
+
+  return result;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "file_map.h"
+
+/* Binary PPM (P6) and PAM (P7) images with 8-bit samples. The pixels of these
+ * formats are stored raw, so rows are served straight from the mapped file.
+ */
+struct pnm_ctx {
+  struct file_map file_map;
+
+  const uint8_t *pixels;
+
+  uint32_t width;
+  uint32_t height;
+  size_t row_stride;
+  uint8_t channels;
+
+  uint32_t last_decoded_row;
+};
+
+bool pnm_decoder_init_from_filename(struct pnm_ctx *self, const char *filename);
+
+/* The @data buffer is not copied and must outlive the decoder. */
+bool pnm_decoder_init_from_memory(struct pnm_ctx *self, const void *data,
+                                  size_t size);
+
+void pnm_clear(struct pnm_ctx *self);
+
+/* Copies the next rows into @buffer, like png_read(). */
+ssize_t pnm_read(struct pnm_ctx *self, void *buffer, size_t size,
+                 size_t *first_row, size_t *num_rows);
+
+/* Returns in @data a pointer to the next rows (at most @size bytes) inside the
+ * mapped file, without copying them.
+ */
+ssize_t pnm_read_direct(struct pnm_ctx *self, const void **data, size_t size,
+                        size_t *first_row, size_t *num_rows);
@@ -0,0 +1,449 @@
+#include "qoi.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xc0
+#define QOI_OP_RGB 0xfe
+#define QOI_OP_RGBA 0xff
+#define QOI_MASK_2 0xc0
+
+#define QOI_HEADER_SIZE 14
+#define QOI_MAX_RUN 62
+
+static const uint8_t QOI_MAGIC[4] = {'q', 'o', 'i', 'f'};
+static const uint8_t QOI_END_MARKER[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+static inline uint32_t qoi_hash(struct qoi_rgba px) {
+  return (px.r * 3 + px.g * 5 + px.b * 7 + px.a * 11) % 64;
+}
+
+static inline bool qoi_equal(struct qoi_rgba a, struct qoi_rgba b) {
+  return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+static uint32_t read_u32_be(const uint8_t *data) {
+  return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 |
+         (uint32_t)data[2] << 8 | data[3];
+}
+
+static void write_u32_be(uint8_t *data, uint32_t value) {
+  data[0] = value >> 24;
+  data[1] = value >> 16;
+  data[2] = value >> 8;
+  data[3] = value;
+}
+
+static void qoi_reset_state(struct qoi_ctx *self) {
+  memset(self->index, 0x00, sizeof(self->index));
+  self->px = (struct qoi_rgba){0, 0, 0, 255};
+  self->run = 0;
+}
+
+static bool qoi_decoder_init(struct qoi_ctx *self) {
+  if (self->size < QOI_HEADER_SIZE + sizeof(QOI_END_MARKER) ||
+      memcmp(self->data, QOI_MAGIC, sizeof(QOI_MAGIC)) != 0) {
+    qoi_clear(self);
+    errno = EINVAL;
+    return false;
+  }
+
+  self->width = read_u32_be(self->data + 4);
+  self->height = read_u32_be(self->data + 8);
+  self->channels = self->data[12];
+  if (self->width == 0 || self->height == 0 ||
+      (self->channels != 3 && self->channels != 4)) {
+    qoi_clear(self);
+    errno = EINVAL;
+    return false;
+  }
+
+  self->row_stride = (size_t)self->width * self->channels;
+  self->offset = QOI_HEADER_SIZE;
+  qoi_reset_state(self);
+
+  self->status = QOI_STATUS_DECODE_READY;
+
+  return true;
+}
+
+bool qoi_decoder_init_from_filename(struct qoi_ctx *self,
+                                    const char *filename) {
+  assert(self != NULL);
+  assert(filename != NULL);
+
+  memset(self, 0x00, sizeof(struct qoi_ctx));
+
+  if (!file_map_open(&self->file_map, filename)) return false;
+
+  self->data = self->file_map.data;
+  self->size = self->file_map.size;
+
+  return qoi_decoder_init(self);
+}
+
+bool qoi_decoder_init_from_memory(struct qoi_ctx *self, const void *data,
+                                  size_t size) {
+  assert(self != NULL);
+  assert(data != NULL);
+
+  memset(self, 0x00, sizeof(struct qoi_ctx));
+  self->file_map.fd = -1;
+
+  self->data = data;
+  self->size = size;
+
+  return qoi_decoder_init(self);
+}
+
+bool qoi_encoder_init_to_filename(struct qoi_ctx *self, const char *filename,
+                                  uint32_t width, uint32_t height,
+                                  uint8_t channels) {
+  assert(self != NULL);
+  assert(filename != NULL);
+  assert(width > 0 && height > 0);
+  assert(channels == 3 || channels == 4);
+
+  memset(self, 0x00, sizeof(struct qoi_ctx));
+  self->file_map.fd = -1;
+
+  self->width = width;
+  self->height = height;
+  self->channels = channels;
+  self->row_stride = (size_t)width * channels;
+
+  /* Worst case is one QOI_OP_RGBA (5 bytes) per pixel. */
+  self->out_buffer = malloc((size_t)width * 5);
+  if (self->out_buffer == NULL) {
+    errno = ENOMEM;
+    return false;
+  }
+
+  self->file_obj = fopen(filename, "wb");
+  if (self->file_obj == NULL) {
+    qoi_clear(self);
+    return false;
+  }
+
+  uint8_t header[QOI_HEADER_SIZE];
+  memcpy(header, QOI_MAGIC, sizeof(QOI_MAGIC));
+  write_u32_be(header + 4, width);
+  write_u32_be(header + 8, height);
+  header[12] = channels;
+  header[13] = 0; /* sRGB with linear alpha */
+
+  if (fwrite(header, 1, sizeof(header), self->file_obj) != sizeof(header)) {
+    qoi_clear(self);
+    return false;
+  }
+
+  qoi_reset_state(self);
+
+  self->status = QOI_STATUS_ENCODE_READY;
+
+  return true;
+}
+
+void qoi_clear(struct qoi_ctx *self) {
+  assert(self != NULL);
+
+  file_map_close(&self->file_map);
+  self->data = NULL;
+  self->size = 0;
+
+  if (self->file_obj != NULL) {
+    fclose(self->file_obj);
+    self->file_obj = NULL;
+  }
+
+  free(self->out_buffer);
+  self->out_buffer = NULL;
+
+  free(self->row);
+  self->row = NULL;
+
+  self->status = QOI_STATUS_NONE;
+}
+
+/* Decodes one row of pixels, returning false on truncated input. */
+static bool qoi_decode_row(struct qoi_ctx *self, uint8_t *row) {
+  const uint8_t *data = self->data;
+  /* Every op is at most 5 bytes; never read into the end marker. */
+  size_t end = self->size - sizeof(QOI_END_MARKER);
+  struct qoi_rgba px = self->px;
+  uint32_t run = self->run;
+
+  for (uint32_t x = 0; x < self->width; x++) {
+    if (run > 0) {
+      run--;
+    } else {
+      if (self->offset >= end) return false;
+
+      uint8_t b1 = data[self->offset++];
+      if (b1 == QOI_OP_RGB) {
+        if (self->offset + 3 > end) return false;
+        px.r = data[self->offset++];
+        px.g = data[self->offset++];
+        px.b = data[self->offset++];
+      } else if (b1 == QOI_OP_RGBA) {
+        if (self->offset + 4 > end) return false;
+        px.r = data[self->offset++];
+        px.g = data[self->offset++];
+        px.b = data[self->offset++];
+        px.a = data[self->offset++];
+      } else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+        px = self->index[b1];
+      } else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+        px.r += ((b1 >> 4) & 0x03) - 2;
+        px.g += ((b1 >> 2) & 0x03) - 2;
+        px.b += (b1 & 0x03) - 2;
+      } else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+        if (self->offset >= end) return false;
+        uint8_t b2 = data[self->offset++];
+        int32_t vg = (b1 & 0x3f) - 32;
+        px.r += vg - 8 + ((b2 >> 4) & 0x0f);
+        px.g += vg;
+        px.b += vg - 8 + (b2 & 0x0f);
+      } else {
+        run = b1 & 0x3f;
+      }
+
+      self->index[qoi_hash(px)] = px;
+    }
+
+    uint8_t *out = row + x * self->channels;
+    out[0] = px.r;
+    out[1] = px.g;
+    out[2] = px.b;
+    if (self->channels == 4) out[3] = px.a;
+  }
+
+  self->px = px;
+  self->run = run;
+
+  return true;
+}
+
+ssize_t qoi_read(struct qoi_ctx *self, void *buffer, size_t size,
+                 size_t *first_row, size_t *num_rows) {
+  assert(self != NULL);
+  assert(self->status == QOI_STATUS_DECODE_READY ||
+         self->status == QOI_STATUS_DONE);
+  assert(size == 0 || buffer != NULL);
+  assert(self->row_stride > 0 && size >= self->row_stride);
+
+  size_t _num_rows = 0;
+  size_t _first_row = self->last_decoded_row;
+  ssize_t result = 0;
+
+  if (self->status == QOI_STATUS_DONE) goto out;
+
+  size_t max_read_rows = size / self->row_stride;
+  if (max_read_rows > self->height - self->last_decoded_row)
+    max_read_rows = self->height - self->last_decoded_row;
+
+  uint8_t *rows = buffer;
+  for (; _num_rows < max_read_rows; _num_rows++) {
+    if (!qoi_decode_row(self, rows + _num_rows * self->row_stride)) {
+      self->status = QOI_STATUS_ERROR;
+      errno = EINVAL;
+      return -1;
+    }
+  }
+
+  self->last_decoded_row += _num_rows;
+  result = _num_rows * self->row_stride;
+
+  if (self->last_decoded_row == self->height) self->status = QOI_STATUS_DONE;
+
+out:
+  if (first_row != NULL) *first_row = _first_row;
+
+  if (num_rows != NULL) *num_rows = _num_rows;
+
+  return result;
+}
+
+/* Encodes one row of pixels into out_buffer, returning the encoded size. */
+static bool qoi_ensure_row(struct qoi_ctx *self) {
+  if (self->row != NULL) return true;
+
+  self->row = malloc(self->row_stride);
+  if (self->row == NULL) {
+    errno = ENOMEM;
+    return false;
+  }
+
+  return true;
+}
+
+bool qoi_skip_rows(struct qoi_ctx *self, size_t num_rows) {
+  assert(self != NULL);
+  assert(self->status == QOI_STATUS_DECODE_READY);
+  assert(num_rows <= self->height - self->last_decoded_row);
+
+  if (!qoi_ensure_row(self)) return false;
+
+  for (size_t i = 0; i < num_rows; i++) {
+    if (!qoi_decode_row(self, self->row)) {
+      self->status = QOI_STATUS_ERROR;
+      errno = EINVAL;
+      return false;
+    }
+    self->last_decoded_row++;
+  }
+
+  return true;
+}
+
+ssize_t qoi_read_columns(struct qoi_ctx *self, uint32_t x, uint32_t width,
+                         void *buffer, size_t size, size_t *first_row,
+                         size_t *num_rows) {
+  assert(self != NULL);
+  assert(self->status == QOI_STATUS_DECODE_READY ||
+         self->status == QOI_STATUS_DONE);
+  assert(width > 0 && x + width <= self->width);
+  assert(size >= (size_t)width * self->channels && buffer != NULL);
+
+  if (first_row != NULL) *first_row = self->last_decoded_row;
+  if (num_rows != NULL) *num_rows = 0;
+
+  if (self->status == QOI_STATUS_DONE) return 0;
+  if (!qoi_ensure_row(self)) return -1;
+
+  size_t row_stride = (size_t)width * self->channels;
+  size_t max_read_rows = size / row_stride;
+  if (max_read_rows > self->height - self->last_decoded_row)
+    max_read_rows = self->height - self->last_decoded_row;
+
+  uint8_t *rows = buffer;
+  size_t _num_rows = 0;
+  for (; _num_rows < max_read_rows; _num_rows++) {
+    if (!qoi_decode_row(self, self->row)) {
+      self->status = QOI_STATUS_ERROR;
+      errno = EINVAL;
+      return -1;
+    }
+    memcpy(rows + _num_rows * row_stride,
+           self->row + (size_t)x * self->channels, row_stride);
+  }
+
+  self->last_decoded_row += _num_rows;
+  if (self->last_decoded_row == self->height) self->status = QOI_STATUS_DONE;
+
+  if (num_rows != NULL) *num_rows = _num_rows;
+
+  return _num_rows * row_stride;
+}
+
+static size_t qoi_encode_row(struct qoi_ctx *self, const uint8_t *row,
+                             bool last_row) {
+  uint8_t *out = self->out_buffer;
+  size_t p = 0;
+  struct qoi_rgba px_prev = self->px;
+  uint32_t run = self->run;
+
+  for (uint32_t x = 0; x < self->width; x++) {
+    const uint8_t *in = row + x * self->channels;
+    struct qoi_rgba px = {in[0], in[1], in[2],
+                          self->channels == 4 ? in[3] : px_prev.a};
+
+    if (qoi_equal(px, px_prev)) {
+      run++;
+      if (run == QOI_MAX_RUN || (last_row && x == self->width - 1)) {
+        out[p++] = QOI_OP_RUN | (run - 1);
+        run = 0;
+      }
+      continue;
+    }
+
+    if (run > 0) {
+      out[p++] = QOI_OP_RUN | (run - 1);
+      run = 0;
+    }
+
+    uint32_t index_pos = qoi_hash(px);
+    if (qoi_equal(self->index[index_pos], px)) {
+      out[p++] = QOI_OP_INDEX | index_pos;
+    } else {
+      self->index[index_pos] = px;
+
+      if (px.a == px_prev.a) {
+        int8_t vr = px.r - px_prev.r;
+        int8_t vg = px.g - px_prev.g;
+        int8_t vb = px.b - px_prev.b;
+        int8_t vg_r = vr - vg;
+        int8_t vg_b = vb - vg;
+
+        if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+          out[p++] = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+        } else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 &&
+                   vg_b > -9 && vg_b < 8) {
+          out[p++] = QOI_OP_LUMA | (vg + 32);
+          out[p++] = (vg_r + 8) << 4 | (vg_b + 8);
+        } else {
+          out[p++] = QOI_OP_RGB;
+          out[p++] = px.r;
+          out[p++] = px.g;
+          out[p++] = px.b;
+        }
+      } else {
+        out[p++] = QOI_OP_RGBA;
+        out[p++] = px.r;
+        out[p++] = px.g;
+        out[p++] = px.b;
+        out[p++] = px.a;
+      }
+    }
+
+    px_prev = px;
+  }
+
+  self->px = px_prev;
+  self->run = run;
+
+  return p;
+}
+
+ssize_t qoi_write(struct qoi_ctx *self, const void *buffer, size_t size) {
+  assert(self != NULL);
+  assert(self->status == QOI_STATUS_ENCODE_READY);
+  assert(size == 0 || buffer != NULL);
+  assert(size % self->row_stride == 0);
+
+  size_t num_rows = size / self->row_stride;
+  if (num_rows > self->height - self->last_decoded_row)
+    num_rows = self->height - self->last_decoded_row;
+
+  const uint8_t *rows = buffer;
+  for (size_t i = 0; i < num_rows; i++) {
+    self->last_decoded_row++;
+    size_t encoded_size =
+        qoi_encode_row(self, rows + i * self->row_stride,
+                       self->last_decoded_row == self->height);
+
+    if (fwrite(self->out_buffer, 1, encoded_size, self->file_obj) !=
+        encoded_size) {
+      self->status = QOI_STATUS_ERROR;
+      return -1;
+    }
+  }
+
+  if (self->last_decoded_row == self->height) {
+    if (fwrite(QOI_END_MARKER, 1, sizeof(QOI_END_MARKER), self->file_obj) !=
+            sizeof(QOI_END_MARKER) ||
+        fflush(self->file_obj) != 0) {
+      self->status = QOI_STATUS_ERROR;
+      return -1;
+    }
+
+    self->status = QOI_STATUS_DONE;
+  }
+
+  return num_rows * self->row_stride;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "file_map.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* "Quite OK Image" format, see <https://qoiformat.org/qoi-specification.pdf>.
+ * A lossless format that encodes and decodes much faster than PNG, meant for
+ * intermediate images written once and read many times.
+ */
+
+enum qoi_status {
+  QOI_STATUS_NONE = 0,
+  QOI_STATUS_DECODE_READY,
+  QOI_STATUS_ENCODE_READY,
+  QOI_STATUS_ERROR,
+  QOI_STATUS_DONE,
+};
+
+struct qoi_rgba {
+  uint8_t r;
+  uint8_t g;
+  uint8_t b;
+  uint8_t a;
+};
+
+struct qoi_ctx {
+  /* Decoder input. */
+  struct file_map file_map;
+  const uint8_t *data;
+  size_t size;
+  size_t offset;
+
+  /* Encoder output. */
+  FILE *file_obj;
+  uint8_t *out_buffer;
+
+  /* Whole row, decoded before the columns of a region are copied out. */
+  uint8_t *row;
+
+  enum qoi_status status;
+
+  uint32_t width;
+  uint32_t height;
+  size_t row_stride;
+  uint8_t channels;
+
+  /* Codec state, carried across rows. */
+  struct qoi_rgba index[64];
+  struct qoi_rgba px;
+  uint32_t run;
+
+  uint32_t last_decoded_row;
+};
+
+bool qoi_decoder_init_from_filename(struct qoi_ctx *self, const char *filename);
+
+/* The @data buffer is not copied and must outlive the decoder. */
+bool qoi_decoder_init_from_memory(struct qoi_ctx *self, const void *data,
+                                  size_t size);
+
+bool qoi_encoder_init_to_filename(struct qoi_ctx *self, const char *filename,
+                                  uint32_t width, uint32_t height,
+                                  uint8_t channels);
+
+void qoi_clear(struct qoi_ctx *self);
+
+ssize_t qoi_read(struct qoi_ctx *self, void *buffer, size_t size,
+                 size_t *first_row, size_t *num_rows);
+
+/* Decodes the next @num_rows rows and drops them. */
+bool qoi_skip_rows(struct qoi_ctx *self, size_t num_rows);
+
+/* Like qoi_read(), but only keeps the @width columns from @x, in rows of
+ * @width pixels.
+ */
+ssize_t qoi_read_columns(struct qoi_ctx *self, uint32_t x, uint32_t width,
+                         void *buffer, size_t size, size_t *first_row,
+                         size_t *num_rows);
+
+/* Encodes the next rows, top to bottom, from @buffer. @size must be a multiple
+ * of the row stride. The file is complete once the last row is written.
+ */
+ssize_t qoi_write(struct qoi_ctx *self, const void *buffer, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,158 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "stream.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+uint64_t o_image_stream_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void *decoder_thread_func(void *data) {
+  struct o_image_stream *self = data;
+
+  for (;;) {
+    /* Wait for a free band. */
+    pthread_mutex_lock(&self->lock);
+    uint64_t start = o_image_stream_now_ns();
+    while (self->filled == self->num_bands && !self->cancelled)
+      pthread_cond_wait(&self->band_released, &self->lock);
+    self->stats.decode_stall_ns += o_image_stream_now_ns() - start;
+
+    bool cancelled = self->cancelled;
+    struct o_image_band *band = &self->bands[self->head];
+    pthread_mutex_unlock(&self->lock);
+
+    if (cancelled) break;
+
+    /* Decode the next rows outside the lock. */
+    start = o_image_stream_now_ns();
+    ssize_t size_read = o_image_read(self->image, band->data, band->size,
+                                     &band->first_row, &band->num_rows);
+    band->size_read = size_read;
+    uint64_t elapsed = o_image_stream_now_ns() - start;
+
+    pthread_mutex_lock(&self->lock);
+    self->stats.decode_ns += elapsed;
+    self->head = (self->head + 1) % self->num_bands;
+    self->filled++;
+    pthread_cond_signal(&self->band_filled);
+    pthread_mutex_unlock(&self->lock);
+
+    /* An empty (or failed) band marks the end of the image. */
+    if (size_read <= 0) break;
+  }
+
+  return NULL;
+}
+
+bool o_image_stream_init(struct o_image_stream *self, struct o_image *image,
+                         size_t band_size, uint32_t num_bands,
+                         void *const *buffers) {
+  assert(self != NULL);
+  assert(image != NULL);
+  assert(num_bands > 0);
+  assert(band_size >= image->row_stride);
+
+  memset(self, 0x00, sizeof(struct o_image_stream));
+
+  self->image = image;
+  self->num_bands = num_bands;
+  self->owns_buffers = buffers == NULL;
+
+  pthread_mutex_init(&self->lock, NULL);
+  pthread_cond_init(&self->band_filled, NULL);
+  pthread_cond_init(&self->band_released, NULL);
+
+  self->bands = calloc(num_bands, sizeof(struct o_image_band));
+  if (self->bands == NULL) {
+    o_image_stream_clear(self);
+    errno = ENOMEM;
+    return false;
+  }
+
+  for (uint32_t i = 0; i < num_bands; i++) {
+    self->bands[i].size = band_size;
+    self->bands[i].data = buffers != NULL ? buffers[i] : malloc(band_size);
+    if (self->bands[i].data == NULL) {
+      o_image_stream_clear(self);
+      errno = ENOMEM;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool o_image_stream_start(struct o_image_stream *self) {
+  assert(self != NULL);
+  assert(!self->started);
+
+  if (pthread_create(&self->thread, NULL, decoder_thread_func, self) != 0)
+    return false;
+
+  self->started = true;
+
+  return true;
+}
+
+struct o_image_band *o_image_stream_acquire(struct o_image_stream *self) {
+  assert(self != NULL);
+  assert(self->started);
+
+  pthread_mutex_lock(&self->lock);
+  uint64_t start = o_image_stream_now_ns();
+  while (self->filled == 0)
+    pthread_cond_wait(&self->band_filled, &self->lock);
+  self->stats.consume_stall_ns += o_image_stream_now_ns() - start;
+
+  struct o_image_band *band = &self->bands[self->tail];
+  pthread_mutex_unlock(&self->lock);
+
+  return band;
+}
+
+void o_image_stream_release(struct o_image_stream *self) {
+  assert(self != NULL);
+
+  pthread_mutex_lock(&self->lock);
+  assert(self->filled > 0);
+  self->tail = (self->tail + 1) % self->num_bands;
+  self->filled--;
+  pthread_cond_signal(&self->band_released);
+  pthread_mutex_unlock(&self->lock);
+}
+
+void o_image_stream_clear(struct o_image_stream *self) {
+  assert(self != NULL);
+
+  if (self->started) {
+    pthread_mutex_lock(&self->lock);
+    self->cancelled = true;
+    pthread_cond_signal(&self->band_released);
+    pthread_mutex_unlock(&self->lock);
+
+    pthread_join(self->thread, NULL);
+    self->started = false;
+  }
+
+  if (self->bands != NULL) {
+    if (self->owns_buffers) {
+      for (uint32_t i = 0; i < self->num_bands; i++) free(self->bands[i].data);
+    }
+
+    free(self->bands);
+    self->bands = NULL;
+  }
+
+  pthread_mutex_destroy(&self->lock);
+  pthread_cond_destroy(&self->band_filled);
+  pthread_cond_destroy(&self->band_released);
+}
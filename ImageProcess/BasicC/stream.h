@@ -0,0 +1,74 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "image.h"
+
+/* A band of consecutive image rows, as produced by one o_image_read() call. */
+struct o_image_band {
+  void *data;
+  size_t size;
+
+  size_t first_row;
+  size_t num_rows;
+  ssize_t size_read;
+};
+
+struct o_image_stream_stats {
+  /* Time the decoder thread spent inside o_image_read(). */
+  uint64_t decode_ns;
+  /* Time the decoder thread waited for the consumer to release a band. */
+  uint64_t decode_stall_ns;
+  /* Time the consumer waited for the decoder to fill a band. */
+  uint64_t consume_stall_ns;
+};
+
+/* Decodes an image on a separate thread into a bounded ring of row bands,
+ * so that decoding and consuming (e.g., uploading to a texture) overlap.
+ */
+struct o_image_stream {
+  struct o_image *image;
+
+  struct o_image_band *bands;
+  uint32_t num_bands;
+  bool owns_buffers;
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t band_filled;
+  pthread_cond_t band_released;
+
+  uint32_t head;
+  uint32_t tail;
+  uint32_t filled;
+  bool started;
+  bool cancelled;
+
+  struct o_image_stream_stats stats;
+};
+
+/* Prepares a ring of @num_bands bands of @band_size bytes each. If @buffers is
+ * NULL the band storage is allocated (and later freed) by the stream,
+ * otherwise @buffers must hold @num_bands pointers owned by the caller.
+ */
+bool o_image_stream_init(struct o_image_stream *self, struct o_image *image,
+                         size_t band_size, uint32_t num_bands,
+                         void *const *buffers);
+
+bool o_image_stream_start(struct o_image_stream *self);
+
+/* Blocks until the next band is decoded. The last band of the image has
+ * size_read == 0 (or -1 on error), like o_image_read().
+ */
+struct o_image_band *o_image_stream_acquire(struct o_image_stream *self);
+
+/* Hands the band last returned by o_image_stream_acquire() back to the
+ * decoder. The consumer may point band->data at new storage before releasing.
+ */
+void o_image_stream_release(struct o_image_stream *self);
+
+void o_image_stream_clear(struct o_image_stream *self);
+
+uint64_t o_image_stream_now_ns(void);
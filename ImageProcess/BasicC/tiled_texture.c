@@ -0,0 +1,184 @@
+#include "tiled_texture.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t tile_extent(uint32_t size, uint32_t tile_size,
+                            uint32_t index) {
+  uint32_t start = index * tile_size;
+  return size - start < tile_size ? size - start : tile_size;
+}
+
+bool o_tiled_texture_init(struct o_tiled_texture *self, uint32_t width,
+                          uint32_t height, GLenum format, uint32_t tile_size) {
+  assert(self != NULL);
+  assert(width > 0 && height > 0);
+  assert(format == GL_RGB || format == GL_RGBA);
+  assert(tile_size > 0);
+
+  memset(self, 0x00, sizeof(struct o_tiled_texture));
+
+  self->width = width;
+  self->height = height;
+  self->format = format;
+  self->bytes_per_pixel = format == GL_RGB ? 3 : 4;
+  self->tile_size = tile_size;
+  self->columns = (width + tile_size - 1) / tile_size;
+  self->rows = (height + tile_size - 1) / tile_size;
+
+  self->textures = calloc((size_t)self->columns * self->rows, sizeof(GLuint));
+  self->staging =
+      malloc((size_t)tile_size * width * self->bytes_per_pixel);
+  self->tile =
+      malloc((size_t)tile_size * tile_size * self->bytes_per_pixel);
+  if (self->textures == NULL || self->staging == NULL || self->tile == NULL) {
+    o_tiled_texture_clear(self);
+    errno = ENOMEM;
+    return false;
+  }
+
+  glGenTextures(self->columns * self->rows, self->textures);
+  assert(glGetError() == GL_NO_ERROR);
+
+  for (uint32_t row = 0; row < self->rows; row++) {
+    for (uint32_t column = 0; column < self->columns; column++) {
+      glBindTexture(GL_TEXTURE_2D,
+                    self->textures[row * self->columns + column]);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexImage2D(GL_TEXTURE_2D, 0, format,
+                   tile_extent(width, tile_size, column),
+                   tile_extent(height, tile_size, row), 0, format,
+                   GL_UNSIGNED_BYTE, NULL);
+      assert(glGetError() == GL_NO_ERROR);
+    }
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  return true;
+}
+
+void o_tiled_texture_clear(struct o_tiled_texture *self) {
+  assert(self != NULL);
+
+  if (self->textures != NULL) {
+    glDeleteTextures(self->columns * self->rows, self->textures);
+    free(self->textures);
+    self->textures = NULL;
+  }
+
+  free(self->staging);
+  self->staging = NULL;
+  free(self->tile);
+  self->tile = NULL;
+}
+
+/* Uploads the staged tile row to its textures. ES 2.0 has no
+ * GL_UNPACK_ROW_LENGTH, so each tile is repacked before the upload.
+ */
+static void flush_tile_row(struct o_tiled_texture *self) {
+  uint32_t row = self->staged_tile_row;
+  uint32_t tile_height = tile_extent(self->height, self->tile_size, row);
+  size_t row_stride = (size_t)self->width * self->bytes_per_pixel;
+
+  assert(self->staged_rows == tile_height);
+
+  for (uint32_t column = 0; column < self->columns; column++) {
+    uint32_t tile_width = tile_extent(self->width, self->tile_size, column);
+    size_t tile_stride = (size_t)tile_width * self->bytes_per_pixel;
+    const uint8_t *src = self->staging + (size_t)column * self->tile_size *
+                                             self->bytes_per_pixel;
+
+    for (uint32_t y = 0; y < tile_height; y++)
+      memcpy(self->tile + y * tile_stride, src + y * row_stride, tile_stride);
+
+    glBindTexture(GL_TEXTURE_2D, self->textures[row * self->columns + column]);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, tile_width, tile_height,
+                    self->format, GL_UNSIGNED_BYTE, self->tile);
+    assert(glGetError() == GL_NO_ERROR);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  /* Let the driver start on this tile row while the next one decodes. */
+  glFlush();
+
+  self->staged_tile_row++;
+  self->staged_rows = 0;
+}
+
+void o_tiled_texture_write(struct o_tiled_texture *self, const void *pixels,
+                           size_t first_row, size_t num_rows) {
+  assert(self != NULL);
+  assert(pixels != NULL);
+  assert(first_row == (size_t)self->staged_tile_row * self->tile_size +
+                          self->staged_rows);
+  assert(first_row + num_rows <= self->height);
+
+  size_t row_stride = (size_t)self->width * self->bytes_per_pixel;
+  const uint8_t *src = pixels;
+
+  while (num_rows > 0) {
+    uint32_t tile_height =
+        tile_extent(self->height, self->tile_size, self->staged_tile_row);
+    size_t count = tile_height - self->staged_rows;
+    if (count > num_rows) count = num_rows;
+
+    memcpy(self->staging + self->staged_rows * row_stride, src,
+           count * row_stride);
+    self->staged_rows += count;
+    src += count * row_stride;
+    num_rows -= count;
+
+    if (self->staged_rows == tile_height) flush_tile_row(self);
+  }
+}
+
+void o_tiled_texture_draw(const struct o_tiled_texture *self) {
+  assert(self != NULL);
+
+  static const GLfloat s_texturePos[4][2] = {
+      {0, 0},
+      {1, 0},
+      {0, 1},
+      {1, 1},
+  };
+
+  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, s_texturePos);
+  glEnableVertexAttribArray(0);
+  glEnableVertexAttribArray(1);
+
+  for (uint32_t row = 0; row < self->rows; row++) {
+    uint32_t top = row * self->tile_size;
+    uint32_t bottom = top + tile_extent(self->height, self->tile_size, row);
+
+    for (uint32_t column = 0; column < self->columns; column++) {
+      uint32_t left = column * self->tile_size;
+      uint32_t right =
+          left + tile_extent(self->width, self->tile_size, column);
+
+      GLfloat x0 = -1.0f + 2.0f * left / self->width;
+      GLfloat x1 = -1.0f + 2.0f * right / self->width;
+      GLfloat y0 = 1.0f - 2.0f * top / self->height;
+      GLfloat y1 = 1.0f - 2.0f * bottom / self->height;
+      const GLfloat vertices[4][2] = {
+          {x0, y0},
+          {x1, y0},
+          {x0, y1},
+          {x1, y1},
+      };
+
+      glBindTexture(GL_TEXTURE_2D,
+                    self->textures[row * self->columns + column]);
+      glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, vertices);
+      glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    }
+  }
+  assert(glGetError() == GL_NO_ERROR);
+
+  glDisableVertexAttribArray(0);
+  glDisableVertexAttribArray(1);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <GLES3/gl3.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+/* An image split into a grid of fixed-size textures, for images larger than
+ * GL_MAX_TEXTURE_SIZE. Rows are staged on the host one tile row at a time,
+ * so host memory stays bounded by tile_size rows whatever the image height.
+ */
+struct o_tiled_texture {
+  uint32_t width;
+  uint32_t height;
+  GLenum format;
+  uint32_t bytes_per_pixel;
+
+  uint32_t tile_size;
+  uint32_t columns;
+  uint32_t rows;
+  GLuint *textures;
+
+  /* Rows of the tile row being filled, and one tile repacked for upload. */
+  uint8_t *staging;
+  uint8_t *tile;
+  uint32_t staged_tile_row;
+  uint32_t staged_rows;
+};
+
+bool o_tiled_texture_init(struct o_tiled_texture *self, uint32_t width,
+                          uint32_t height, GLenum format, uint32_t tile_size);
+
+void o_tiled_texture_clear(struct o_tiled_texture *self);
+
+/* Appends consecutive rows, top to bottom. Each tile row is uploaded as soon
+ * as its last image row arrives.
+ */
+void o_tiled_texture_write(struct o_tiled_texture *self, const void *pixels,
+                           size_t first_row, size_t num_rows);
+
+/* Draws the tiles over the whole viewport, using vertex attributes 0
+ * (position) and 1 (texture coordinates).
+ */
+void o_tiled_texture_draw(const struct o_tiled_texture *self);
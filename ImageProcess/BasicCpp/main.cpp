@@ -4,13 +4,18 @@
 #include <GLFW/glfw3.h>
 
 #include <cassert>
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <memory>
 #include <png++/png.hpp>
 #include <string>
 #include <vector>
 
+#include "../Filter/gl_context.hpp"
+
 bool gl_utils_print_shader_log(GLuint shader) {
   GLint length;
   char buffer[4096] = {0};
@@ -86,38 +91,148 @@ GLuint create_shader_program() {
   return program;
 }
 
-int32_t main(int32_t argc, char *argv[]) {
-  printf("Usage: %s <path-to-PNG-image>\n", argv[0]);
+void draw_image(GLuint tex) {
+  glClearColor(0.25, 0.25, 0.25, 0.5);
+  glClear(GL_COLOR_BUFFER_BIT);
 
-  if (argc <= 1) return EXIT_FAILURE;
+  // Bind the texture.
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, tex);
+  assert(glGetError() == GL_NO_ERROR);
 
-  // Load an decode an image.
-  png::image<png::rgb_pixel> image(argv[1]);
+  // Enable blending for transparent PNGs.
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+  // Draw a quad.
+  constexpr GLfloat s_vertices[4][2] = {
+      {-1.0, 1.0},
+      {1.0, 1.0},
+      {-1.0, -1.0},
+      {1.0, -1.0},
+  };
+
+  constexpr GLfloat s_texturePos[4][2] = {
+      {0, 0},
+      {1, 0},
+      {0, 1},
+      {1, 1},
+  };
+
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, s_vertices);
+  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, s_texturePos);
+
+  glEnableVertexAttribArray(0);
+  glEnableVertexAttribArray(1);
+
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+  glDisableVertexAttribArray(0);
+  glDisableVertexAttribArray(1);
+}
+
+// Draws the image once into a framebuffer object of its size and writes
+// that out, for headless runs.
+void render_to_file(GLuint tex, uint32_t width, uint32_t height,
+                    const std::string &filename) {
+  GLuint target;
+  glGenTextures(1, &target);
+  glBindTexture(GL_TEXTURE_2D, target);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA,
+               GL_UNSIGNED_BYTE, NULL);
+  assert(glGetError() == GL_NO_ERROR);
 
-  GLFWwindow *window;
+  GLuint fbo;
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                         target, 0);
+  assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
 
-  // Initialize GLFW.
-  if (!glfwInit()) return EXIT_FAILURE;
+  glViewport(0, 0, width, height);
+  draw_image(tex);
 
-  // Select an OpenGL-ES 2.0 profile.
-  glfwWindowHint(GLFW_CLIENT_API, GLFW_OPENGL_ES_API);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
+  std::vector<uint8_t> pixels(width * height * 4);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+  assert(glGetError() == GL_NO_ERROR);
+
+  // The framebuffer is read bottom row first.
+  png::image<png::rgba_pixel> image(width, height);
+  for (size_t y = 0; y < height; ++y) {
+    const uint8_t *row = &pixels[(height - 1 - y) * width * 4];
+    for (size_t x = 0; x < width; ++x)
+      image[y][x] = png::rgba_pixel(row[x * 4], row[x * 4 + 1],
+                                    row[x * 4 + 2], row[x * 4 + 3]);
+  }
+  image.write(filename);
 
-  // Create a windowed mode window and its OpenGL context
-  window = glfwCreateWindow(image.get_width(), image.get_height(),
-                            "GL Image Loader", NULL, NULL);
-  if (window == NULL) {
-    glfwTerminate();
-    return EXIT_FAILURE;
+  glDeleteFramebuffers(1, &fbo);
+  glDeleteTextures(1, &target);
+}
+
+int32_t main(int32_t argc, char *argv[]) {
+  printf(
+      "Usage: %s [--context glfw|egl] <path-to-PNG-image> [output.png]\n"
+      "       With egl, the image is drawn headless into output.png.\n",
+      argv[0]);
+
+  std::vector<std::string> paths;
+  bool headless = false;
+  for (int32_t i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "--context" && i + 1 < argc) {
+      const std::string context = argv[++i];
+      if (context != "glfw" && context != "egl") return EXIT_FAILURE;
+      headless = context == "egl";
+    } else {
+      paths.push_back(arg);
+    }
   }
 
-  // Make the window's context current
-  glfwMakeContextCurrent(window);
+  if (paths.empty()) return EXIT_FAILURE;
+
+  // Load an decode an image.
+  png::image<png::rgb_pixel> image(paths[0]);
+
+  GLFWwindow *window = NULL;
+  std::unique_ptr<GlContext> context;
+
+  const auto start = std::chrono::steady_clock::now();
+  if (headless) {
+    // The image is drawn into a framebuffer object, so the context needs no
+    // window.
+    context = GlContext::create(ContextBackend::EGL_HEADLESS, 1, 1, 2, 0);
+    if (context == nullptr) return EXIT_FAILURE;
+  } else {
+
+    // Initialize GLFW.
+    if (!glfwInit()) return EXIT_FAILURE;
+
+    // Select an OpenGL-ES 2.0 profile.
+    glfwWindowHint(GLFW_CLIENT_API, GLFW_OPENGL_ES_API);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
+
+    // Create a windowed mode window and its OpenGL context
+    window = glfwCreateWindow(image.get_width(), image.get_height(),
+                              "GL Image Loader", NULL, NULL);
+    if (window == NULL) {
+      glfwTerminate();
+      return EXIT_FAILURE;
+    }
+
+    // Make the window's context current
+    glfwMakeContextCurrent(window);
+  }
+  const std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
 
   // Dump some GL capabilities.
   const GLubyte *gles_version = glGetString(GL_VERSION);
   printf("%s\n", (char *)gles_version);
+  printf("Context (%s) created in %.3f ms\n", headless ? "egl" : "glfw",
+         elapsed.count());
 
   // Create a texture for the image.
   GLuint tex;
@@ -144,7 +259,8 @@ int32_t main(int32_t argc, char *argv[]) {
     }
   }
 
-  // Allocate the texture size.
+  // Allocate the texture size. The rows are tightly packed.
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
   glTexImage2D(GL_TEXTURE_2D, 0, format, image.get_width(), image.get_height(),
                0, format, GL_UNSIGNED_BYTE, buf.data());
   assert(glGetError() == GL_NO_ERROR);
@@ -156,46 +272,16 @@ int32_t main(int32_t argc, char *argv[]) {
   glUseProgram(program);
   assert(glGetError() == GL_NO_ERROR);
 
+  if (headless) {
+    render_to_file(tex, image.get_width(), image.get_height(),
+                   paths.size() > 1 ? paths[1] : "output.png");
+    return EXIT_SUCCESS;
+  }
+
   // Loop until the user closes the window
   while (!glfwWindowShouldClose(window)) {
     // Render here
-    glClearColor(0.25, 0.25, 0.25, 0.5);
-    glClear(GL_COLOR_BUFFER_BIT);
-
-    // Bind the texture.
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, tex);
-    assert(glGetError() == GL_NO_ERROR);
-
-    // Enable blending for transparent PNGs.
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-    // Draw a quad.
-    constexpr GLfloat s_vertices[4][2] = {
-        {-1.0, 1.0},
-        {1.0, 1.0},
-        {-1.0, -1.0},
-        {1.0, -1.0},
-    };
-
-    constexpr GLfloat s_texturePos[4][2] = {
-        {0, 0},
-        {1, 0},
-        {0, 1},
-        {1, 1},
-    };
-
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, s_vertices);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, s_texturePos);
-
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-
-    glDisableVertexAttribArray(0);
-    glDisableVertexAttribArray(1);
+    draw_image(tex);
 
     // Swap front and back buffers
     glfwSwapBuffers(window);
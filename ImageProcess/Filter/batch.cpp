@@ -0,0 +1,219 @@
+#include "batch.hpp"
+
+#include <GLES2/gl2.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <thread>
+
+#include "../BasicC/png.h"
+#include "bounded_queue.hpp"
+#include "gl_utils.hpp"
+#include "image_writer.hpp"
+#include "pixel_readback.hpp"
+
+namespace {
+
+// Images waiting between two stages. One is enough to keep the next stage
+// busy; the second absorbs jitter.
+constexpr size_t QUEUE_CAPACITY = 2;
+
+struct Frame {
+  size_t index;
+  int width;
+  int height;
+
+  // RGBA rows, top-down once decoded and bottom-up once read back.
+  std::vector<uint8_t> pixels;
+};
+
+using Clock = std::chrono::steady_clock;
+
+double seconds_since(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+bool decode_png(const std::string &filename, Frame &frame) {
+  png_ctx png;
+  if (!png_decoder_init_from_filename(&png, filename.c_str(), nullptr))
+    return false;
+
+  frame.width = png.width;
+  frame.height = png.height;
+  frame.pixels.resize(png.row_stride * png.height);
+
+  size_t offset = 0;
+  while (offset < frame.pixels.size()) {
+    const ssize_t size = png_read(&png, frame.pixels.data() + offset,
+                                  frame.pixels.size() - offset, NULL, NULL);
+    if (size <= 0) break;
+    offset += size;
+  }
+  png_clear(&png);
+
+  return offset == frame.pixels.size();
+}
+
+}  // namespace
+
+std::vector<std::string> list_batch_inputs(
+    const std::vector<std::string> &paths) {
+  std::vector<std::string> inputs;
+  for (const std::string &path : paths) {
+    std::error_code error;
+    if (!std::filesystem::is_directory(path, error)) {
+      inputs.push_back(path);
+      continue;
+    }
+
+    std::vector<std::string> files;
+    for (const auto &entry :
+         std::filesystem::directory_iterator(path, error)) {
+      if (entry.is_regular_file(error) &&
+          entry.path().extension() == ".png")
+        files.push_back(entry.path().string());
+    }
+    std::sort(files.begin(), files.end());
+    inputs.insert(inputs.end(), files.begin(), files.end());
+  }
+
+  return inputs;
+}
+
+bool run_batch(const std::vector<std::string> &inputs,
+               const std::string &output_directory,
+               const FilterBuilder &build) {
+  std::error_code error;
+  std::filesystem::create_directories(output_directory, error);
+  if (error) return false;
+
+  BoundedQueue<Frame> decoded(QUEUE_CAPACITY);
+  BoundedQueue<Frame> filtered(QUEUE_CAPACITY);
+  std::atomic<size_t> num_failed(0);
+  double decode_seconds = 0;
+  double filter_seconds = 0;
+  double encode_seconds = 0;
+
+  const Clock::time_point start = Clock::now();
+
+  std::thread decoder([&] {
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      const Clock::time_point decode_start = Clock::now();
+      Frame frame = {i, 0, 0, {}};
+      if (!decode_png(inputs[i], frame)) {
+        printf("Failed to decode %s\n", inputs[i].c_str());
+        num_failed++;
+        continue;
+      }
+      decode_seconds += seconds_since(decode_start);
+
+      decoded.push(std::move(frame));
+    }
+    decoded.close();
+  });
+
+  std::thread encoder([&] {
+    Frame frame;
+    while (filtered.pop(frame)) {
+      const Clock::time_point encode_start = Clock::now();
+      const std::string output =
+          (std::filesystem::path(output_directory) /
+           std::filesystem::path(inputs[frame.index]).filename())
+              .string();
+      if (!write_image_file(output, frame.width, frame.height, 4,
+                            frame.pixels.data())) {
+        printf("Failed to write %s\n", output.c_str());
+        num_failed++;
+      }
+      encode_seconds += seconds_since(encode_start);
+    }
+  });
+
+  // The GL stage runs on this thread, which owns the context. The input
+  // texture is only reallocated when the size changes, and the pool keeps
+  // the intermediate textures of images of the same size.
+  TexturePool pool;
+  GLuint texture = createAndSetupTexture();
+  int texture_width = 0;
+  int texture_height = 0;
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+  // Each image is read back while the next one is drawn, through two pixel
+  // pack buffers taking turns. The decoded pixels of the image in flight are
+  // no longer needed, so they make room for the filtered ones.
+  PixelReadback readbacks[2];
+  size_t num_drawn = 0;
+  Frame in_flight;
+  const auto finish_readback = [&](PixelReadback &readback) {
+    const bool ok = readback.finish([&](const uint8_t *pixels) {
+      std::copy(pixels, pixels + in_flight.pixels.size(),
+                in_flight.pixels.begin());
+      return true;
+    });
+    if (!ok) {
+      printf("Failed to read back %s\n", inputs[in_flight.index].c_str());
+      num_failed++;
+      return;
+    }
+    filtered.push(std::move(in_flight));
+  };
+
+  Frame frame;
+  while (decoded.pop(frame)) {
+    const Clock::time_point filter_start = Clock::now();
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+    if (frame.width != texture_width || frame.height != texture_height) {
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, frame.width, frame.height, 0,
+                   GL_RGBA, GL_UNSIGNED_BYTE, frame.pixels.data());
+      texture_width = frame.width;
+      texture_height = frame.height;
+    } else {
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, frame.width, frame.height,
+                      GL_RGBA, GL_UNSIGNED_BYTE, frame.pixels.data());
+    }
+    assert(glGetError() == GL_NO_ERROR);
+
+    FilterGraph graph(pool);
+    const FilterImage output = build(
+        graph, graph.add_input(texture, frame.width, frame.height, GL_RGBA));
+    const GLuint fbo = graph.execute(output);
+    if (fbo == 0) {
+      num_failed++;
+      continue;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    readbacks[num_drawn++ % 2].start(frame.width, frame.height);
+
+    PixelReadback &previous = readbacks[num_drawn % 2];
+    if (previous.pending()) finish_readback(previous);
+    in_flight = std::move(frame);
+    filter_seconds += seconds_since(filter_start);
+  }
+
+  PixelReadback &last = readbacks[(num_drawn + 1) % 2];
+  if (last.pending()) finish_readback(last);
+  filtered.close();
+
+  decoder.join();
+  encoder.join();
+  glDeleteTextures(1, &texture);
+
+  const double seconds = seconds_since(start);
+  const size_t num_done = inputs.size() - num_failed;
+  printf("Batch: %zu images in %.2f s (%.2f images/s)\n", num_done, seconds,
+         num_done / seconds);
+  printf("  decode: %.2f s, filter: %.2f s, encode: %.2f s\n", decode_seconds,
+         filter_seconds, encode_seconds);
+  printf("  pooled textures: %zu (%.1f MiB)\n", pool.num_textures(),
+         pool.num_bytes() / 1048576.0);
+
+  return num_failed == 0;
+}
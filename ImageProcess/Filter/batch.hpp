@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "filter_graph.hpp"
+
+// Expands directories to the PNG files they hold, in name order.
+std::vector<std::string> list_batch_inputs(
+    const std::vector<std::string> &paths);
+
+// Filters every file into @output_directory, under the same name, on the
+// current GL context, with @build given the images as RGBA. Decoding,
+// filtering and encoding run on their own threads, with at most a couple of
+// images queued between them, so images go through at about the rate of the
+// slowest stage. The context, programs and pooled textures are shared by all
+// the images.
+//
+// Returns false if any image failed.
+bool run_batch(const std::vector<std::string> &inputs,
+               const std::string &output_directory,
+               const FilterBuilder &build);
@@ -0,0 +1,112 @@
+#include "benchmark.hpp"
+
+#include <GLES3/gl31.h>
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+
+#include "compute_convolution.hpp"
+#include "convolution.hpp"
+#include "filter_graph.hpp"
+#include "summed_area_blur.hpp"
+
+namespace {
+
+constexpr int RADII[] = {1, 2, 4, 8, 16, 32, 64, 128};
+
+// Runs timed after one untimed run, which compiles and allocates lazily.
+constexpr int NUM_RUNS = 10;
+
+// Returns the milliseconds per run of @run, waiting for the GPU each time.
+double time_runs(const std::function<void()> &run) {
+  run();
+  glFinish();
+
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < NUM_RUNS; ++i) {
+    run();
+    glFinish();
+  }
+  const std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  return elapsed.count() / NUM_RUNS;
+}
+
+}  // namespace
+
+void run_convolution_benchmark(GLuint texture, int width, int height,
+                               GLenum format) {
+  printf("Separable Gaussian blur of %dx%d, ms per run:\n", width, height);
+  printf("%8s %12s %12s %12s %12s %8s\n", "radius", "fragment", "compute",
+         "frag taps", "comp taps", "speedup");
+
+  for (const int radius : RADII) {
+    if (radius > ComputeConvolution::max_radius()) break;
+
+    const std::vector<float> weights =
+        gaussian_weights(radius, radius / 2.0f + 0.5f);
+
+    TexturePool pool;
+    FilterGraph graph(pool);
+    const SeparableConvolution convolution(weights, weights);
+    const FilterImage input = graph.add_input(texture, width, height, format);
+    const FilterImage output = graph.add_image(width, height, format);
+    convolution.add_passes(graph, input, output);
+    const double fragment_ms = time_runs([&] { graph.execute(output); });
+
+    ComputeConvolution compute(width, height, weights, weights);
+    const double compute_ms =
+        time_runs([&] { compute.apply(texture, true); });
+
+    // Texture fetches per pixel over both passes. The fragment passes fetch
+    // the Gaussian taps in pairs. Every compute invocation fetches one pixel,
+    // plus its share of the halos of its group.
+    const double fragment_taps = 2.0 * (1 + 2 * ((radius + 1) / 2));
+    const double compute_taps =
+        2.0 * (1 + 2.0 * radius / ComputeConvolution::GROUP_SIZE);
+
+    printf("%8d %12.3f %12.3f %12.0f %12.2f %7.2fx\n", radius, fragment_ms,
+           compute_ms, fragment_taps, compute_taps, fragment_ms / compute_ms);
+  }
+}
+
+void run_box_blur_benchmark(GLuint texture, int width, int height,
+                            GLenum format) {
+  printf("Box blur of %dx%d, ms per run:\n", width, height);
+  printf("%8s %12s %12s %12s %12s %8s\n", "radius", "separable", "table",
+         "sep taps", "table taps", "speedup");
+
+  int crossover = 0;
+  for (const int radius : RADII) {
+    const std::vector<float> weights = box_weights(radius);
+
+    TexturePool pool;
+    FilterGraph graph(pool);
+    const SeparableConvolution convolution(weights, weights);
+    const FilterImage input = graph.add_input(texture, width, height, format);
+    const FilterImage output = graph.add_image(width, height, format);
+    convolution.add_passes(graph, input, output);
+    const double separable_ms = time_runs([&] { graph.execute(output); });
+
+    SummedAreaBlur blur(width, height, radius);
+    const double table_ms = time_runs([&] { blur.apply(texture, true); });
+
+    // Texture fetches per pixel. The separable passes fetch the taps in
+    // pairs. The table is fetched once by each scan and at four corners
+    // for each box.
+    const double separable_taps = 2.0 * (1 + 2 * ((radius + 1) / 2));
+    const double table_taps = 2 * blur.table_ratio() + 4;
+
+    printf("%8d %12.3f %12.3f %12.0f %12.2f %7.2fx\n", radius, separable_ms,
+           table_ms, separable_taps, table_taps, separable_ms / table_ms);
+
+    if (crossover == 0 && table_ms < separable_ms) crossover = radius;
+  }
+
+  if (crossover > 0)
+    printf("The table is faster from radius %d\n", crossover);
+  else
+    printf("The separable passes are faster at every radius\n");
+}
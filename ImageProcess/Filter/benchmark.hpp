@@ -0,0 +1,16 @@
+#pragma once
+
+#include <GLES2/gl2.h>
+
+// Times the Gaussian blur of @texture, an uploaded image, on the fragment
+// and compute backends for kernels of growing radius, and prints a table of
+// the two. Needs an OpenGL ES 3.1 context.
+void run_convolution_benchmark(GLuint texture, int width, int height,
+                               GLenum format);
+
+// Times the box blur of @texture, an uploaded image, on the separable
+// fragment passes and from a summed-area table for kernels of growing
+// radius, prints a table of the two and the smallest radius from which the
+// table is faster. Needs an OpenGL ES 3.1 context.
+void run_box_blur_benchmark(GLuint texture, int width, int height,
+                            GLenum format);
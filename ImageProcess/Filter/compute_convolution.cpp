@@ -0,0 +1,144 @@
+#include "compute_convolution.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <string>
+
+#include "gl_utils.hpp"
+
+int ComputeConvolution::max_radius() {
+  GLint shared_size;
+  glGetIntegerv(GL_MAX_COMPUTE_SHARED_MEMORY_SIZE, &shared_size);
+  assert(glGetError() == GL_NO_ERROR);
+
+  // One vec4 per pixel of the group and of the halo on both sides.
+  return (shared_size / 16 - GROUP_SIZE) / 2;
+}
+
+// Each invocation filters one pixel of a run of GROUP_SIZE pixels along a
+// row, or along a column for the vertical pass. Between the passes the first
+// row is at y = 0, like in uploaded images, so the horizontal pass flips
+// rendered inputs and the vertical pass flips its output.
+static std::string convolution_source(const std::vector<float> &weights,
+                                      bool vertical) {
+  const int radius = weights.size() / 2;
+
+  char header[256];
+  snprintf(header, sizeof(header),
+           "#version 310 es\n"
+           "#define GROUP_SIZE %d\n"
+           "#define RADIUS %d\n"
+           "#define VERTICAL %d\n",
+           ComputeConvolution::GROUP_SIZE, radius, vertical);
+
+  std::string source = header;
+  source += "const float WEIGHTS[2 * RADIUS + 1] = float[](";
+  for (size_t i = 0; i < weights.size(); ++i) {
+    if (i > 0) source += ", ";
+    source += gl_utils_float_literal(weights[i]);
+  }
+  source += ");\n";
+
+  source +=
+      "precision highp float;\n"
+      "layout(local_size_x = GROUP_SIZE) in;\n"
+      "layout(binding = 0) uniform highp sampler2D u_tex;\n"
+      "layout(rgba8, binding = 0) writeonly uniform highp image2D u_output;\n"
+      "uniform bool u_flip_input;\n"
+      "shared vec4 tile[GROUP_SIZE + 2 * RADIUS];\n"
+      "ivec2 pixel(int along, int across) {\n"
+      "  return VERTICAL != 0 ? ivec2(across, along) : ivec2(along, across);\n"
+      "}\n"
+      "void main() {\n"
+      "  ivec2 size = textureSize(u_tex, 0);\n"
+      "  int extent = VERTICAL != 0 ? size.y : size.x;\n"
+      "  int across = int(gl_WorkGroupID.y);\n"
+      "  int first = int(gl_WorkGroupID.x) * GROUP_SIZE - RADIUS;\n"
+      "  int local = int(gl_LocalInvocationID.x);\n"
+      // Edge pixels repeat, like the clamped texture coordinates of the
+      // fragment passes.
+      "  for (int i = local; i < GROUP_SIZE + 2 * RADIUS; i += GROUP_SIZE) {\n"
+      "    ivec2 source = pixel(clamp(first + i, 0, extent - 1), across);\n"
+      "    if (u_flip_input) source.y = size.y - 1 - source.y;\n"
+      "    tile[i] = texelFetch(u_tex, source, 0);\n"
+      "  }\n"
+      "  barrier();\n"
+      "  int along = first + RADIUS + local;\n"
+      "  if (along >= extent) return;\n"
+      "  vec3 sum = vec3(0.0);\n"
+      "  for (int i = 0; i <= 2 * RADIUS; ++i)\n"
+      "    sum += tile[local + i].rgb * WEIGHTS[i];\n"
+      "  ivec2 target = pixel(along, across);\n"
+      "  if (VERTICAL != 0) target.y = size.y - 1 - target.y;\n"
+      "  imageStore(u_output, target, vec4(sum, tile[local + RADIUS].a));\n"
+      "}\n";
+
+  return source;
+}
+
+ComputeConvolution::ComputeConvolution(int width, int height,
+                                       const std::vector<float> &horizontal,
+                                       const std::vector<float> &vertical)
+    : width_(width), height_(height) {
+  assert(horizontal.size() % 2 == 1);
+  assert(vertical.size() % 2 == 1);
+  assert(static_cast<int>(horizontal.size() / 2) <= max_radius());
+  assert(static_cast<int>(vertical.size() / 2) <= max_radius());
+
+  program_[0] =
+      gl_utils_create_compute_program(convolution_source(horizontal, false));
+  program_[1] =
+      gl_utils_create_compute_program(convolution_source(vertical, true));
+
+  // Images written by compute shaders need immutable storage.
+  for (int pass = 0; pass < 2; ++pass) {
+    texture_[pass] = createAndSetupTexture();
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+    assert(glGetError() == GL_NO_ERROR);
+  }
+
+  glGenFramebuffers(1, &fbo_);
+  assert(glGetError() == GL_NO_ERROR);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+  assert(glGetError() == GL_NO_ERROR);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                         texture_[1], 0);
+  assert(glGetError() == GL_NO_ERROR);
+}
+
+ComputeConvolution::~ComputeConvolution() {
+  glDeleteFramebuffers(1, &fbo_);
+  glDeleteTextures(2, texture_);
+  glDeleteProgram(program_[0]);
+  glDeleteProgram(program_[1]);
+}
+
+GLuint ComputeConvolution::apply(GLuint source, bool source_uploaded) {
+  const GLuint inputs[2] = {source, texture_[0]};
+  const int lengths[2] = {width_, height_};
+  const int runs[2] = {height_, width_};
+  for (int pass = 0; pass < 2; ++pass) {
+    glUseProgram(program_[pass]);
+    glUniform1i(glGetUniformLocation(program_[pass], "u_flip_input"),
+                pass == 0 && !source_uploaded);
+    assert(glGetError() == GL_NO_ERROR);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, inputs[pass]);
+    glBindImageTexture(0, texture_[pass], 0, GL_FALSE, 0, GL_WRITE_ONLY,
+                       GL_RGBA8);
+    assert(glGetError() == GL_NO_ERROR);
+
+    glDispatchCompute((lengths[pass] + GROUP_SIZE - 1) / GROUP_SIZE,
+                      runs[pass], 1);
+    assert(glGetError() == GL_NO_ERROR);
+
+    // The next pass samples what this one stored, and the caller reads the
+    // last one back through the framebuffer.
+    glMemoryBarrier(pass == 0 ? GL_TEXTURE_FETCH_BARRIER_BIT
+                              : GL_FRAMEBUFFER_BARRIER_BIT |
+                                    GL_TEXTURE_FETCH_BARRIER_BIT);
+  }
+
+  return fbo_;
+}
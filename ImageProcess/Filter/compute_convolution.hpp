@@ -0,0 +1,47 @@
+#pragma once
+
+#include <GLES3/gl31.h>
+
+#include <vector>
+
+// Convolves an image with a separable kernel in two compute dispatches, one
+// along rows and one along columns. Each work group loads its run of pixels
+// plus a halo of the kernel radius on each side into shared memory once,
+// and evaluates the taps from there, where the fragment passes fetch every
+// tap from the texture for every pixel.
+//
+// Needs OpenGL ES 3.1. The weights follow SeparableConvolution.
+class ComputeConvolution {
+ public:
+  // Pixels filtered by each work group.
+  static constexpr int GROUP_SIZE = 128;
+
+  // The widest kernel whose halo fits in shared memory.
+  static int max_radius();
+
+  ComputeConvolution(int width, int height,
+                     const std::vector<float> &horizontal,
+                     const std::vector<float> &vertical);
+  ~ComputeConvolution();
+
+  ComputeConvolution(const ComputeConvolution &) = delete;
+  ComputeConvolution &operator=(const ComputeConvolution &) = delete;
+
+  // Filters @source, of the size given at construction, into texture().
+  // Returns the framebuffer holding the result, with its first row at the
+  // top like rendered images. An uploaded @source has its first row at
+  // t = 0. @source may be texture() itself, to filter again.
+  GLuint apply(GLuint source, bool source_uploaded);
+
+  GLuint texture() const { return texture_[1]; }
+
+ private:
+  int width_;
+  int height_;
+
+  GLuint program_[2];
+
+  // The rows pass writes the first texture, and the columns pass the second.
+  GLuint texture_[2];
+  GLuint fbo_;
+};
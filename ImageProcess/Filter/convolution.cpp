@@ -0,0 +1,103 @@
+#include "convolution.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <string>
+
+#include "gl_utils.hpp"
+#include "kernel_library.hpp"
+
+std::vector<float> box_weights(int radius) {
+  assert(radius >= 0);
+
+  return std::vector<float>(2 * radius + 1, 1.0f / (2 * radius + 1));
+}
+
+std::vector<float> gaussian_weights(int radius, float sigma) {
+  assert(radius >= 0);
+  assert(sigma > 0);
+
+  std::vector<float> weights(2 * radius + 1);
+  float sum = 0;
+  for (int i = -radius; i <= radius; ++i) {
+    weights[i + radius] = std::exp(-0.5f * i * i / (sigma * sigma));
+    sum += weights[i + radius];
+  }
+  for (float &weight : weights) weight /= sum;
+
+  return weights;
+}
+
+// Unrolls the taps, with the weights as constants, since GLSL ES 1.00 only
+// has loops of constant bounds and few uniforms to spare. Wide kernels step
+// far from the center, so the offsets need high precision where available.
+// Symmetric positive kernels fetch adjacent taps in pairs, by linear
+// filtering.
+static std::string convolution_source(const std::vector<float> &weights,
+                                      bool vertical) {
+  std::string source =
+      "#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+      "precision highp float;\n"
+      "#else\n"
+      "precision mediump float;\n"
+      "#endif\n"
+      "uniform sampler2D u_tex;\n"
+      "uniform vec2 u_texel;\n"
+      "varying vec2 v_texture;\n"
+      "void main() {\n"
+      "  vec4 center = texture2D(u_tex, v_texture);\n"
+      "  vec3 sum = vec3(0.0);\n";
+
+  std::vector<float> offsets(weights.size());
+  std::vector<float> merged(weights.size());
+  const int num_taps = bilinear_taps(weights.data(), weights.size(),
+                                     offsets.data(), merged.data());
+
+  char line[160];
+  for (int i = 0; i < num_taps; ++i) {
+    const std::string offset = gl_utils_float_literal(offsets[i]);
+    if (offsets[i] == 0)
+      snprintf(line, sizeof(line), "  sum += center.rgb * %s;\n",
+               gl_utils_float_literal(merged[i]).c_str());
+    else
+      snprintf(line, sizeof(line),
+               "  sum += texture2D(u_tex, v_texture + u_texel * vec2(%s, %s))"
+               ".rgb * %s;\n",
+               vertical ? "0.0" : offset.c_str(),
+               vertical ? offset.c_str() : "0.0",
+               gl_utils_float_literal(merged[i]).c_str());
+    source += line;
+  }
+
+  source +=
+      "  gl_FragColor = vec4(sum, center.a);\n"
+      "}\n";
+
+  return source;
+}
+
+SeparableConvolution::SeparableConvolution(
+    const std::vector<float> &horizontal, const std::vector<float> &vertical) {
+  assert(horizontal.size() % 2 == 1);
+  assert(vertical.size() % 2 == 1);
+
+  program_[0] =
+      gl_utils_create_program(convolution_source(horizontal, false).c_str());
+  program_[1] =
+      gl_utils_create_program(convolution_source(vertical, true).c_str());
+}
+
+SeparableConvolution::~SeparableConvolution() {
+  glDeleteProgram(program_[0]);
+  glDeleteProgram(program_[1]);
+}
+
+void SeparableConvolution::add_passes(FilterGraph &graph, FilterImage input,
+                                      FilterImage output) const {
+  const FilterImage rows = graph.add_image(
+      graph.width(output), graph.height(output), graph.format(output));
+
+  graph.add_pass(program_[0], {input}, rows);
+  graph.add_pass(program_[1], {rows}, output);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <GLES2/gl2.h>
+
+#include <vector>
+
+#include "filter_graph.hpp"
+
+// Normalized 1D kernels of 2 * radius + 1 taps.
+std::vector<float> box_weights(int radius);
+std::vector<float> gaussian_weights(int radius, float sigma);
+
+// Convolves an image with a separable kernel as a horizontal pass and a
+// vertical pass through an intermediate image, so the two ping-pong between
+// pooled framebuffer textures. A kernel of radius r costs 2 * (2r + 1)
+// fetches per pixel instead of (2r + 1)^2, and symmetric positive ones, as
+// bilinear_taps() merges them, 2 * (1 + 2 * ceil(r / 2)).
+//
+// Each pass takes an odd number of weights, applied from left to right and
+// from top to bottom. Alpha is passed through from the center tap.
+class SeparableConvolution {
+ public:
+  SeparableConvolution(const std::vector<float> &horizontal,
+                       const std::vector<float> &vertical);
+  ~SeparableConvolution();
+
+  SeparableConvolution(const SeparableConvolution &) = delete;
+  SeparableConvolution &operator=(const SeparableConvolution &) = delete;
+
+  // Adds the passes filtering @input into @output, which must have the same
+  // size, to @graph.
+  void add_passes(FilterGraph &graph, FilterImage input,
+                  FilterImage output) const;
+
+ private:
+  GLuint program_[2];
+};
@@ -0,0 +1,287 @@
+#include "cpu_convolution.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+#include "../BasicC/convert.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FILTER_CPU_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define FILTER_CPU_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+// Sums bytes @first to @size one at a time, for the tails of the SIMD
+// kernels. Sums round to the nearest value and saturate, like the writes to
+// 8-bit render targets.
+void weighted_sum_bytes(uint8_t *destination, const uint8_t *const *sources,
+                        const float *weights, int num_taps, size_t first,
+                        size_t size) {
+  for (size_t i = first; i < size; ++i) {
+    float sum = 0;
+    for (int k = 0; k < num_taps; ++k) sum += weights[k] * sources[k][i];
+
+    destination[i] = static_cast<uint8_t>(
+        std::min(std::max(std::nearbyint(sum), 0.0f), 255.0f));
+  }
+}
+
+void weighted_sum_scalar(uint8_t *destination, const uint8_t *const *sources,
+                         const float *weights, int num_taps, size_t size) {
+  weighted_sum_bytes(destination, sources, weights, num_taps, 0, size);
+}
+
+#ifdef FILTER_CPU_X86
+// Sums 16 bytes at a time, as two vectors of eight floats.
+__attribute__((target("avx2"))) void weighted_sum_avx2(
+    uint8_t *destination, const uint8_t *const *sources, const float *weights,
+    int num_taps, size_t size) {
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m256 low = _mm256_setzero_ps();
+    __m256 high = _mm256_setzero_ps();
+    for (int k = 0; k < num_taps; ++k) {
+      const __m128i bytes =
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(sources[k] + i));
+      const __m256 weight = _mm256_set1_ps(weights[k]);
+      low = _mm256_add_ps(
+          low, _mm256_mul_ps(
+                   _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes)), weight));
+      high = _mm256_add_ps(
+          high, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+                                  _mm_srli_si128(bytes, 8))),
+                              weight));
+    }
+
+    // Round to nearest, then narrow with unsigned saturation.
+    const __m256i low32 = _mm256_cvtps_epi32(low);
+    const __m256i high32 = _mm256_cvtps_epi32(high);
+    const __m128i low16 = _mm_packus_epi32(_mm256_castsi256_si128(low32),
+                                           _mm256_extracti128_si256(low32, 1));
+    const __m128i high16 = _mm_packus_epi32(
+        _mm256_castsi256_si128(high32), _mm256_extracti128_si256(high32, 1));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(destination + i),
+                     _mm_packus_epi16(low16, high16));
+  }
+
+  weighted_sum_bytes(destination, sources, weights, num_taps, i, size);
+}
+#endif
+
+#ifdef FILTER_CPU_NEON
+// Sums 8 bytes at a time, as two vectors of four floats.
+void weighted_sum_neon(uint8_t *destination, const uint8_t *const *sources,
+                       const float *weights, int num_taps, size_t size) {
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    float32x4_t low = vdupq_n_f32(0);
+    float32x4_t high = vdupq_n_f32(0);
+    for (int k = 0; k < num_taps; ++k) {
+      const uint16x8_t words = vmovl_u8(vld1_u8(sources[k] + i));
+      low = vfmaq_n_f32(low, vcvtq_f32_u32(vmovl_u16(vget_low_u16(words))),
+                        weights[k]);
+      high = vfmaq_n_f32(high, vcvtq_f32_u32(vmovl_u16(vget_high_u16(words))),
+                         weights[k]);
+    }
+
+    // Round to nearest, saturating negative sums to 0, then narrow.
+    const uint16x8_t sums = vcombine_u16(vqmovn_u32(vcvtnq_u32_f32(low)),
+                                         vqmovn_u32(vcvtnq_u32_f32(high)));
+    vst1_u8(destination + i, vqmovn_u16(sums));
+  }
+
+  weighted_sum_bytes(destination, sources, weights, num_taps, i, size);
+}
+#endif
+
+// Copies the @width pixels of @row to @padded with @radius repeated edge
+// pixels on each side.
+void pad_row(const uint8_t *row, uint8_t *padded, int width, int channels,
+             int radius) {
+  const size_t row_stride = static_cast<size_t>(width) * channels;
+  for (int x = 0; x < radius; ++x) {
+    memcpy(&padded[x * channels], row, channels);
+    memcpy(&padded[(radius + width + x) * channels],
+           row + row_stride - channels, channels);
+  }
+  memcpy(&padded[radius * channels], row, row_stride);
+}
+
+// Calls @filter_rows on @num_threads bands of the @height rows.
+void parallel_rows(
+    int height, unsigned num_threads,
+    const std::function<void(int first, int last)> &filter_rows) {
+  const int band = (height + num_threads - 1) / num_threads;
+
+  std::vector<std::thread> threads;
+  for (int first = band; first < height; first += band)
+    threads.emplace_back(filter_rows, first, std::min(first + band, height));
+  filter_rows(0, std::min(band, height));
+
+  for (std::thread &thread : threads) thread.join();
+}
+
+}  // namespace
+
+CpuConvolution::CpuConvolution(const std::vector<float> &horizontal,
+                               const std::vector<float> &vertical,
+                               unsigned num_threads)
+    : horizontal_(horizontal), vertical_(vertical), num_threads_(num_threads) {
+  assert(horizontal.size() % 2 == 1);
+  assert(vertical.size() % 2 == 1);
+
+  select_weighted_sum();
+}
+
+CpuConvolution::CpuConvolution(const float *weights, int size, float bias,
+                               unsigned num_threads)
+    : kernel_(weights, weights + size * size),
+      kernel_size_(size),
+      bias_(bias),
+      num_threads_(num_threads) {
+  assert(size % 2 == 1);
+
+  select_weighted_sum();
+}
+
+void CpuConvolution::select_weighted_sum() {
+  if (num_threads_ == 0) num_threads_ = std::thread::hardware_concurrency();
+  if (num_threads_ == 0) num_threads_ = 1;
+
+  weighted_sum_ = weighted_sum_scalar;
+#ifdef FILTER_CPU_X86
+  if (o_convert_best_isa() == O_CONVERT_ISA_AVX2)
+    weighted_sum_ = weighted_sum_avx2;
+#endif
+#ifdef FILTER_CPU_NEON
+  weighted_sum_ = weighted_sum_neon;
+#endif
+}
+
+const char *CpuConvolution::isa_name() const {
+#ifdef FILTER_CPU_X86
+  if (weighted_sum_ == weighted_sum_avx2) return "avx2";
+#endif
+#ifdef FILTER_CPU_NEON
+  if (weighted_sum_ == weighted_sum_neon) return "neon";
+#endif
+  return "scalar";
+}
+
+void CpuConvolution::apply(const uint8_t *source, uint8_t *destination,
+                           int width, int height, int channels) const {
+  assert(channels == 3 || channels == 4);
+
+  if (kernel_size_ > 0) {
+    apply_kernel(source, destination, width, height, channels);
+    return;
+  }
+
+  const size_t row_stride = static_cast<size_t>(width) * channels;
+  std::vector<uint8_t> rows(row_stride * height);
+
+  // Along rows, the taps are the same row shifted by a pixel each, read from
+  // a copy padded with repeated edge pixels.
+  const int horizontal_radius = horizontal_.size() / 2;
+  parallel_rows(height, num_threads_, [&](int first, int last) {
+    std::vector<uint8_t> padded((width + 2 * horizontal_radius) * channels);
+    std::vector<const uint8_t *> taps(horizontal_.size());
+    for (size_t k = 0; k < taps.size(); ++k)
+      taps[k] = padded.data() + k * channels;
+
+    for (int y = first; y < last; ++y) {
+      const uint8_t *row = source + y * row_stride;
+      pad_row(row, padded.data(), width, channels, horizontal_radius);
+
+      uint8_t *out = rows.data() + y * row_stride;
+      weighted_sum_(out, taps.data(), horizontal_.data(), taps.size(),
+                    row_stride);
+      if (channels == 4) {
+        for (int x = 0; x < width; ++x) out[x * 4 + 3] = row[x * 4 + 3];
+      }
+    }
+  });
+
+  // Along columns, the taps are whole rows, clamped at the edges.
+  const int vertical_radius = vertical_.size() / 2;
+  parallel_rows(height, num_threads_, [&](int first, int last) {
+    std::vector<const uint8_t *> taps(vertical_.size());
+    for (int y = first; y < last; ++y) {
+      for (int k = 0; k < static_cast<int>(taps.size()); ++k) {
+        const int tap_y =
+            std::min(std::max(y + k - vertical_radius, 0), height - 1);
+        taps[k] = rows.data() + tap_y * row_stride;
+      }
+
+      uint8_t *out = destination + y * row_stride;
+      weighted_sum_(out, taps.data(), vertical_.data(), taps.size(),
+                    row_stride);
+      if (channels == 4) {
+        const uint8_t *center = taps[vertical_radius];
+        for (int x = 0; x < width; ++x) out[x * 4 + 3] = center[x * 4 + 3];
+      }
+    }
+  });
+}
+
+void CpuConvolution::apply_kernel(const uint8_t *source, uint8_t *destination,
+                                  int width, int height, int channels) const {
+  const int radius = kernel_size_ / 2;
+  const size_t row_stride = static_cast<size_t>(width) * channels;
+  const size_t padded_stride =
+      static_cast<size_t>(width + 2 * radius) * channels;
+
+  // Every tap reads a row of the image padded with repeated edge pixels, at
+  // its offset along x, and rows are clamped at the edges.
+  std::vector<uint8_t> padded(padded_stride * height);
+  parallel_rows(height, num_threads_, [&](int first, int last) {
+    for (int y = first; y < last; ++y)
+      pad_row(source + y * row_stride, padded.data() + y * padded_stride,
+              width, channels, radius);
+  });
+
+  // Zero weights are skipped, and the bias is one more tap, on a row of full
+  // scale bytes.
+  std::vector<float> weights;
+  std::vector<int> offsets_x;
+  std::vector<int> offsets_y;
+  for (int ky = 0; ky < kernel_size_; ++ky) {
+    for (int kx = 0; kx < kernel_size_; ++kx) {
+      const float weight = kernel_[ky * kernel_size_ + kx];
+      if (weight == 0) continue;
+
+      weights.push_back(weight);
+      offsets_x.push_back(kx);
+      offsets_y.push_back(ky - radius);
+    }
+  }
+  const std::vector<uint8_t> full_scale(bias_ != 0 ? row_stride : 0, 255);
+  if (bias_ != 0) weights.push_back(bias_);
+
+  parallel_rows(height, num_threads_, [&](int first, int last) {
+    std::vector<const uint8_t *> taps(weights.size(), full_scale.data());
+    for (int y = first; y < last; ++y) {
+      for (size_t k = 0; k < offsets_x.size(); ++k) {
+        const int tap_y = std::min(std::max(y + offsets_y[k], 0), height - 1);
+        taps[k] = padded.data() + tap_y * padded_stride +
+                  offsets_x[k] * channels;
+      }
+
+      uint8_t *out = destination + y * row_stride;
+      weighted_sum_(out, taps.data(), weights.data(), taps.size(),
+                    row_stride);
+      if (channels == 4) {
+        const uint8_t *row = source + y * row_stride;
+        for (int x = 0; x < width; ++x) out[x * 4 + 3] = row[x * 4 + 3];
+      }
+    }
+  });
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Runs the separable convolution of SeparableConvolution on the CPU, with
+// the same edge clamping and the same rounding of the intermediate image to
+// 8 bits, so it can stand in for the GPU and check its output. It also runs
+// the single-pass kernels of kernel_library.hpp in one pass. The taps are
+// summed with AVX2 or NEON where available, and bands of rows are filtered
+// on every core.
+class CpuConvolution {
+ public:
+  // Filters on @num_threads threads, one per online CPU if 0.
+  CpuConvolution(const std::vector<float> &horizontal,
+                 const std::vector<float> &vertical,
+                 unsigned num_threads = 0);
+
+  // Applies the @size x @size @weights, rows from top to bottom, in one pass
+  // and adds @bias, a fraction of full scale, to the sums.
+  CpuConvolution(const float *weights, int size, float bias,
+                 unsigned num_threads = 0);
+
+  // Filters top-down rows of 3 or 4 channels from @source into
+  // @destination. Alpha is passed through from the center tap.
+  void apply(const uint8_t *source, uint8_t *destination, int width,
+             int height, int channels) const;
+
+  const char *isa_name() const;
+
+ private:
+  // Writes the sum of @weights[k] times @sources[k][i] for every k to
+  // @destination[i], for the @size bytes from 0.
+  using WeightedSum = void (*)(uint8_t *destination,
+                               const uint8_t *const *sources,
+                               const float *weights, int num_taps,
+                               size_t size);
+
+  // Picks the widest weighted sum the CPU runs, and the number of threads.
+  void select_weighted_sum();
+
+  void apply_kernel(const uint8_t *source, uint8_t *destination, int width,
+                    int height, int channels) const;
+
+  std::vector<float> horizontal_;
+  std::vector<float> vertical_;
+  // The weights of a single-pass kernel, if any, and their bias.
+  std::vector<float> kernel_;
+  int kernel_size_ = 0;
+  float bias_ = 0;
+  unsigned num_threads_;
+  WeightedSum weighted_sum_;
+};
@@ -0,0 +1,181 @@
+#include "filter_graph.hpp"
+
+#include <cassert>
+#include <string>
+
+#include "gl_utils.hpp"
+
+TexturePool::~TexturePool() {
+  for (const Entry &entry : entries_) {
+    glDeleteFramebuffers(1, &entry.fbo);
+    glDeleteTextures(1, &entry.texture);
+  }
+}
+
+size_t TexturePool::acquire(int width, int height, GLenum format) {
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    Entry &entry = entries_[i];
+    if (!entry.in_use && entry.width == width && entry.height == height &&
+        entry.format == format) {
+      entry.in_use = true;
+      return i;
+    }
+  }
+
+  Entry entry = {width, height, format, 0, 0, true};
+  entry.texture = createAndSetupTexture();
+  glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format,
+               GL_UNSIGNED_BYTE, nullptr);
+  assert(glGetError() == GL_NO_ERROR);
+
+  glGenFramebuffers(1, &entry.fbo);
+  assert(glGetError() == GL_NO_ERROR);
+  glBindFramebuffer(GL_FRAMEBUFFER, entry.fbo);
+  assert(glGetError() == GL_NO_ERROR);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                         entry.texture, 0);
+  assert(glGetError() == GL_NO_ERROR);
+
+  num_bytes_ += static_cast<size_t>(width) * height *
+                (format == GL_RGBA ? 4 : format == GL_RGB ? 3 : 1);
+  entries_.push_back(entry);
+
+  return entries_.size() - 1;
+}
+
+void TexturePool::release(size_t index) {
+  assert(entries_[index].in_use);
+
+  entries_[index].in_use = false;
+}
+
+FilterGraph::~FilterGraph() { release_images(); }
+
+FilterImage FilterGraph::add_input(GLuint texture, int width, int height,
+                                   GLenum format) {
+  images_.push_back({width, height, format, texture, true, 0, false, NO_PASS});
+
+  return images_.size() - 1;
+}
+
+FilterImage FilterGraph::add_image(int width, int height, GLenum format) {
+  images_.push_back({width, height, format, 0, false, 0, false, NO_PASS});
+
+  return images_.size() - 1;
+}
+
+void FilterGraph::add_pass(GLuint program, std::vector<FilterImage> inputs,
+                           FilterImage output, FilterUniforms uniforms) {
+  assert(!inputs.empty());
+  assert(output < images_.size() && !images_[output].uploaded);
+  assert(images_[output].producer == NO_PASS);
+
+  // The pass flips uploaded inputs, so they can't be mixed with others.
+  for (FilterImage input : inputs) {
+    assert(input < images_.size());
+    assert(images_[input].uploaded == images_[inputs[0]].uploaded);
+  }
+
+  images_[output].producer = passes_.size();
+  passes_.push_back({program, std::move(inputs), output, std::move(uniforms)});
+}
+
+// Appends the passes @image depends on to @order, depth first, so that every
+// pass comes after those producing its inputs. Fails on cycles.
+bool FilterGraph::sort_passes(FilterImage image, std::vector<uint8_t> &state,
+                              std::vector<size_t> &order) const {
+  enum : uint8_t { UNVISITED, VISITING, DONE };
+
+  const size_t pass = images_[image].producer;
+  if (pass == NO_PASS || state[pass] == DONE) return true;
+  if (state[pass] == VISITING) return false;
+
+  state[pass] = VISITING;
+  for (FilterImage input : passes_[pass].inputs)
+    if (!sort_passes(input, state, order)) return false;
+  state[pass] = DONE;
+
+  order.push_back(pass);
+
+  return true;
+}
+
+void FilterGraph::release_images() {
+  for (Image &image : images_) {
+    if (!image.pooled) continue;
+
+    pool_.release(image.pool_index);
+    image.pooled = false;
+  }
+}
+
+GLuint FilterGraph::execute(FilterImage output) {
+  assert(output < images_.size() && !images_[output].uploaded);
+
+  // The output of the last run goes back to the pool.
+  release_images();
+
+  std::vector<uint8_t> state(passes_.size(), 0);
+  std::vector<size_t> order;
+  if (!sort_passes(output, state, order) || order.empty()) return 0;
+
+  // Each image goes back to the pool after the last pass reading it.
+  std::vector<size_t> last_reader(images_.size(), NO_PASS);
+  for (size_t step = 0; step < order.size(); ++step) {
+    for (FilterImage input : passes_[order[step]].inputs)
+      last_reader[input] = step;
+  }
+
+  // Every tap is written, so nothing must blend into the targets.
+  glDisable(GL_BLEND);
+
+  for (size_t step = 0; step < order.size(); ++step) {
+    const Pass &pass = passes_[order[step]];
+
+    Image &target = images_[pass.output];
+    target.pool_index =
+        pool_.acquire(target.width, target.height, target.format);
+    target.texture = pool_.texture(target.pool_index);
+    target.pooled = true;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, pool_.framebuffer(target.pool_index));
+    assert(glGetError() == GL_NO_ERROR);
+    glViewport(0, 0, target.width, target.height);
+
+    glUseProgram(pass.program);
+    assert(glGetError() == GL_NO_ERROR);
+
+    for (size_t i = 0; i < pass.inputs.size(); ++i) {
+      const std::string name = i == 0 ? "u_tex" : "u_tex" + std::to_string(i);
+      glUniform1i(glGetUniformLocation(pass.program, name.c_str()), i);
+
+      glActiveTexture(GL_TEXTURE0 + i);
+      glBindTexture(GL_TEXTURE_2D, images_[pass.inputs[i]].texture);
+      assert(glGetError() == GL_NO_ERROR);
+    }
+    glActiveTexture(GL_TEXTURE0);
+
+    // Rendered images have their first row at the top, at t = 1.
+    const Image &input = images_[pass.inputs[0]];
+    glUniform2f(glGetUniformLocation(pass.program, "u_textureSize"),
+                input.width, input.height);
+    glUniform2f(glGetUniformLocation(pass.program, "u_texel"),
+                1.0f / input.width,
+                (input.uploaded ? 1.0f : -1.0f) / input.height);
+    if (pass.uniforms) pass.uniforms(pass.program);
+    assert(glGetError() == GL_NO_ERROR);
+
+    gl_utils_draw_quad(input.uploaded);
+
+    for (FilterImage image : pass.inputs) {
+      if (last_reader[image] != step || !images_[image].pooled ||
+          image == output)
+        continue;
+
+      pool_.release(images_[image].pool_index);
+      images_[image].pooled = false;
+    }
+  }
+
+  return pool_.framebuffer(images_[output].pool_index);
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <GLES2/gl2.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Framebuffer textures, kept for reuse by images of the same size and format
+// once they are no longer needed.
+class TexturePool {
+ public:
+  TexturePool() = default;
+  ~TexturePool();
+
+  TexturePool(const TexturePool &) = delete;
+  TexturePool &operator=(const TexturePool &) = delete;
+
+  // Returns the index of a free texture, allocating it if there is none.
+  size_t acquire(int width, int height, GLenum format);
+  void release(size_t index);
+
+  GLuint texture(size_t index) const { return entries_[index].texture; }
+  GLuint framebuffer(size_t index) const { return entries_[index].fbo; }
+
+  // Every texture ever allocated is kept, so this is also the peak.
+  size_t num_textures() const { return entries_.size(); }
+  size_t num_bytes() const { return num_bytes_; }
+
+ private:
+  struct Entry {
+    int width;
+    int height;
+    GLenum format;
+
+    GLuint texture;
+    GLuint fbo;
+    bool in_use;
+  };
+
+  std::vector<Entry> entries_;
+  size_t num_bytes_ = 0;
+};
+
+// Identifies an image read or written by the passes of a graph.
+using FilterImage = size_t;
+
+// Sets the uniforms of a pass beyond those set by the graph.
+using FilterUniforms = std::function<void(GLuint program)>;
+
+class FilterGraph;
+
+// Adds the passes filtering @input to @graph and returns the image they
+// render.
+using FilterBuilder =
+    std::function<FilterImage(FilterGraph &graph, FilterImage input)>;
+
+// Runs fragment-shader passes declared by the images they read and write.
+// Only the passes the requested image depends on run, each after the passes
+// producing its inputs. Intermediate images get pooled textures when their
+// pass runs, which go back to the pool after their last reader ran, so a
+// chain of any length holds two of them at a time.
+//
+// Every pass draws the full-screen quad with the size of its output, with
+// its inputs bound to the samplers u_tex, u_tex1, u_tex2... For the first
+// input, u_textureSize is its size and u_texel steps one pixel right and one
+// pixel down.
+class FilterGraph {
+ public:
+  explicit FilterGraph(TexturePool &pool) : pool_(pool) {}
+  ~FilterGraph();
+
+  FilterGraph(const FilterGraph &) = delete;
+  FilterGraph &operator=(const FilterGraph &) = delete;
+
+  // An image uploaded by the caller, with its first row at t = 0.
+  FilterImage add_input(GLuint texture, int width, int height, GLenum format);
+
+  // An image rendered by one of the passes.
+  FilterImage add_image(int width, int height, GLenum format);
+
+  void add_pass(GLuint program, std::vector<FilterImage> inputs,
+                FilterImage output, FilterUniforms uniforms = nullptr);
+
+  // Renders @output, returning the framebuffer holding it, or 0 if it depends
+  // on itself. The framebuffer is valid until the next execute() call.
+  GLuint execute(FilterImage output);
+
+  int width(FilterImage image) const { return images_[image].width; }
+  int height(FilterImage image) const { return images_[image].height; }
+  GLenum format(FilterImage image) const { return images_[image].format; }
+
+  size_t num_passes() const { return passes_.size(); }
+
+ private:
+  struct Image {
+    int width;
+    int height;
+    GLenum format;
+
+    // The texture of inputs, and of rendered images while pooled.
+    GLuint texture;
+    bool uploaded;
+    size_t pool_index;
+    bool pooled;
+
+    // The pass rendering the image, if any.
+    size_t producer;
+  };
+
+  struct Pass {
+    GLuint program;
+    std::vector<FilterImage> inputs;
+    FilterImage output;
+    FilterUniforms uniforms;
+  };
+
+  static constexpr size_t NO_PASS = static_cast<size_t>(-1);
+
+  bool sort_passes(FilterImage image, std::vector<uint8_t> &state,
+                   std::vector<size_t> &order) const;
+  void release_images();
+
+  TexturePool &pool_;
+  std::vector<Image> images_;
+  std::vector<Pass> passes_;
+};
@@ -0,0 +1,161 @@
+#include "gl_context.hpp"
+
+#include <EGL/eglext.h>
+#include <GLFW/glfw3.h>
+
+#include <chrono>
+#include <cstring>
+
+namespace {
+
+bool has_extension(const char *extensions, const char *name) {
+  if (extensions == nullptr) return false;
+
+  const size_t length = strlen(name);
+  for (const char *found = strstr(extensions, name); found != nullptr;
+       found = strstr(found + length, name)) {
+    const bool starts = found == extensions || found[-1] == ' ';
+    const bool ends = found[length] == ' ' || found[length] == '\0';
+    if (starts && ends) return true;
+  }
+
+  return false;
+}
+
+}  // namespace
+
+bool parse_context_backend(const std::string &name, ContextBackend &backend) {
+  if (name == "glfw")
+    backend = ContextBackend::GLFW_WINDOW;
+  else if (name == "egl")
+    backend = ContextBackend::EGL_HEADLESS;
+  else
+    return false;
+
+  return true;
+}
+
+const char *context_backend_name(ContextBackend backend) {
+  return backend == ContextBackend::GLFW_WINDOW ? "glfw" : "egl";
+}
+
+std::unique_ptr<GlContext> GlContext::create(ContextBackend backend,
+                                             int width, int height, int major,
+                                             int minor) {
+  const auto start = std::chrono::steady_clock::now();
+
+  std::unique_ptr<GlContext> context(new GlContext(backend));
+  const bool created =
+      backend == ContextBackend::GLFW_WINDOW
+          ? context->create_glfw_window(width, height, major, minor)
+          : context->create_egl_context(major, minor);
+  if (!created) return nullptr;
+
+  const std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  context->creation_ms_ = elapsed.count();
+
+  return context;
+}
+
+GlContext::~GlContext() {
+  if (window_ != nullptr) {
+    glfwDestroyWindow(window_);
+    glfwTerminate();
+  }
+
+  if (display_ != EGL_NO_DISPLAY) {
+    eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (surface_ != EGL_NO_SURFACE) eglDestroySurface(display_, surface_);
+    if (context_ != EGL_NO_CONTEXT) eglDestroyContext(display_, context_);
+    eglTerminate(display_);
+  }
+}
+
+bool GlContext::create_glfw_window(int width, int height, int major,
+                                   int minor) {
+  // Initialize GLFW.
+  if (!glfwInit()) return false;
+
+  // Select an OpenGL-ES profile.
+  glfwWindowHint(GLFW_CLIENT_API, GLFW_OPENGL_ES_API);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, major);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, minor);
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+  // Create a windowed mode window and its OpenGL context
+  window_ = glfwCreateWindow(width, height, "GL Image Loader", NULL, NULL);
+  if (window_ == NULL) {
+    glfwTerminate();
+    return false;
+  }
+
+  // Make the window's context current
+  glfwMakeContextCurrent(window_);
+
+  return true;
+}
+
+bool GlContext::create_egl_context(int major, int minor) {
+  // Mesa's surfaceless platform needs neither a display server nor a GPU
+  // device, and renders with llvmpipe when there is none.
+  const auto get_platform_display =
+      reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+          eglGetProcAddress("eglGetPlatformDisplayEXT"));
+  if (get_platform_display != nullptr &&
+      has_extension(eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS),
+                    "EGL_MESA_platform_surfaceless"))
+    display_ = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                    EGL_DEFAULT_DISPLAY, nullptr);
+  if (display_ == EGL_NO_DISPLAY) display_ = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  if (display_ == EGL_NO_DISPLAY) return false;
+
+  if (!eglInitialize(display_, nullptr, nullptr) ||
+      !eglBindAPI(EGL_OPENGL_ES_API))
+    return false;
+
+  const EGLint config_attributes[] = {
+      EGL_SURFACE_TYPE,
+      EGL_PBUFFER_BIT,
+      EGL_RENDERABLE_TYPE,
+      major >= 3 ? EGL_OPENGL_ES3_BIT_KHR : EGL_OPENGL_ES2_BIT,
+      EGL_RED_SIZE,
+      8,
+      EGL_GREEN_SIZE,
+      8,
+      EGL_BLUE_SIZE,
+      8,
+      EGL_ALPHA_SIZE,
+      8,
+      EGL_NONE,
+  };
+  EGLConfig config;
+  EGLint num_configs = 0;
+  if (!eglChooseConfig(display_, config_attributes, &config, 1,
+                       &num_configs) ||
+      num_configs == 0)
+    return false;
+
+  const EGLint context_attributes[] = {
+      EGL_CONTEXT_MAJOR_VERSION_KHR,
+      major,
+      EGL_CONTEXT_MINOR_VERSION_KHR,
+      minor,
+      EGL_NONE,
+  };
+  context_ =
+      eglCreateContext(display_, config, EGL_NO_CONTEXT, context_attributes);
+  if (context_ == EGL_NO_CONTEXT) return false;
+
+  // Everything renders into framebuffer objects, so a context without a
+  // surface will do. Otherwise a 1x1 pbuffer stands in for one.
+  if (!has_extension(eglQueryString(display_, EGL_EXTENSIONS),
+                     "EGL_KHR_surfaceless_context")) {
+    const EGLint pbuffer_attributes[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1,
+                                         EGL_NONE};
+    surface_ = eglCreatePbufferSurface(display_, config, pbuffer_attributes);
+    if (surface_ == EGL_NO_SURFACE) return false;
+  }
+
+  return eglMakeCurrent(display_, surface_, surface_, context_);
+}
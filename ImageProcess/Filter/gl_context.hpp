@@ -0,0 +1,58 @@
+#pragma once
+
+#include <EGL/egl.h>
+
+#include <memory>
+#include <string>
+
+struct GLFWwindow;
+
+// Where the OpenGL ES context comes from. Filter renders only into
+// framebuffer objects, so it needs no window surface either way.
+enum class ContextBackend {
+  // A hidden GLFW window, which needs a display server.
+  GLFW_WINDOW,
+  // An EGL context on Mesa's surfaceless platform, or on the default display
+  // with a pbuffer if that platform is missing. Runs in containers with
+  // llvmpipe.
+  EGL_HEADLESS,
+};
+
+// Parses "glfw" or "egl" into @backend.
+bool parse_context_backend(const std::string &name, ContextBackend &backend);
+
+const char *context_backend_name(ContextBackend backend);
+
+// An OpenGL ES context, current on the thread that created it until it is
+// destroyed.
+class GlContext {
+ public:
+  // Returns nullptr if the context can't be created. @width and @height size
+  // the hidden window of GLFW_WINDOW.
+  static std::unique_ptr<GlContext> create(ContextBackend backend, int width,
+                                           int height, int major, int minor);
+  ~GlContext();
+
+  GlContext(const GlContext &) = delete;
+  GlContext &operator=(const GlContext &) = delete;
+
+  ContextBackend backend() const { return backend_; }
+
+  // Milliseconds from the start of create() until the context was current.
+  double creation_ms() const { return creation_ms_; }
+
+ private:
+  explicit GlContext(ContextBackend backend) : backend_(backend) {}
+
+  bool create_glfw_window(int width, int height, int major, int minor);
+  bool create_egl_context(int major, int minor);
+
+  ContextBackend backend_;
+  double creation_ms_ = 0;
+
+  GLFWwindow *window_ = nullptr;
+
+  EGLDisplay display_ = EGL_NO_DISPLAY;
+  EGLContext context_ = EGL_NO_CONTEXT;
+  EGLSurface surface_ = EGL_NO_SURFACE;
+};
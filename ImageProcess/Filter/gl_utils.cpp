@@ -0,0 +1,158 @@
+#include "gl_utils.hpp"
+
+#include <GLES3/gl31.h>
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+bool gl_utils_print_shader_log(GLuint shader) {
+  GLint length;
+  char buffer[4096] = {0};
+  GLint success;
+
+  glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+  if (length == 0) return true;
+
+  glGetShaderInfoLog(shader, sizeof(buffer), NULL, buffer);
+  if (strlen(buffer) > 0) printf("Shader compilation log: %s\n", buffer);
+
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+
+  return success == GL_TRUE;
+}
+
+GLuint gl_utils_load_shader(const char *shader_source, GLenum type) {
+  GLuint shader = glCreateShader(type);
+
+  glShaderSource(shader, 1, &shader_source, NULL);
+  assert(glGetError() == GL_NO_ERROR);
+  glCompileShader(shader);
+  assert(glGetError() == GL_NO_ERROR);
+
+  gl_utils_print_shader_log(shader);
+
+  return shader;
+}
+
+GLuint gl_utils_create_program(const char *fragment_source) {
+  constexpr char VERTEX_SOURCE[] =
+      "attribute vec2 pos;\n"
+      "attribute vec2 texture;\n"
+      "varying vec2 v_texture;\n"
+      "void main() {\n"
+      "  v_texture = texture;\n"
+      "  gl_Position = vec4(pos, 0, 1);\n"
+      "}\n";
+
+  GLuint vertex_shader = gl_utils_load_shader(VERTEX_SOURCE, GL_VERTEX_SHADER);
+  assert(vertex_shader >= 0);
+  assert(glGetError() == GL_NO_ERROR);
+
+  GLuint fragment_shader =
+      gl_utils_load_shader(fragment_source, GL_FRAGMENT_SHADER);
+  assert(fragment_shader >= 0);
+  assert(glGetError() == GL_NO_ERROR);
+
+  GLuint program = glCreateProgram();
+  assert(glGetError() == GL_NO_ERROR);
+  glAttachShader(program, vertex_shader);
+  assert(glGetError() == GL_NO_ERROR);
+  glAttachShader(program, fragment_shader);
+  assert(glGetError() == GL_NO_ERROR);
+
+  glBindAttribLocation(program, 0, "pos");
+  glBindAttribLocation(program, 1, "texture");
+
+  glLinkProgram(program);
+  assert(glGetError() == GL_NO_ERROR);
+
+  glDeleteShader(vertex_shader);
+  glDeleteShader(fragment_shader);
+
+  return program;
+}
+
+GLuint gl_utils_create_compute_program(const std::string &source) {
+  GLuint shader = gl_utils_load_shader(source.c_str(), GL_COMPUTE_SHADER);
+  assert(glGetError() == GL_NO_ERROR);
+
+  GLuint program = glCreateProgram();
+  assert(glGetError() == GL_NO_ERROR);
+  glAttachShader(program, shader);
+  assert(glGetError() == GL_NO_ERROR);
+
+  glLinkProgram(program);
+  assert(glGetError() == GL_NO_ERROR);
+
+  glDeleteShader(shader);
+
+  return program;
+}
+
+void gl_utils_draw_quad(bool flip_y) {
+  constexpr GLfloat s_vertices[4][2] = {
+      {-1.0, 1.0},
+      {1.0, 1.0},
+      {-1.0, -1.0},
+      {1.0, -1.0},
+  };
+
+  constexpr GLfloat s_texturePos[2][4][2] = {
+      {
+          {0, 1},
+          {1, 1},
+          {0, 0},
+          {1, 0},
+      },
+      {
+          {0, 0},
+          {1, 0},
+          {0, 1},
+          {1, 1},
+      },
+  };
+
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, s_vertices);
+  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, s_texturePos[flip_y]);
+
+  glEnableVertexAttribArray(0);
+  glEnableVertexAttribArray(1);
+
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  assert(glGetError() == GL_NO_ERROR);
+
+  glDisableVertexAttribArray(0);
+  glDisableVertexAttribArray(1);
+}
+
+GLuint createAndSetupTexture() {
+  GLuint texture;
+  glGenTextures(1, &texture);
+  assert(glGetError() == GL_NO_ERROR);
+  assert(texture > 0);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  assert(glGetError() == GL_NO_ERROR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+  return texture;
+}
+
+bool gl_utils_has_pixel_buffers() {
+  const char *version = reinterpret_cast<const char *>(glGetString(GL_VERSION));
+  int major = 0;
+  return version != nullptr && sscanf(version, "OpenGL ES %d", &major) == 1 &&
+         major >= 3;
+}
+
+std::string gl_utils_float_literal(float value) {
+  char literal[32];
+  snprintf(literal, sizeof(literal), "%.9g", value);
+
+  if (strpbrk(literal, ".e") == nullptr) strcat(literal, ".0");
+
+  return literal;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <GLES2/gl2.h>
+
+#include <string>
+
+bool gl_utils_print_shader_log(GLuint shader);
+
+GLuint gl_utils_load_shader(const char *shader_source, GLenum type);
+
+// Links the fragment shader with the full-screen quad vertex shader, which
+// takes the positions at attribute 0 and the texture coordinates at 1.
+GLuint gl_utils_create_program(const char *fragment_source);
+
+// Links a compute shader on its own. Needs OpenGL ES 3.1.
+GLuint gl_utils_create_compute_program(const std::string &source);
+
+// Draws the full-screen quad. Uploaded images have their first row at t = 0,
+// so the pass reading them flips it to put that row at the top of the
+// framebuffer; passes reading rendered textures keep it there.
+void gl_utils_draw_quad(bool flip_y);
+
+GLuint createAndSetupTexture();
+
+// Whether the current context is OpenGL ES 3.0 or later, which has pixel
+// pack and unpack buffers.
+bool gl_utils_has_pixel_buffers();
+
+// Formats @value as a GLSL float constant, which needs a decimal point or an
+// exponent to not be taken for an int.
+std::string gl_utils_float_literal(float value);
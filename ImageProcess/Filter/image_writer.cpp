@@ -0,0 +1,92 @@
+#include "image_writer.hpp"
+
+#include <cassert>
+#include <vector>
+
+#include "../BasicC/png.h"
+#include "../BasicC/qoi.h"
+
+// Passes the bottom-up rows of @pixels to @write top to bottom, without
+// their alpha if @channels is 3 and @pixel_channels 4. Stops at the first
+// row @write fails.
+template <typename Write>
+static void write_rows(int width, int height, int channels,
+                       const uint8_t *pixels, int pixel_channels,
+                       Write write) {
+  assert(pixel_channels == channels || (channels == 3 && pixel_channels == 4));
+
+  const size_t row_stride = static_cast<size_t>(width) * channels;
+  const size_t pixel_stride = static_cast<size_t>(width) * pixel_channels;
+  std::vector<uint8_t> packed(pixel_channels == channels ? 0 : row_stride);
+  for (int y = height - 1; y >= 0; --y) {
+    const uint8_t *row = pixels + y * pixel_stride;
+    if (!packed.empty()) {
+      for (int x = 0; x < width; ++x) {
+        packed[x * 3] = row[x * 4];
+        packed[x * 3 + 1] = row[x * 4 + 1];
+        packed[x * 3 + 2] = row[x * 4 + 2];
+      }
+      row = packed.data();
+    }
+
+    if (write(row, row_stride) < 0) break;
+  }
+}
+
+// Streams the rows, bottom-up, into a PNG encoder that deflates bands of
+// rows on every core.
+static bool write_png_image(const std::string &filename, int width,
+                            int height, int channels, const uint8_t *pixels,
+                            int pixel_channels) {
+  png_ctx png;
+  if (!png_encoder_init_to_filename(&png, filename.c_str(), width, height,
+                                    channels, -1, PNG_FILTER_STRATEGY_ADAPTIVE,
+                                    0))
+    return false;
+
+  write_rows(width, height, channels, pixels, pixel_channels,
+             [&](const uint8_t *row, size_t size) {
+               return png_write(&png, row, size);
+             });
+
+  const bool ok = png.status == PNG_STATUS_DONE;
+  png_clear(&png);
+
+  return ok;
+}
+
+// Streams the rows, bottom-up, straight into a QOI encoder.
+static bool write_qoi_image(const std::string &filename, int width,
+                            int height, int channels, const uint8_t *pixels,
+                            int pixel_channels) {
+  qoi_ctx qoi;
+  if (!qoi_encoder_init_to_filename(&qoi, filename.c_str(), width, height,
+                                    channels))
+    return false;
+
+  write_rows(width, height, channels, pixels, pixel_channels,
+             [&](const uint8_t *row, size_t size) {
+               return qoi_write(&qoi, row, size);
+             });
+
+  const bool ok = qoi.status == QOI_STATUS_DONE;
+  qoi_clear(&qoi);
+
+  return ok;
+}
+
+bool write_image_file(const std::string &filename, int width, int height,
+                      int channels, const uint8_t *pixels,
+                      int pixel_channels) {
+  if (pixel_channels == 0) pixel_channels = channels;
+
+  const std::string qoi_extension = ".qoi";
+  if (filename.size() >= qoi_extension.size() &&
+      filename.compare(filename.size() - qoi_extension.size(),
+                       qoi_extension.size(), qoi_extension) == 0)
+    return write_qoi_image(filename, width, height, channels, pixels,
+                           pixel_channels);
+
+  return write_png_image(filename, width, height, channels, pixels,
+                         pixel_channels);
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Writes 3 or 4 channel rows, stored bottom-up as glReadPixels() returns
+// them, to a QOI file if @filename ends in .qoi and to a PNG file otherwise.
+// @pixels has @pixel_channels per pixel if given, which may be 4 for a 3
+// channel file to drop the alpha while streaming the rows out.
+bool write_image_file(const std::string &filename, int width, int height,
+                      int channels, const uint8_t *pixels,
+                      int pixel_channels = 0);
@@ -0,0 +1,284 @@
+#pragma once
+
+#include <cstddef>
+
+// Convolution kernels, and the GLSL applying them in one fragment pass, all
+// computed at compile time so the shaders are string constants in the
+// binary.
+//
+// Rows of a kernel that are symmetric with positive weights are applied
+// with linear filtering: two adjacent taps of weights a and b are one fetch
+// at b / (a + b) of the way between them, weighted a + b. A row of 2r + 1
+// taps then costs 1 + 2 * ceil(r / 2) fetches. Clamping to the edge keeps
+// this exact at the borders, where both taps clamp to the same texel.
+
+// A kernel of WIDTH x HEIGHT weights, applied centered on each pixel from
+// left to right and from top to bottom. The bias is added to the sum, so
+// signed responses such as edges show around mid-grey.
+template <int WIDTH, int HEIGHT>
+struct Kernel {
+  static_assert(WIDTH % 2 == 1 && HEIGHT % 2 == 1, "kernels have a center");
+
+  float weights[HEIGHT][WIDTH];
+  float bias;
+};
+
+constexpr Kernel<3, 3> SHARPEN_KERNEL = {
+    {{0, -1, 0}, {-1, 5, -1}, {0, -1, 0}}, 0};
+
+constexpr Kernel<3, 3> LAPLACIAN_KERNEL = {
+    {{0, 1, 0}, {1, -4, 1}, {0, 1, 0}}, 0.5f};
+
+// Horizontal and vertical gradients.
+constexpr Kernel<3, 3> SOBEL_X_KERNEL = {
+    {{-1, 0, 1}, {-2, 0, 2}, {-1, 0, 1}}, 0.5f};
+constexpr Kernel<3, 3> SOBEL_Y_KERNEL = {
+    {{-1, -2, -1}, {0, 0, 0}, {1, 2, 1}}, 0.5f};
+
+// e^x, to the precision of a double, for the Gaussian weights: std::exp()
+// isn't constexpr. The argument is halved into [-0.5, 0.5], where the Taylor
+// series converges fast, and the sum squared back.
+constexpr double kernel_exp(double x) {
+  int halvings = 0;
+  while (x < -0.5 || x > 0.5) {
+    x /= 2;
+    ++halvings;
+  }
+
+  double term = 1;
+  double sum = 1;
+  for (int n = 1; n < 20; ++n) {
+    term *= x / n;
+    sum += term;
+  }
+
+  for (; halvings > 0; --halvings) sum *= sum;
+
+  return sum;
+}
+
+template <int RADIUS>
+constexpr Kernel<2 * RADIUS + 1, 2 * RADIUS + 1> box_kernel() {
+  constexpr int SIZE = 2 * RADIUS + 1;
+
+  Kernel<SIZE, SIZE> kernel = {};
+  for (int y = 0; y < SIZE; ++y) {
+    for (int x = 0; x < SIZE; ++x) kernel.weights[y][x] = 1.0f / (SIZE * SIZE);
+  }
+
+  return kernel;
+}
+
+template <int RADIUS>
+constexpr Kernel<2 * RADIUS + 1, 2 * RADIUS + 1> gaussian_kernel(
+    float sigma) {
+  constexpr int SIZE = 2 * RADIUS + 1;
+
+  double weights[SIZE] = {};
+  double sum = 0;
+  for (int i = -RADIUS; i <= RADIUS; ++i) {
+    weights[i + RADIUS] = kernel_exp(-0.5 * i * i / (sigma * sigma));
+    sum += weights[i + RADIUS];
+  }
+
+  Kernel<SIZE, SIZE> kernel = {};
+  for (int y = 0; y < SIZE; ++y) {
+    for (int x = 0; x < SIZE; ++x)
+      kernel.weights[y][x] = weights[y] * weights[x] / (sum * sum);
+  }
+
+  return kernel;
+}
+
+// Sharpens by adding @amount times the difference between the image and its
+// Gaussian blur.
+template <int RADIUS>
+constexpr Kernel<2 * RADIUS + 1, 2 * RADIUS + 1> unsharp_mask_kernel(
+    float sigma, float amount) {
+  Kernel<2 * RADIUS + 1, 2 * RADIUS + 1> kernel =
+      gaussian_kernel<RADIUS>(sigma);
+  for (auto &row : kernel.weights) {
+    for (float &weight : row) weight *= -amount;
+  }
+  kernel.weights[RADIUS][RADIUS] += 1 + amount;
+
+  return kernel;
+}
+
+// Merges the @size weights of a row centered on 0 into fetches at
+// @offsets with @merged weights, and returns how many there are. Pairs of
+// taps are merged outwards from the center, which stays a fetch of its own,
+// if the row is symmetric with positive weights; otherwise every non-zero
+// weight is a fetch. Runs at compile time or at run time.
+constexpr int bilinear_taps(const float *weights, int size, float *offsets,
+                            float *merged) {
+  const int radius = size / 2;
+
+  bool mergeable = true;
+  for (int i = 0; i < size; ++i) {
+    if (weights[i] <= 0 || weights[i] != weights[size - 1 - i])
+      mergeable = false;
+  }
+
+  int count = 0;
+  if (!mergeable) {
+    for (int i = 0; i < size; ++i) {
+      if (weights[i] == 0) continue;
+
+      offsets[count] = i - radius;
+      merged[count++] = weights[i];
+    }
+    return count;
+  }
+
+  for (int i = -radius; i <= radius;) {
+    // The center, and the outermost tap of an odd number on each side,
+    // are fetched alone.
+    const bool single =
+        i == 0 || (radius % 2 == 1 && (i == -radius || i == radius));
+    if (single) {
+      offsets[count] = i;
+      merged[count++] = weights[i + radius];
+      ++i;
+      continue;
+    }
+
+    const float a = weights[i + radius];
+    const float b = weights[i + 1 + radius];
+    offsets[count] = i + b / (a + b);
+    merged[count++] = a + b;
+    i += 2;
+  }
+
+  return count;
+}
+
+// Builds a string in constant expressions.
+template <size_t CAPACITY>
+class GlslSource {
+ public:
+  constexpr const char *c_str() const { return data_; }
+  constexpr size_t size() const { return size_; }
+
+  constexpr void append(const char *text) {
+    while (*text != '\0') data_[size_++] = *text++;
+    data_[size_] = '\0';
+  }
+
+  constexpr void append(int value) {
+    if (value < 0) {
+      append("-");
+      value = -value;
+    }
+
+    char digits[12] = {};
+    int count = 0;
+    do {
+      digits[count++] = '0' + value % 10;
+      value /= 10;
+    } while (value > 0);
+
+    while (count > 0) data_[size_++] = digits[--count];
+    data_[size_] = '\0';
+  }
+
+  // Nine significant digits, in scientific notation, which round-trip a
+  // float and always read as a GLSL float.
+  constexpr void append(float value) {
+    double magnitude = value < 0 ? -value : value;
+    if (value < 0) append("-");
+    if (magnitude == 0) {
+      append("0.0");
+      return;
+    }
+
+    int exponent = 0;
+    while (magnitude >= 10) {
+      magnitude /= 10;
+      ++exponent;
+    }
+    while (magnitude < 1) {
+      magnitude *= 10;
+      --exponent;
+    }
+
+    long long digits = static_cast<long long>(magnitude * 1e8 + 0.5);
+    if (digits >= 1000000000) {
+      digits /= 10;
+      ++exponent;
+    }
+
+    char mantissa[11] = {};
+    for (int i = 9; i >= 0; --i) {
+      if (i == 1) continue;
+      mantissa[i] = '0' + digits % 10;
+      digits /= 10;
+    }
+    mantissa[1] = '.';
+
+    append(mantissa);
+    append("e");
+    append(exponent);
+  }
+
+ private:
+  char data_[CAPACITY] = {};
+  size_t size_ = 0;
+};
+
+// The fragment shader applying @kernel, for the quad of
+// gl_utils_create_program(). Alpha is passed through from the center.
+template <int WIDTH, int HEIGHT>
+constexpr GlslSource<1024 + 160 * WIDTH * HEIGHT> kernel_fragment_source(
+    const Kernel<WIDTH, HEIGHT> &kernel) {
+  GlslSource<1024 + 160 * WIDTH * HEIGHT> source;
+  source.append(
+      "#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+      "precision highp float;\n"
+      "#else\n"
+      "precision mediump float;\n"
+      "#endif\n"
+      "uniform sampler2D u_tex;\n"
+      "uniform vec2 u_texel;\n"
+      "varying vec2 v_texture;\n"
+      "void main() {\n"
+      "  vec4 center = texture2D(u_tex, v_texture);\n"
+      "  vec3 sum = vec3(");
+  source.append(kernel.bias);
+  source.append(");\n");
+
+  // A single column is merged along y, and anything wider along its rows.
+  const bool column = WIDTH == 1;
+  const int num_lines = column ? 1 : HEIGHT;
+  for (int line = 0; line < num_lines; ++line) {
+    float weights[HEIGHT > WIDTH ? HEIGHT : WIDTH] = {};
+    const int size = column ? HEIGHT : WIDTH;
+    for (int i = 0; i < size; ++i)
+      weights[i] = column ? kernel.weights[i][0] : kernel.weights[line][i];
+
+    float offsets[HEIGHT > WIDTH ? HEIGHT : WIDTH] = {};
+    float merged[HEIGHT > WIDTH ? HEIGHT : WIDTH] = {};
+    const int count = bilinear_taps(weights, size, offsets, merged);
+    for (int tap = 0; tap < count; ++tap) {
+      const float x = column ? 0 : offsets[tap];
+      const float y = column ? offsets[tap] : line - HEIGHT / 2;
+      if (x == 0 && y == 0) {
+        source.append("  sum += center.rgb * ");
+      } else {
+        source.append("  sum += texture2D(u_tex, v_texture + u_texel * vec2(");
+        source.append(x);
+        source.append(", ");
+        source.append(y);
+        source.append(")).rgb * ");
+      }
+      source.append(merged[tap]);
+      source.append(";\n");
+    }
+  }
+
+  source.append(
+      "  gl_FragColor = vec4(sum, center.a);\n"
+      "}\n");
+
+  return source;
+}
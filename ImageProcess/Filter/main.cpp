@@ -2,176 +2,358 @@
 // https://webglfundamentals.org/webgl/lessons/webgl-image-processing-continued.html
 
 #include <GLES2/gl2.h>
-#include <GLFW/glfw3.h>
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <memory>
 #include <png++/png.hpp>
 #include <string>
 #include <vector>
 
-bool gl_utils_print_shader_log(GLuint shader) {
-  GLint length;
-  char buffer[4096] = {0};
-  GLint success;
-
-  glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
-  if (length == 0) return true;
-
-  glGetShaderInfoLog(shader, sizeof(buffer), NULL, buffer);
-  if (strlen(buffer) > 0) printf("Shader compilation log: %s\n", buffer);
-
-  glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+#include "batch.hpp"
+#include "benchmark.hpp"
+#include "compute_convolution.hpp"
+#include "convolution.hpp"
+#include "cpu_convolution.hpp"
+#include "filter_graph.hpp"
+#include "gl_context.hpp"
+#include "gl_utils.hpp"
+#include "image_writer.hpp"
+#include "kernel_library.hpp"
+#include "pixel_readback.hpp"
+#include "summed_area_blur.hpp"
+#include "tiled_filter.hpp"
+
+// The kernels applied in a single fragment pass, with their shaders generated
+// at compile time. The 3x3 box blur is the default filter.
+constexpr Kernel<3, 3> BOX_3X3 = box_kernel<1>();
+constexpr Kernel<5, 5> UNSHARP_MASK = unsharp_mask_kernel<2>(1.0f, 1.0f);
+
+constexpr auto BOX_3X3_SOURCE = kernel_fragment_source(BOX_3X3);
+constexpr auto SHARPEN_SOURCE = kernel_fragment_source(SHARPEN_KERNEL);
+constexpr auto UNSHARP_MASK_SOURCE = kernel_fragment_source(UNSHARP_MASK);
+constexpr auto LAPLACIAN_SOURCE = kernel_fragment_source(LAPLACIAN_KERNEL);
+constexpr auto SOBEL_X_SOURCE = kernel_fragment_source(SOBEL_X_KERNEL);
+constexpr auto SOBEL_Y_SOURCE = kernel_fragment_source(SOBEL_Y_KERNEL);
+
+// The weights of a kernel, 2 * radius + 1 to a side, are kept for the CPU
+// backend.
+struct SinglePassKernel {
+  const char *name;
+  const char *source;
+  int radius;
+  const float *weights;
+  float bias;
+};
+
+constexpr SinglePassKernel SINGLE_PASS_KERNELS[] = {
+    {"box3x3", BOX_3X3_SOURCE.c_str(), 1, BOX_3X3.weights[0], BOX_3X3.bias},
+    {"sharpen", SHARPEN_SOURCE.c_str(), 1, SHARPEN_KERNEL.weights[0],
+     SHARPEN_KERNEL.bias},
+    {"unsharp", UNSHARP_MASK_SOURCE.c_str(), 2, UNSHARP_MASK.weights[0],
+     UNSHARP_MASK.bias},
+    {"laplacian", LAPLACIAN_SOURCE.c_str(), 1, LAPLACIAN_KERNEL.weights[0],
+     LAPLACIAN_KERNEL.bias},
+    {"sobel-x", SOBEL_X_SOURCE.c_str(), 1, SOBEL_X_KERNEL.weights[0],
+     SOBEL_X_KERNEL.bias},
+    {"sobel-y", SOBEL_Y_SOURCE.c_str(), 1, SOBEL_Y_KERNEL.weights[0],
+     SOBEL_Y_KERNEL.bias},
+};
+constexpr const SinglePassKernel *BOX_3X3_KERNEL = &SINGLE_PASS_KERNELS[0];
+
+// Large images are filtered in tiles of this size by default, or smaller
+// ones where the context can't take this size with the halos around it.
+constexpr int DEFAULT_TILE_SIZE = 2048;
+
+// Returns the single-pass kernel @name, or nullptr.
+const SinglePassKernel *find_single_pass_kernel(const std::string &name) {
+  for (const SinglePassKernel &kernel : SINGLE_PASS_KERNELS) {
+    if (name == kernel.name) return &kernel;
+  }
 
-  return success == GL_TRUE;
+  return nullptr;
 }
 
-GLuint gl_utils_load_shader(const char *shader_source, GLenum type) {
-  GLuint shader = glCreateShader(type);
+// Reads the framebuffer back as RGB, bottom row first. OpenGL ES only
+// promises RGBA reads, so the alpha is dropped here.
+std::vector<uint8_t> read_pixels(int width, int height) {
+  std::vector<uint8_t> pixels(width * height * 4);
 
-  glShaderSource(shader, 1, &shader_source, NULL);
-  assert(glGetError() == GL_NO_ERROR);
-  glCompileShader(shader);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
   assert(glGetError() == GL_NO_ERROR);
 
-  gl_utils_print_shader_log(shader);
+  for (size_t i = 0; i < pixels.size() / 4; ++i)
+    memmove(&pixels[i * 3], &pixels[i * 4], 3);
+  pixels.resize(pixels.size() / 4 * 3);
 
-  return shader;
+  return pixels;
 }
 
-GLuint create_shader_program() {
-  constexpr char VERTEX_SOURCE[] =
-      "attribute vec2 pos;\n"
-      "attribute vec2 texture;\n"
-      "varying vec2 v_texture;\n"
-      "void main() {\n"
-      "  v_texture = texture;\n"
-      "  gl_Position = vec4(pos, 0, 1);\n"
-      "}\n";
-
-  constexpr char FRAGMENT_SOURCE[] =
-      "precision mediump float;\n"
-      "uniform sampler2D u_tex;\n"
-      "uniform vec2 u_textureSize;\n"
-      "varying vec2 v_texture;\n"
-      "void main() {\n"
-      "  vec2 onePixel = vec2(1.0, 1.0) / u_textureSize;\n"
-      "  float wt = 1.0/9.0;\n"
-      "     vec4 colorSum =\n"
-      "         texture2D(u_tex, v_texture + onePixel * vec2(-1, -1)) * wt +\n"
-      "         texture2D(u_tex, v_texture + onePixel * vec2( 0, -1)) * wt +\n"
-      "         texture2D(u_tex, v_texture + onePixel * vec2( 1, -1)) * wt +\n"
-      "         texture2D(u_tex, v_texture + onePixel * vec2(-1,  0)) * wt +\n"
-      "         texture2D(u_tex, v_texture + onePixel * vec2( 0,  0)) * wt +\n"
-      "         texture2D(u_tex, v_texture + onePixel * vec2( 1,  0)) * wt +\n"
-      "         texture2D(u_tex, v_texture + onePixel * vec2(-1,  1)) * wt +\n"
-      "         texture2D(u_tex, v_texture + onePixel * vec2( 0,  1)) * wt +\n"
-      "         texture2D(u_tex, v_texture + onePixel * vec2( 1,  1)) * wt ;\n"
-      "  gl_FragColor = vec4(colorSum.rgb, texture2D(u_tex, v_texture).a);\n"
-      "}\n";
-
-  GLuint vertex_shader = gl_utils_load_shader(VERTEX_SOURCE, GL_VERTEX_SHADER);
-  assert(vertex_shader >= 0);
-  assert(glGetError() == GL_NO_ERROR);
+// Reads the framebuffer back and streams its rows from the pixel pack
+// buffer straight into the encoder. Returns false if either failed.
+bool write_image(int width, int height, const std::string &filename) {
+  PixelReadback readback;
+  readback.start(width, height);
+  return readback.finish([&](const uint8_t *pixels) {
+    return write_image_file(filename, width, height, 3, pixels, 4);
+  });
+}
 
-  GLuint fragment_shader =
-      gl_utils_load_shader(FRAGMENT_SOURCE, GL_FRAGMENT_SHADER);
-  assert(fragment_shader >= 0);
-  assert(glGetError() == GL_NO_ERROR);
+// Filters the top-down RGB @pixels @iterations times with @convolution, and
+// returns them bottom row first like the framebuffer reads.
+std::vector<uint8_t> filter_on_cpu(const std::vector<uint8_t> &pixels,
+                                   int width, int height,
+                                   const CpuConvolution &convolution,
+                                   int iterations) {
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<uint8_t> filtered = pixels;
+  std::vector<uint8_t> scratch(pixels.size());
+  for (int i = 0; i < iterations; ++i) {
+    convolution.apply(filtered.data(), scratch.data(), width, height, 3);
+    filtered.swap(scratch);
+  }
+  const std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  printf("CPU filter (%s): %.3f ms\n", convolution.isa_name(),
+         elapsed.count());
+
+  const size_t row_stride = width * 3;
+  for (int y = 0; y < height / 2; ++y)
+    std::swap_ranges(filtered.begin() + y * row_stride,
+                     filtered.begin() + (y + 1) * row_stride,
+                     filtered.end() - (y + 1) * row_stride);
+
+  return filtered;
+}
 
-  GLuint program = glCreateProgram();
-  assert(glGetError() == GL_NO_ERROR);
-  glAttachShader(program, vertex_shader);
-  assert(glGetError() == GL_NO_ERROR);
-  glAttachShader(program, fragment_shader);
-  assert(glGetError() == GL_NO_ERROR);
+// Prints the largest and mean absolute differences of each channel between
+// the RGB images @a and @b.
+void compare_images(const std::vector<uint8_t> &a,
+                    const std::vector<uint8_t> &b) {
+  assert(a.size() == b.size());
+
+  int max_error[3] = {};
+  double total_error[3] = {};
+  for (size_t i = 0; i < a.size(); ++i) {
+    const int error = std::abs(a[i] - b[i]);
+    max_error[i % 3] = std::max(max_error[i % 3], error);
+    total_error[i % 3] += error;
+  }
 
-  glBindAttribLocation(program, 0, "pos");
-  glBindAttribLocation(program, 1, "texture");
+  const double num_pixels = a.size() / 3;
+  printf("GPU vs CPU error: max %d/%d/%d, mean %.4f/%.4f/%.4f\n",
+         max_error[0], max_error[1], max_error[2],
+         total_error[0] / num_pixels, total_error[1] / num_pixels,
+         total_error[2] / num_pixels);
+}
 
-  glLinkProgram(program);
-  assert(glGetError() == GL_NO_ERROR);
+// Creates an OpenGL-ES context of version 3.1 if @compute shaders are needed
+// and 2.0 otherwise, and makes it current. Falls back to a headless EGL
+// context if there is no display server for the GLFW window.
+std::unique_ptr<GlContext> create_context(ContextBackend backend, int width,
+                                          int height, bool compute) {
+  const int major = compute ? 3 : 2;
+  const int minor = compute ? 1 : 0;
+
+  std::unique_ptr<GlContext> context =
+      GlContext::create(backend, width, height, major, minor);
+  if (context == nullptr && backend == ContextBackend::GLFW_WINDOW) {
+    fprintf(stderr, "No GLFW window, trying a headless EGL context\n");
+    context = GlContext::create(ContextBackend::EGL_HEADLESS, width, height,
+                                major, minor);
+  }
+  if (context == nullptr) return nullptr;
 
-  glDeleteShader(vertex_shader);
-  glDeleteShader(fragment_shader);
+  // Dump some GL capabilities.
+  const GLubyte *gles_version = glGetString(GL_VERSION);
+  printf("%s\n", (char *)gles_version);
+  printf("Context (%s) created in %.3f ms\n",
+         context_backend_name(context->backend()), context->creation_ms());
 
-  return program;
+  return context;
 }
 
-void write_png_image(int width, int height) {
-  std::vector<uint8_t> pixels(width * height * 3);
-
-  // Read the content from the FBO
-  glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
-
-  auto it = pixels.begin();
-  png::image<png::rgb_pixel> output_image(width, height);
-  for (int y = output_image.get_height() - 1; y >= 0; --y) {
-    for (size_t x = 0; x < output_image.get_width(); ++x) {
-      output_image[y][x].red = *it++;
-      output_image[y][x].green = *it++;
-      output_image[y][x].blue = *it++;
-    }
+// Chains @iterations passes of the separable @convolution, if any, or of the
+// single-pass @program, each filtering the output of the previous one. The
+// intermediate images take turns in two pooled textures.
+FilterImage add_filters(FilterGraph &graph, FilterImage input,
+                        const SeparableConvolution *convolution,
+                        GLuint program, int iterations) {
+  FilterImage filtered = input;
+  for (int i = 0; i < iterations; ++i) {
+    const FilterImage next = graph.add_image(
+        graph.width(input), graph.height(input), graph.format(input));
+    if (convolution)
+      convolution->add_passes(graph, filtered, next);
+    else
+      graph.add_pass(program, {filtered}, next);
+    filtered = next;
   }
 
-  output_image.write("output.png");
+  return filtered;
 }
 
-GLuint createAndSetupTexture() {
-  GLuint texture;
-  glGenTextures(1, &texture);
-  assert(glGetError() == GL_NO_ERROR);
-  assert(texture > 0);
-  glBindTexture(GL_TEXTURE_2D, texture);
-  assert(glGetError() == GL_NO_ERROR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-  return texture;
+// Parses comma-separated weights, of which there must be an odd number.
+bool parse_weights(const char *text, std::vector<float> &weights) {
+  weights.clear();
+  for (char *end;; text = end + 1) {
+    weights.push_back(strtof(text, &end));
+    if (end == text) return false;
+    if (*end != ',') return *end == '\0' && weights.size() % 2 == 1;
+  }
 }
 
 int32_t main(int32_t argc, char *argv[]) {
-  printf("Usage: %s <path-to-PNG-image>\n", argv[0]);
+  printf(
+      "Usage: %s [--radius <r>] "
+      "[--kernel box|gaussian|box3x3|sharpen|unsharp|laplacian|sobel-x|"
+      "sobel-y] [--sigma <s>] "
+      "[--weights <w>,<w>,<w>...] [--iterations <n>] "
+      "[--backend fragment|compute|sat|cpu] [--context glfw|egl] [--benchmark] "
+      "[--compare] [--tile-size <n>] "
+      "<path-to-PNG-image> "
+      "[output.png|output.qoi]\n"
+      "       %s [options] --batch <output-dir> <path-to-PNG-image|dir>...\n",
+      argv[0], argv[0]);
+
+  // Any of the kernel options replaces the 3x3 box blur by a separable
+  // convolution.
+  std::vector<std::string> paths;
+  const char *batch_directory = nullptr;
+  bool separable = false;
+  int radius = 1;
+  std::string kernel = "gaussian";
+  float sigma = 0;
+  std::vector<float> weights;
+  int iterations = 1;
+  std::string backend = "fragment";
+  bool benchmark = false;
+  bool compare = false;
+  int tile_size = 0;
+  ContextBackend context_backend = ContextBackend::GLFW_WINDOW;
+  for (int32_t i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "--radius" && i + 1 < argc) {
+      radius = atoi(argv[++i]);
+      separable = true;
+    } else if (arg == "--kernel" && i + 1 < argc) {
+      kernel = argv[++i];
+      separable = true;
+    } else if (arg == "--sigma" && i + 1 < argc) {
+      sigma = atof(argv[++i]);
+      separable = true;
+    } else if (arg == "--weights" && i + 1 < argc) {
+      if (!parse_weights(argv[++i], weights)) return EXIT_FAILURE;
+      separable = true;
+    } else if (arg == "--iterations" && i + 1 < argc) {
+      iterations = atoi(argv[++i]);
+    } else if (arg == "--backend" && i + 1 < argc) {
+      backend = argv[++i];
+    } else if (arg == "--context" && i + 1 < argc) {
+      if (!parse_context_backend(argv[++i], context_backend))
+        return EXIT_FAILURE;
+    } else if (arg == "--benchmark") {
+      benchmark = true;
+    } else if (arg == "--compare") {
+      compare = true;
+    } else if (arg == "--tile-size" && i + 1 < argc) {
+      tile_size = atoi(argv[++i]);
+    } else if (arg == "--batch" && i + 1 < argc) {
+      batch_directory = argv[++i];
+    } else {
+      paths.push_back(arg);
+    }
+  }
 
-  if (argc <= 1) return EXIT_FAILURE;
+  if (paths.empty() || radius < 0 || iterations < 1 || tile_size < 0)
+    return EXIT_FAILURE;
 
-  // Load an decode an image.
-  png::image<png::rgb_pixel> image(argv[1]);
+  // Naming a single-pass kernel overrides the other kernel options.
+  const SinglePassKernel *single_pass = find_single_pass_kernel(kernel);
+  if (single_pass != nullptr)
+    separable = false;
+  else if (!separable)
+    single_pass = BOX_3X3_KERNEL;
+
+  // The compute backend only runs separable kernels, the 3x3 blur as a 3x1
+  // box, and with the CPU backend only on single images. The summed-area
+  // table only runs box blurs.
+  const bool compute = backend == "compute";
+  const bool sat = backend == "sat";
+  bool cpu = backend == "cpu";
+  const bool has_weights = separable || single_pass == BOX_3X3_KERNEL;
+  const bool box = single_pass == BOX_3X3_KERNEL ||
+                   (separable && kernel == "box" && weights.empty());
+  if ((!compute && !sat && !cpu && backend != "fragment") ||
+      ((compute || sat || cpu) && batch_directory != nullptr) ||
+      (sat && !box))
+    return EXIT_FAILURE;
+  if (compute && !has_weights) {
+    fprintf(stderr, "The compute backend doesn't run the %s kernel\n",
+            single_pass->name);
+    return EXIT_FAILURE;
+  }
 
-  GLFWwindow *window;
+  // The Gaussian covers about two sigmas on each side by default.
+  if (sigma <= 0) sigma = radius / 2.0f + 0.5f;
+
+  // The 3x3 blur is a 3x1 box along rows, then along columns.
+  if (!separable) {
+    weights = box_weights(1);
+  } else if (weights.empty()) {
+    if (kernel == "box")
+      weights = box_weights(radius);
+    else if (kernel == "gaussian")
+      weights = gaussian_weights(radius, sigma);
+    else
+      return EXIT_FAILURE;
+  }
 
-  // Initialize GLFW.
-  if (!glfwInit()) return EXIT_FAILURE;
+  if (batch_directory != nullptr) {
+    // Every image renders into pooled framebuffers, so the window is only
+    // there for the context.
+    const std::unique_ptr<GlContext> context =
+        create_context(context_backend, 1, 1, false);
+    if (context == nullptr) return EXIT_FAILURE;
 
-  // Select an OpenGL-ES 2.0 profile.
-  glfwWindowHint(GLFW_CLIENT_API, GLFW_OPENGL_ES_API);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
+    std::unique_ptr<SeparableConvolution> convolution;
+    if (separable)
+      convolution = std::make_unique<SeparableConvolution>(weights, weights);
+    const GLuint program =
+        separable ? 0 : gl_utils_create_program(single_pass->source);
 
-  // Create a windowed mode window and its OpenGL context
-  window = glfwCreateWindow(image.get_width(), image.get_height(),
-                            "GL Image Loader", NULL, NULL);
-  if (window == NULL) {
-    glfwTerminate();
-    return EXIT_FAILURE;
+    const FilterBuilder build = [&](FilterGraph &graph, FilterImage input) {
+      return add_filters(graph, input, convolution.get(), program,
+                         iterations);
+    };
+
+    const bool ok =
+        run_batch(list_batch_inputs(paths), batch_directory, build);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
   }
 
-  // Make the window's context current
-  glfwMakeContextCurrent(window);
-  glfwHideWindow(window);
+  const std::string output_filename =
+      paths.size() > 1 ? paths[1] : "output.png";
 
-  // Dump some GL capabilities.
-  const GLubyte *gles_version = glGetString(GL_VERSION);
-  printf("%s\n", (char *)gles_version);
+  // The other single-pass kernels run on the CPU in one pass as well, and
+  // the 3x3 blur as a separable box like on the compute backend.
+  const CpuConvolution cpu_convolution =
+      has_weights ? CpuConvolution(weights, weights)
+                  : CpuConvolution(single_pass->weights,
+                                   2 * single_pass->radius + 1,
+                                   single_pass->bias);
 
-  // Create a texture for the image.
-  GLuint tex = createAndSetupTexture();
+  // Load an decode an image.
+  png::image<png::rgb_pixel> image(paths[0]);
 
-  // Load the image into the texture
   std::vector<uint8_t> buf(image.get_width() * image.get_height() * 3);
   GLuint format = GL_RGB;  // png::rgb_pixel
 
@@ -184,90 +366,172 @@ int32_t main(int32_t argc, char *argv[]) {
     }
   }
 
-  // Allocate the texture size.
-  glTexImage2D(GL_TEXTURE_2D, 0, format, image.get_width(), image.get_height(),
-               0, format, GL_UNSIGNED_BYTE, buf.data());
-  assert(glGetError() == GL_NO_ERROR);
-
-  // Create a texture for the filtered image.
-  GLuint tex_filtered = createAndSetupTexture();
-
-  // Allocate the filtered texture size.
-  glTexImage2D(GL_TEXTURE_2D, 0, format, image.get_width(), image.get_height(),
-               0, format, GL_UNSIGNED_BYTE, nullptr);
-  assert(glGetError() == GL_NO_ERROR);
-
-  // Create a framebuffer
-  GLuint fbo = 1;
-  glGenFramebuffers(1, &fbo);
-  assert(glGetError() == GL_NO_ERROR);
-  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-  assert(glGetError() == GL_NO_ERROR);
-
-  // Attach a texture to it.
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
-                         tex_filtered, 0);
-  assert(glGetError() == GL_NO_ERROR);
+  // Without an OpenGL-ES context, single images can still be filtered on the
+  // CPU. Everything renders into framebuffers, so the window need not take
+  // the size of the image, which may be beyond what a window can be.
+  std::unique_ptr<GlContext> context;
+  if (!cpu)
+    context =
+        create_context(context_backend, 1, 1, compute || sat || benchmark);
+  if (!cpu && context == nullptr) {
+    if (compute || sat || benchmark || compare) return EXIT_FAILURE;
+
+    fprintf(stderr, "No OpenGL-ES context, filtering on the CPU\n");
+    cpu = true;
+  }
 
-  // Create shader program to sample the texture.
-  GLuint program = create_shader_program();
+  if (cpu) {
+    const std::vector<uint8_t> filtered =
+        filter_on_cpu(buf, image.get_width(), image.get_height(),
+                      cpu_convolution, iterations);
+    return write_image_file(output_filename, image.get_width(),
+                            image.get_height(), 3, filtered.data())
+               ? EXIT_SUCCESS
+               : EXIT_FAILURE;
+  }
 
-  const GLint resolutionLocation =
-      glGetUniformLocation(program, "u_textureSize");
+  std::unique_ptr<SeparableConvolution> convolution;
+  if (separable)
+    convolution = std::make_unique<SeparableConvolution>(weights, weights);
+  const GLuint program =
+      separable ? 0 : gl_utils_create_program(single_pass->source);
+
+  // Images beyond the texture and viewport limits of the context are
+  // filtered in tiles, with halos reaching as far as all the iterations
+  // read, as are all images given a tile size.
+  const int kernel_radius = separable ? static_cast<int>(weights.size() / 2)
+                                      : single_pass->radius;
+  const int halo = kernel_radius * iterations;
+  const int max_extent = max_tile_extent();
+  if (tile_size == 0 && (static_cast<int>(image.get_width()) > max_extent ||
+                         static_cast<int>(image.get_height()) > max_extent)) {
+    tile_size = std::min(DEFAULT_TILE_SIZE, max_extent - 2 * halo);
+    if (tile_size < 1) {
+      fprintf(stderr,
+              "A %d pixel halo leaves no room for tiles within the %d pixel "
+              "limit of the context\n",
+              halo, max_extent);
+      return EXIT_FAILURE;
+    }
+  }
+  if (tile_size > 0) {
+    if (compute || sat || benchmark) {
+      fprintf(stderr, "The %s can't run in tiles\n",
+              compute ? "compute backend" : sat ? "sat backend" : "benchmark");
+      return EXIT_FAILURE;
+    }
 
-  glUseProgram(program);
-  assert(glGetError() == GL_NO_ERROR);
+    const FilterBuilder build = [&](FilterGraph &graph, FilterImage input) {
+      return add_filters(graph, input, convolution.get(), program,
+                         iterations);
+    };
+
+    std::vector<uint8_t> filtered;
+    if (!run_tiled(buf.data(), image.get_width(), image.get_height(), format,
+                   tile_size, halo, build, filtered))
+      return EXIT_FAILURE;
+
+    if (compare)
+      compare_images(filtered, filter_on_cpu(buf, image.get_width(),
+                                             image.get_height(),
+                                             cpu_convolution, iterations));
+
+    return write_image_file(output_filename, image.get_width(),
+                            image.get_height(), 3, filtered.data())
+               ? EXIT_SUCCESS
+               : EXIT_FAILURE;
+  }
 
-  // Tell the shader the resolution of the framebuffer.
-  glUniform2f(resolutionLocation, image.get_width(), image.get_height());
-  assert(glGetError() == GL_NO_ERROR);
+  // Create a texture for the image.
+  GLuint tex = createAndSetupTexture();
 
-  // Render here
-  glClearColor(0.25, 0.25, 0.25, 0.5);
-  glClear(GL_COLOR_BUFFER_BIT);
+  // Load the image into the texture
 
-  // Bind the texture.
-  // glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, tex);
+  // Allocate the texture size. The rows are tightly packed.
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, 0, format, image.get_width(), image.get_height(),
+               0, format, GL_UNSIGNED_BYTE, buf.data());
   assert(glGetError() == GL_NO_ERROR);
 
-  // Enable blending for transparent PNGs.
-  glEnable(GL_BLEND);
-  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-  // Draw a quad.
-  constexpr GLfloat s_vertices[4][2] = {
-      {-1.0, 1.0},
-      {1.0, 1.0},
-      {-1.0, -1.0},
-      {1.0, -1.0},
-  };
+  if (benchmark) {
+    run_convolution_benchmark(tex, image.get_width(), image.get_height(),
+                              format);
+    run_box_blur_benchmark(tex, image.get_width(), image.get_height(),
+                           format);
+    return EXIT_SUCCESS;
+  }
 
-  constexpr GLfloat s_texturePos[4][2] = {
-      {0, 0},
-      {1, 0},
-      {0, 1},
-      {1, 1},
-  };
+  if (compute) {
+    if (static_cast<int>(weights.size() / 2) >
+        ComputeConvolution::max_radius()) {
+      fprintf(stderr, "The compute backend runs radii of up to %d\n",
+              ComputeConvolution::max_radius());
+      return EXIT_FAILURE;
+    }
 
-  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, s_vertices);
-  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, s_texturePos);
+    ComputeConvolution convolution(image.get_width(), image.get_height(),
+                                   weights, weights);
+    GLuint fbo = convolution.apply(tex, true);
+    for (int i = 1; i < iterations; ++i)
+      fbo = convolution.apply(convolution.texture(), false);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    if (compare)
+      compare_images(read_pixels(image.get_width(), image.get_height()),
+                     filter_on_cpu(buf, image.get_width(), image.get_height(),
+                                   cpu_convolution, iterations));
+    return write_image(image.get_width(), image.get_height(),
+                       output_filename)
+               ? EXIT_SUCCESS
+               : EXIT_FAILURE;
+  }
 
-  glEnableVertexAttribArray(0);
-  glEnableVertexAttribArray(1);
+  if (sat) {
+    SummedAreaBlur blur(image.get_width(), image.get_height(),
+                        weights.size() / 2);
+    GLuint fbo = blur.apply(tex, true);
+    for (int i = 1; i < iterations; ++i)
+      fbo = blur.apply(blur.texture(), false);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    if (compare)
+      compare_images(read_pixels(image.get_width(), image.get_height()),
+                     filter_on_cpu(buf, image.get_width(), image.get_height(),
+                                   cpu_convolution, iterations));
+    return write_image(image.get_width(), image.get_height(),
+                       output_filename)
+               ? EXIT_SUCCESS
+               : EXIT_FAILURE;
+  }
 
-  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  TexturePool pool;
+  FilterGraph graph(pool);
 
-  // The framebuffer we are rendering to.
-  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  const FilterImage filtered = add_filters(
+      graph,
+      graph.add_input(tex, image.get_width(), image.get_height(), format),
+      convolution.get(), program, iterations);
 
-  glBindTexture(GL_TEXTURE_2D, tex_filtered);
+  // The framebuffer we are reading from.
+  const auto start = std::chrono::steady_clock::now();
+  glBindFramebuffer(GL_FRAMEBUFFER, graph.execute(filtered));
+  glFinish();
+  const std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
   assert(glGetError() == GL_NO_ERROR);
 
-  glDisableVertexAttribArray(0);
-  glDisableVertexAttribArray(1);
+  printf("Filter graph: %zu passes, %zu pooled textures (%.1f MiB)\n",
+         graph.num_passes(), pool.num_textures(), pool.num_bytes() / 1048576.0);
 
-  write_png_image(image.get_width(), image.get_height());
+  if (compare) {
+    // The first GPU run includes compiling the shaders.
+    printf("GPU filter: %.3f ms\n", elapsed.count());
+    compare_images(read_pixels(image.get_width(), image.get_height()),
+                   filter_on_cpu(buf, image.get_width(), image.get_height(),
+                                 cpu_convolution, iterations));
+  }
 
-  return EXIT_SUCCESS;
-}
\ No newline at end of file
+  return write_image(image.get_width(), image.get_height(), output_filename)
+             ? EXIT_SUCCESS
+             : EXIT_FAILURE;
+}
@@ -0,0 +1,74 @@
+#include "pixel_readback.hpp"
+
+#include <cassert>
+
+#include "gl_utils.hpp"
+
+PixelReadback::PixelReadback() {
+  if (gl_utils_has_pixel_buffers()) {
+    glGenBuffers(1, &buffer_);
+    assert(glGetError() == GL_NO_ERROR);
+  }
+}
+
+PixelReadback::~PixelReadback() {
+  if (fence_ != nullptr) glDeleteSync(fence_);
+  if (buffer_ != 0) glDeleteBuffers(1, &buffer_);
+}
+
+void PixelReadback::start(int width, int height) {
+  assert(!pending_);
+  pending_ = true;
+  size_ = static_cast<size_t>(width) * height * 4;
+
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  if (buffer_ == 0) {
+    pixels_.resize(size_);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE,
+                 pixels_.data());
+    assert(glGetError() == GL_NO_ERROR);
+    return;
+  }
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer_);
+  if (size_ > buffer_size_) {
+    glBufferData(GL_PIXEL_PACK_BUFFER, size_, nullptr, GL_STREAM_READ);
+    buffer_size_ = size_;
+  }
+  glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  // Submits the copy now, so it runs while the CPU goes on.
+  fence_ = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  glFlush();
+  assert(glGetError() == GL_NO_ERROR);
+}
+
+bool PixelReadback::finish(
+    const std::function<bool(const uint8_t *pixels)> &consume) {
+  assert(pending_);
+  pending_ = false;
+
+  if (buffer_ == 0) return consume(pixels_.data());
+
+  constexpr GLuint64 WAIT_NANOSECONDS = 1000000;
+  GLenum status;
+  do {
+    status = glClientWaitSync(fence_, 0, WAIT_NANOSECONDS);
+  } while (status == GL_TIMEOUT_EXPIRED);
+  glDeleteSync(fence_);
+  fence_ = nullptr;
+  if (status == GL_WAIT_FAILED) return false;
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer_);
+  const void *pixels =
+      glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size_, GL_MAP_READ_BIT);
+  const bool ok =
+      pixels != nullptr && consume(static_cast<const uint8_t *>(pixels));
+
+  if (pixels != nullptr) glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  assert(glGetError() == GL_NO_ERROR);
+
+  return ok;
+}
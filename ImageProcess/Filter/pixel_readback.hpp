@@ -0,0 +1,49 @@
+#pragma once
+
+#include <GLES3/gl3.h>
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Reads RGBA framebuffers back through a pixel pack buffer. glReadPixels()
+// then only queues the copy, and a fence tells when it has landed, so the
+// CPU waits for the GPU when it needs the pixels rather than when it asks
+// for them. The rows are handed out straight from the mapped buffer.
+//
+// Pixel pack buffers need OpenGL ES 3.0. On 2.0 contexts start() reads the
+// pixels into memory right away.
+class PixelReadback {
+ public:
+  PixelReadback();
+  ~PixelReadback();
+
+  PixelReadback(const PixelReadback &) = delete;
+  PixelReadback &operator=(const PixelReadback &) = delete;
+
+  // Starts reading the bound framebuffer. finish() must be called before the
+  // next start().
+  void start(int width, int height);
+
+  // Waits for the pixels started last and passes them to @consume, bottom
+  // row first, before unmapping them. Returns what @consume returns, or
+  // false without calling it if the pixels could not be mapped.
+  bool finish(const std::function<bool(const uint8_t *pixels)> &consume);
+
+  bool pending() const { return pending_; }
+
+  // Whether the pixels go through a pixel pack buffer.
+  bool asynchronous() const { return buffer_ != 0; }
+
+ private:
+  GLuint buffer_ = 0;
+  size_t buffer_size_ = 0;
+
+  GLsync fence_ = nullptr;
+
+  size_t size_ = 0;
+  bool pending_ = false;
+
+  // The pixels read without a pixel pack buffer.
+  std::vector<uint8_t> pixels_;
+};
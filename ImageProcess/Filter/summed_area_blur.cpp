@@ -0,0 +1,207 @@
+#include "summed_area_blur.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <string>
+
+#include "gl_utils.hpp"
+
+// Each work group scans one row of the padded image, or one column of the
+// row sums for the vertical pass, and stores the sum of everything before
+// each entry. The scan is shifted by one entry, so the table starts with a
+// row and a column of zeros and needs no edge cases. Rows are stored with
+// the first at y = 0, like in uploaded images, so the rows pass flips
+// rendered inputs.
+static std::string scan_source(int radius, bool vertical) {
+  char header[256];
+  snprintf(header, sizeof(header),
+           "#version 310 es\n"
+           "#define GROUP_SIZE %d\n"
+           "#define RADIUS %d\n"
+           "#define VERTICAL %d\n",
+           SummedAreaBlur::GROUP_SIZE, radius, vertical);
+
+  std::string source = header;
+  source +=
+      "precision highp float;\n"
+      "precision highp int;\n"
+      "layout(local_size_x = GROUP_SIZE) in;\n"
+      "#if VERTICAL\n"
+      "layout(binding = 0) uniform highp usampler2D u_tex;\n"
+      "#else\n"
+      "layout(binding = 0) uniform highp sampler2D u_tex;\n"
+      "#endif\n"
+      "layout(rgba32ui, binding = 0) writeonly uniform highp uimage2D "
+      "u_output;\n"
+      "uniform bool u_flip_input;\n"
+      "shared uvec4 run[GROUP_SIZE];\n"
+      "ivec2 pixel(int along, int across) {\n"
+      "  return VERTICAL != 0 ? ivec2(across, along) : ivec2(along, across);\n"
+      "}\n"
+      "uvec4 value(int along, int across) {\n"
+      "  if (along == 0) return uvec4(0u);\n"
+      "#if VERTICAL\n"
+      "  return texelFetch(u_tex, pixel(along - 1, across), 0);\n"
+      "#else\n"
+      // Edge pixels repeat for the radius beyond the image.
+      "  ivec2 size = textureSize(u_tex, 0);\n"
+      "  ivec2 source = clamp(ivec2(along - 1, across) - RADIUS, ivec2(0),\n"
+      "                       size - 1);\n"
+      "  if (u_flip_input) source.y = size.y - 1 - source.y;\n"
+      "  return uvec4(texelFetch(u_tex, source, 0) * 255.0 + 0.5);\n"
+      "#endif\n"
+      "}\n"
+      "void main() {\n"
+      "  ivec2 size = imageSize(u_output);\n"
+      "  int length = VERTICAL != 0 ? size.y : size.x;\n"
+      "  int across = int(gl_WorkGroupID.y);\n"
+      "  int local = int(gl_LocalInvocationID.x);\n"
+      "  uvec4 carry = uvec4(0u);\n"
+      "  for (int first = 0; first < length; first += GROUP_SIZE) {\n"
+      "    int along = first + local;\n"
+      "    run[local] = along < length ? value(along, across) : uvec4(0u);\n"
+      "    barrier();\n"
+      // Each step adds the partial sum from twice as far back.
+      "    for (int offset = 1; offset < GROUP_SIZE; offset *= 2) {\n"
+      "      uvec4 previous = local >= offset ? run[local - offset]\n"
+      "                                       : uvec4(0u);\n"
+      "      barrier();\n"
+      "      run[local] += previous;\n"
+      "      barrier();\n"
+      "    }\n"
+      "    if (along < length)\n"
+      "      imageStore(u_output, pixel(along, across), carry + run[local]);\n"
+      "    carry += run[GROUP_SIZE - 1];\n"
+      "    barrier();\n"
+      "  }\n"
+      "}\n";
+
+  return source;
+}
+
+// Each invocation sums the box around one pixel from the four corners of
+// the table, and stores the average with the first row at the top. The
+// box of a pixel starts at its own entry of the padded image.
+static std::string box_source(int radius) {
+  char header[256];
+  snprintf(header, sizeof(header),
+           "#version 310 es\n"
+           "#define GROUP_SIZE %d\n"
+           "#define RADIUS %d\n",
+           SummedAreaBlur::GROUP_SIZE, radius);
+
+  std::string source = header;
+  source +=
+      "precision highp float;\n"
+      "precision highp int;\n"
+      "layout(local_size_x = GROUP_SIZE) in;\n"
+      "layout(binding = 0) uniform highp usampler2D u_table;\n"
+      "layout(rgba8, binding = 0) writeonly uniform highp image2D u_output;\n"
+      "const int SPAN = 2 * RADIUS + 1;\n"
+      "void main() {\n"
+      "  ivec2 size = imageSize(u_output);\n"
+      "  ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);\n"
+      "  if (pixel.x >= size.x) return;\n"
+      "  uvec4 sum = texelFetch(u_table, pixel + ivec2(SPAN, SPAN), 0) -\n"
+      "              texelFetch(u_table, pixel + ivec2(0, SPAN), 0) -\n"
+      "              texelFetch(u_table, pixel + ivec2(SPAN, 0), 0) +\n"
+      "              texelFetch(u_table, pixel, 0);\n"
+      "  vec4 color = vec4(sum) / (255.0 * float(SPAN * SPAN));\n"
+      "  imageStore(u_output, ivec2(pixel.x, size.y - 1 - pixel.y), color);\n"
+      "}\n";
+
+  return source;
+}
+
+// Integer textures can't be filtered, and are incomplete unless sampled
+// with the nearest filter.
+static GLuint create_table_texture(int width, int height) {
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32UI, width, height);
+  assert(glGetError() == GL_NO_ERROR);
+
+  return texture;
+}
+
+SummedAreaBlur::SummedAreaBlur(int width, int height, int radius)
+    : width_(width), height_(height), radius_(radius) {
+  assert(radius >= 0);
+
+  program_[0] = gl_utils_create_compute_program(scan_source(radius, false));
+  program_[1] = gl_utils_create_compute_program(scan_source(radius, true));
+  program_[2] = gl_utils_create_compute_program(box_source(radius));
+
+  // The row sums have no leading row of zeros yet.
+  const int table_width = width + 2 * radius + 1;
+  table_[0] = create_table_texture(table_width, height + 2 * radius);
+  table_[1] = create_table_texture(table_width, height + 2 * radius + 1);
+
+  // Images written by compute shaders need immutable storage.
+  texture_ = createAndSetupTexture();
+  glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+  assert(glGetError() == GL_NO_ERROR);
+
+  glGenFramebuffers(1, &fbo_);
+  assert(glGetError() == GL_NO_ERROR);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+  assert(glGetError() == GL_NO_ERROR);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                         texture_, 0);
+  assert(glGetError() == GL_NO_ERROR);
+}
+
+SummedAreaBlur::~SummedAreaBlur() {
+  glDeleteFramebuffers(1, &fbo_);
+  glDeleteTextures(1, &texture_);
+  glDeleteTextures(2, table_);
+  for (GLuint program : program_) glDeleteProgram(program);
+}
+
+double SummedAreaBlur::table_ratio() const {
+  const double entries = (width_ + 2.0 * radius_ + 1) *
+                         (height_ + 2.0 * radius_ + 1);
+  return entries / (static_cast<double>(width_) * height_);
+}
+
+GLuint SummedAreaBlur::apply(GLuint source, bool source_uploaded) {
+  const GLuint inputs[3] = {source, table_[0], table_[1]};
+  const GLuint outputs[3] = {table_[0], table_[1], texture_};
+  const GLenum formats[3] = {GL_RGBA32UI, GL_RGBA32UI, GL_RGBA8};
+
+  // A work group per padded row and per table column, then a run of pixels
+  // of each row per work group.
+  const int groups[3][2] = {
+      {1, height_ + 2 * radius_},
+      {1, width_ + 2 * radius_ + 1},
+      {(width_ + GROUP_SIZE - 1) / GROUP_SIZE, height_},
+  };
+
+  for (int pass = 0; pass < 3; ++pass) {
+    glUseProgram(program_[pass]);
+    if (pass == 0)
+      glUniform1i(glGetUniformLocation(program_[pass], "u_flip_input"),
+                  !source_uploaded);
+    assert(glGetError() == GL_NO_ERROR);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, inputs[pass]);
+    glBindImageTexture(0, outputs[pass], 0, GL_FALSE, 0, GL_WRITE_ONLY,
+                       formats[pass]);
+    assert(glGetError() == GL_NO_ERROR);
+
+    glDispatchCompute(groups[pass][0], groups[pass][1], 1);
+    assert(glGetError() == GL_NO_ERROR);
+
+    // The next pass fetches what this one stored, and the caller reads the
+    // last one back through the framebuffer.
+    glMemoryBarrier(pass < 2 ? GL_TEXTURE_FETCH_BARRIER_BIT
+                             : GL_FRAMEBUFFER_BARRIER_BIT |
+                                   GL_TEXTURE_FETCH_BARRIER_BIT);
+  }
+
+  return fbo_;
+}
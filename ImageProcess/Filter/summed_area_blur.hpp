@@ -0,0 +1,55 @@
+#pragma once
+
+#include <GLES3/gl31.h>
+
+// Box blurs an image in constant time per pixel, whatever the radius, from
+// its summed-area table: each entry holds the sum of the pixels above and
+// to the left of it. The sum over any box is then the difference of the
+// table at its four corners.
+//
+// The table is built by prefix sums along rows and then along columns, two
+// compute dispatches in which each work group scans a row or a column in
+// runs of GROUP_SIZE pixels, in log2(GROUP_SIZE) steps through shared
+// memory, carrying the total of each run to the next. The image is padded
+// with the radius of repeated edge pixels first, like the clamped texture
+// coordinates of the fragment passes, so every box lies within the table.
+//
+// The table holds 32-bit unsigned integers, which wrap around on large
+// images. The wrap cancels out in the difference, so boxes of up to 2^24
+// pixels still sum exactly. Alpha is blurred along with the colors.
+//
+// Needs OpenGL ES 3.1.
+class SummedAreaBlur {
+ public:
+  // Pixels scanned by each work group at a time.
+  static constexpr int GROUP_SIZE = 128;
+
+  SummedAreaBlur(int width, int height, int radius);
+  ~SummedAreaBlur();
+
+  SummedAreaBlur(const SummedAreaBlur &) = delete;
+  SummedAreaBlur &operator=(const SummedAreaBlur &) = delete;
+
+  // Filters @source, of the size given at construction, into texture().
+  // Returns the framebuffer holding the result, with its first row at the
+  // top like rendered images. An uploaded @source has its first row at
+  // t = 0. @source may be texture() itself, to filter again.
+  GLuint apply(GLuint source, bool source_uploaded);
+
+  GLuint texture() const { return texture_; }
+
+  // Table entries per pixel of the image, each fetched once per scan.
+  double table_ratio() const;
+
+ private:
+  int width_;
+  int height_;
+  int radius_;
+
+  // The row sums, the summed-area table and the box sums.
+  GLuint program_[3];
+
+  GLuint table_[2];
+  GLuint texture_;
+  GLuint fbo_;
+};
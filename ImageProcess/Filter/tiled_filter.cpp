@@ -0,0 +1,205 @@
+#include "tiled_filter.hpp"
+
+#include <GLES3/gl3.h>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include "gl_utils.hpp"
+#include "pixel_readback.hpp"
+
+namespace {
+
+// A tile along one axis: the pixels it renders, and the region uploaded
+// around them.
+struct TileSpan {
+  int start;
+  int size;
+  int region_start;
+};
+
+struct Tile {
+  TileSpan x;
+  TileSpan y;
+};
+
+// Splits @length pixels into spans of @tile_size, each within a region of
+// @region_size that reaches @halo beyond it but not beyond the image.
+std::vector<TileSpan> split_spans(int length, int tile_size, int halo,
+                                  int region_size) {
+  std::vector<TileSpan> spans;
+  for (int start = 0; start < length; start += tile_size) {
+    const int region_start =
+        std::clamp(start - halo, 0, length - region_size);
+    spans.push_back({start, std::min(tile_size, length - start), region_start});
+  }
+
+  return spans;
+}
+
+}  // namespace
+
+int max_tile_extent() {
+  GLint max_texture_size = 0;
+  GLint max_viewport_dims[2] = {};
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+  glGetIntegerv(GL_MAX_VIEWPORT_DIMS, max_viewport_dims);
+  assert(glGetError() == GL_NO_ERROR);
+
+  return std::min({max_texture_size, max_viewport_dims[0],
+                   max_viewport_dims[1]});
+}
+
+bool run_tiled(const uint8_t *pixels, int width, int height, GLenum format,
+               int tile_size, int halo, const FilterBuilder &build,
+               std::vector<uint8_t> &filtered) {
+  if (tile_size < 1) return false;
+
+  const int region_width = std::min(tile_size + 2 * halo, width);
+  const int region_height = std::min(tile_size + 2 * halo, height);
+  const int max_extent = max_tile_extent();
+  if (region_width > max_extent || region_height > max_extent) {
+    fprintf(stderr,
+            "Tiles of %d pixels with a %d pixel halo exceed the %d pixel "
+            "limit of the context\n",
+            tile_size, halo, max_extent);
+    return false;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+
+  const int channels = format == GL_RGBA ? 4 : 3;
+  const size_t region_stride = static_cast<size_t>(region_width) * channels;
+  const size_t region_bytes = region_stride * region_height;
+
+  std::vector<Tile> tiles;
+  for (const TileSpan &y :
+       split_spans(height, tile_size, halo, region_height)) {
+    for (const TileSpan &x : split_spans(width, tile_size, halo, region_width))
+      tiles.push_back({x, y});
+  }
+
+  // Every upload is the same size, so the textures are allocated once, and
+  // the pool only ever holds the intermediate images of one tile.
+  GLuint textures[2];
+  for (GLuint &texture : textures) {
+    texture = createAndSetupTexture();
+    glTexImage2D(GL_TEXTURE_2D, 0, format, region_width, region_height, 0,
+                 format, GL_UNSIGNED_BYTE, nullptr);
+    assert(glGetError() == GL_NO_ERROR);
+  }
+
+  const bool pixel_buffers = gl_utils_has_pixel_buffers();
+  GLuint unpack_buffers[2] = {};
+  std::vector<uint8_t> region_pixels;
+  if (pixel_buffers) {
+    glGenBuffers(2, unpack_buffers);
+    for (GLuint buffer : unpack_buffers) {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+      glBufferData(GL_PIXEL_UNPACK_BUFFER, region_bytes, nullptr,
+                   GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    assert(glGetError() == GL_NO_ERROR);
+  } else {
+    region_pixels.resize(region_bytes);
+  }
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+  // Copies the region of @tile into @slot. The copy into a pixel unpack
+  // buffer is all the CPU does; the texture is filled from it on the GPU.
+  const auto upload = [&](size_t slot, const Tile &tile) {
+    uint8_t *region = region_pixels.data();
+    if (pixel_buffers) {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpack_buffers[slot]);
+      region = static_cast<uint8_t *>(glMapBufferRange(
+          GL_PIXEL_UNPACK_BUFFER, 0, region_bytes,
+          GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+      assert(region != nullptr);
+    }
+
+    for (int y = 0; y < region_height; ++y) {
+      const size_t row = static_cast<size_t>(tile.y.region_start + y) * width;
+      memcpy(region + y * region_stride,
+             pixels + (row + tile.x.region_start) * channels, region_stride);
+    }
+    if (pixel_buffers) glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    glBindTexture(GL_TEXTURE_2D, textures[slot]);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, region_width, region_height,
+                    format, GL_UNSIGNED_BYTE, pixel_buffers ? nullptr : region);
+    if (pixel_buffers) glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    assert(glGetError() == GL_NO_ERROR);
+  };
+
+  // Copies the pixels @tile renders out of its bottom-up RGBA @region.
+  filtered.assign(static_cast<size_t>(width) * height * 3, 0);
+  const auto stitch = [&](const Tile &tile, const uint8_t *region) {
+    for (int y = tile.y.start; y < tile.y.start + tile.y.size; ++y) {
+      const int region_row = region_height - 1 - (y - tile.y.region_start);
+      const uint8_t *source =
+          region + (static_cast<size_t>(region_row) * region_width +
+                    tile.x.start - tile.x.region_start) *
+                       4;
+      uint8_t *destination =
+          filtered.data() +
+          (static_cast<size_t>(height - 1 - y) * width + tile.x.start) * 3;
+      for (int x = 0; x < tile.x.size; ++x)
+        memcpy(destination + x * 3, source + x * 4, 3);
+    }
+
+    return true;
+  };
+
+  TexturePool pool;
+  PixelReadback readbacks[2];
+  size_t num_drawn = 0;
+  Tile in_flight = {};
+  bool ok = true;
+  for (const Tile &tile : tiles) {
+    const size_t slot = num_drawn % 2;
+    upload(slot, tile);
+
+    FilterGraph graph(pool);
+    const GLuint fbo = graph.execute(build(
+        graph, graph.add_input(textures[slot], region_width, region_height,
+                               format)));
+    if (fbo == 0) {
+      ok = false;
+      break;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    readbacks[slot].start(region_width, region_height);
+    ++num_drawn;
+
+    PixelReadback &previous = readbacks[num_drawn % 2];
+    if (previous.pending())
+      previous.finish([&](const uint8_t *region) {
+        return stitch(in_flight, region);
+      });
+    in_flight = tile;
+  }
+
+  PixelReadback &last = readbacks[(num_drawn + 1) % 2];
+  if (last.pending())
+    last.finish(
+        [&](const uint8_t *region) { return stitch(in_flight, region); });
+
+  if (pixel_buffers) glDeleteBuffers(2, unpack_buffers);
+  glDeleteTextures(2, textures);
+
+  const std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  printf("Tiled filter: %zu tiles of %dx%d with a %d pixel halo in %.3f ms\n",
+         tiles.size(), region_width, region_height, halo, elapsed.count());
+  printf("  uploads: %.1f MiB, pooled textures: %zu (%.1f MiB)\n",
+         2 * region_bytes / 1048576.0, pool.num_textures(),
+         pool.num_bytes() / 1048576.0);
+
+  return ok;
+}
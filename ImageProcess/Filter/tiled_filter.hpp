@@ -0,0 +1,33 @@
+#pragma once
+
+#include <GLES2/gl2.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "filter_graph.hpp"
+
+// The largest texture and viewport the current context takes on both sides.
+int max_tile_extent();
+
+// Filters an image in tiles, for images larger than the textures or
+// viewports of the context, or than GPU memory holds at once. Each tile is
+// uploaded with a @halo of the pixels around it, all the filters read to
+// render it, so the tiles put together are the image filtered whole. Tiles
+// at the borders of the image have their halo clamped to it and shifted
+// inwards, which keeps every upload the same size and the sampling clamped
+// to the edges of a tile clamped to those of the image.
+//
+// The next tile is uploaded, through a pixel unpack buffer on OpenGL ES
+// 3.0, while the GPU draws the last one, and the one before is stitched in
+// while its pixels come back through a pixel pack buffer. Two uploads and
+// readbacks take turns, so GPU memory holds a couple of tiles whatever the
+// size of the image.
+//
+// The top-down @pixels have 3 channels if @format is GL_RGB and 4 if it is
+// GL_RGBA. @filtered gets RGB rows, bottom row first like the framebuffer
+// reads. Returns false if a tile with its halo is beyond max_tile_extent()
+// or failed.
+bool run_tiled(const uint8_t *pixels, int width, int height, GLenum format,
+               int tile_size, int halo, const FilterBuilder &build,
+               std::vector<uint8_t> &filtered);
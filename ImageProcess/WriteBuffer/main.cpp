@@ -5,8 +5,11 @@
 #include <GL/glut.h>
 
 #include <cmath>
+#include <functional>
 #include <iostream>
-#include <png++/png.hpp>
+#include <string>
+
+#include "../Filter/image_writer.hpp"
 
 // Vertex Shader source code
 const char* vertexShaderSource =
@@ -26,23 +29,38 @@ const char* fragmentShaderSource =
     "   frag_color = vec4(1.0f, 1.0f, 0.5f, 1.0f);\n"
     "}\n\0";
 
-void write_png_image(int width, int height) {
-  std::vector<uint8_t> pixels(width * height * 3);
-
-  glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
-
-  auto it = pixels.begin();
-  // Write upside down
-  png::image<png::rgb_pixel> output_image(width, height);
-  for (int y = output_image.get_height() - 1; y >= 0; --y) {
-    for (size_t x = 0; x < output_image.get_width(); ++x) {
-      output_image[y][x].red = *it++;
-      output_image[y][x].green = *it++;
-      output_image[y][x].blue = *it++;
-    }
-  }
-
-  output_image.write("output.png");
+// Reads the framebuffer into a pixel pack buffer, which only queues the
+// copy, and waits on a fence for it to land. The rows are then passed to
+// @write bottom-up, straight from the mapped buffer.
+bool read_back(int width, int height,
+               const std::function<bool(const uint8_t*)>& write) {
+  const size_t size = static_cast<size_t>(width) * height * 3;
+
+  GLuint buffer;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+  glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+  GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+  // The first wait flushes the copy to the GPU.
+  GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+  while (status == GL_TIMEOUT_EXPIRED)
+    status = glClientWaitSync(fence, 0, 1000000);
+  glDeleteSync(fence);
+
+  const void* pixels =
+      glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+  const bool ok = status != GL_WAIT_FAILED && pixels != nullptr &&
+                  write(static_cast<const uint8_t*>(pixels));
+  if (pixels != nullptr) glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  glDeleteBuffers(1, &buffer);
+
+  return ok;
 }
 
 int main(int argc, char** argv) {
@@ -53,6 +71,9 @@ int main(int argc, char** argv) {
   glutCreateWindow("Triangle");
   glutHideWindow();
 
+  // glutInit() removed its own options, what is left is the output path.
+  const std::string output_filename = argc > 1 ? argv[1] : "output.png";
+
   glewInit();
 
   // Vertices coordinates
@@ -124,12 +145,16 @@ int main(int argc, char** argv) {
   glDrawArrays(GL_TRIANGLES, 0, 3);
 
   // Write buffer contents
-  write_png_image(glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT));
+  const int width = glutGet(GLUT_WINDOW_WIDTH);
+  const int height = glutGet(GLUT_WINDOW_HEIGHT);
+  const bool written = read_back(width, height, [&](const uint8_t* pixels) {
+    return write_image_file(output_filename, width, height, 3, pixels);
+  });
 
   // Delete all the objects created
   glDeleteVertexArrays(1, &VAO);
   glDeleteBuffers(1, &VBO);
   glDeleteProgram(shaderProgram);
 
-  return EXIT_SUCCESS;
+  return written ? EXIT_SUCCESS : EXIT_FAILURE;
 }